@@ -0,0 +1,190 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "batch.h"
+
+/**
+   \struct slot_s
+   \brief an instance in the queue between the reader and the writer
+
+   \c result is the line to write, and it is valid only when \c done is
+   \c true. \c index is the index of the instance in the input file.
+   The instance is allocated in \c arena, that is reused by the next
+   instance stored in the slot.
+*/
+typedef struct slot_s {
+        state_s state;
+        arena_s arena;
+        char *result;
+        uint64_t index;
+        bool done;
+} slot_s;
+
+/**
+   \brief the stack of nodes owned by the calling thread, allocated the first
+   time that the thread solves an instance. All instances of a file have the
+   same size, hence the stack can be reused.
+*/
+static level_s *
+thread_levels(level_s **stacks, arena_s *arenas, const state_s *stp) {
+        uint32_t thread = omp_get_thread_num();
+        if (stacks[thread] == NULL)
+                stacks[thread] = new_levels(stp->num_species_orig, stp->num_characters_orig, arenas + thread);
+        return stacks[thread];
+}
+
+/**
+   \brief the threads that solve the instances, and what each of them owns
+*/
+typedef struct workers_s {
+        uint32_t engine;
+        level_s **stacks;
+        arena_s *arenas;
+        memo_s *memos;
+        sat_engine_s *sat_engines;
+} workers_s;
+
+static void
+solve_slot(slot_s *slot, const workers_s *wp, strategy_fn strategy,
+           const search_limits_s *limits, bool write_counters, bool json, FILE *outf, bool ordered) {
+        state_s *stp = &(slot->state);
+        uint32_t thread = omp_get_thread_num();
+        search_counters_s counters;
+        char *tree = NULL;
+        uint32_t status;
+        if (wp->engine == ENGINE_SAT) {
+                status = sat_search(wp->sat_engines + thread, stp, limits, &counters, &tree);
+        } else if (wp->engine == ENGINE_PORTFOLIO) {
+                status = portfolio_search(stp, thread_levels(wp->stacks, wp->arenas, stp), strategy, wp->memos + thread,
+                                          wp->sat_engines + thread, limits, &counters, &tree);
+        } else {
+                level_s *levels = thread_levels(wp->stacks, wp->arenas, stp);
+                status = exhaustive_search(stp, levels, strategy, wp->memos + thread, limits, &counters,
+                                           stp->num_species + 2 * stp->num_characters);
+                if (status == SEARCH_FOUND) {
+                        tree = newick(stp, levels);
+                        free_subtrees(levels);
+                }
+        }
+        char *result = result_line(status, tree, write_counters ? &counters : NULL, json, slot->index);
+        if (tree != NULL)
+                xfree(tree);
+        if (!ordered) {
+#pragma omp critical(batch_output)
+                fprintf(outf, "%s\n", result);
+        }
+        slot->result = result;
+#pragma omp atomic write seq_cst
+        slot->done = true;
+}
+
+/**
+   \brief writes the results of the instances that have been solved, starting
+   from the instance \c first and stopping at the first instance still to be
+   solved, or at the instance \c last.
+
+   \return the first instance whose result has not been written
+*/
+static uint64_t
+write_results(slot_s *queue, uint32_t window, uint64_t first, uint64_t last, FILE *outf, bool ordered) {
+        for (; first < last; first++) {
+                slot_s *slot = queue + (first % window);
+                bool done;
+#pragma omp atomic read seq_cst
+                done = slot->done;
+                if (!done)
+                        break;
+                if (ordered)
+                        fprintf(outf, "%s\n", slot->result);
+                xfree(slot->result);
+                slot->result = NULL;
+        }
+        return first;
+}
+
+void
+solve_batch(instances_schema_s *props, FILE *outf, uint32_t engine, strategy_fn strategy, size_t memo_size, uint32_t jobs,
+            bool ordered, const search_limits_s *limits, bool write_counters, bool json) {
+        uint32_t window = 4 * jobs;
+        slot_s *queue = xmalloc_root(window * sizeof(slot_s));
+        for (uint32_t i = 0; i < window; i++)
+                arena_init(&(queue[i].arena));
+        level_s **stacks = xmalloc_root(jobs * sizeof(level_s *));
+        arena_s *arenas = xmalloc_root(jobs * sizeof(arena_s));
+        memo_s *memos = xmalloc_root(jobs * sizeof(memo_s));
+        sat_engine_s *sat_engines = xmalloc_root(jobs * sizeof(sat_engine_s));
+        for (uint32_t i = 0; i < jobs; i++) {
+                arena_init(arenas + i);
+                memo_init(memos + i, (engine != ENGINE_SAT) ? memo_size / jobs : 0);
+                sat_engine_init(sat_engines + i);
+        }
+        workers_s workers = {
+                .engine = engine,
+                .stacks = stacks,
+                .arenas = arenas,
+                .memos = memos,
+                .sat_engines = sat_engines
+        };
+        memory_init_threads();
+#pragma omp parallel default(shared) num_threads(jobs)
+        {
+                memory_register_thread();
+#pragma omp barrier
+#pragma omp single
+                {
+                        uint64_t next_read = 0;
+                        uint64_t next_write = 0;
+                        for (;;) {
+                                next_write = write_results(queue, window, next_write, next_read, outf, ordered);
+                                if (next_read - next_write == window) {
+/* The queue is full: the reader helps solving the instances in the queue */
+#pragma omp taskwait
+                                        continue;
+                                }
+                                slot_s *slot = queue + (next_read % window);
+                                props->arena = &(slot->arena);
+                                if (!read_instance_from_filename(props, &(slot->state)))
+                                        break;
+                                check_state(&(slot->state));
+                                slot->result = NULL;
+                                slot->index = props->next_instance - 1;
+                                slot->done = false;
+                                next_read++;
+#pragma omp task default(shared) firstprivate(slot)
+                                solve_slot(slot, &workers, strategy, limits, write_counters, json, outf, ordered);
+                        }
+#pragma omp taskwait
+                        write_results(queue, window, next_write, next_read, outf, ordered);
+                }
+        }
+        for (uint32_t i = 0; i < jobs; i++) {
+                arena_release(arenas + i);
+                memo_release(memos + i);
+                sat_engine_release(sat_engines + i);
+        }
+        for (uint32_t i = 0; i < window; i++)
+                arena_release(&(queue[i].arena));
+        props->arena = NULL;
+        xfree(sat_engines);
+        xfree(memos);
+        xfree(arenas);
+        xfree(stacks);
+        xfree(queue);
+}
@@ -0,0 +1,42 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "portfolio.h"
+
+/**
+   \brief solves all instances of the file described by \c props, writing
+   their trees (or "Not found") to \c outf, one line per instance.
+
+   A reader parses the instances into a bounded queue, and a team of
+   \c jobs OpenMP threads solves them with the engine \c engine, each with
+   its own preallocated stack of nodes of the decision tree and its own SAT
+   solver.
+   If \c ordered is \c true the results are written in the same order as the
+   instances of the input file, otherwise each result is written as soon as
+   it is computed.
+   Each thread has its own table of the instances without a solution, and
+   all tables together take at most \c memo_size bytes.
+   Each instance is solved within the budget \c limits, and if
+   \c write_counters is \c true its result is followed by the counters of
+   its search, as computed by \c result_line, in JSON if \c json is \c true.
+*/
+void
+solve_batch(instances_schema_s *props, FILE *outf, uint32_t engine, strategy_fn strategy, size_t memo_size, uint32_t jobs,
+            bool ordered, const search_limits_s *limits, bool write_counters, bool json);
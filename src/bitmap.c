@@ -0,0 +1,183 @@
+/* Licensed under LGPLv2+
+   Vectorized kernels for the set operations of bitmap.h
+*/
+#include "bitmap.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static bool
+includes_scalar(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        bitmap_word w = 0;
+        for (size_t i = 0; i < nwords; i++)
+                w |= src1[i] & ~src2[i];
+        return w == 0;
+}
+
+static bool
+equal_scalar(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        bitmap_word w = 0;
+        for (size_t i = 0; i < nwords; i++)
+                w |= src1[i] ^ src2[i];
+        return w == 0;
+}
+
+static void
+difference_scalar(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        for (size_t i = 0; i < nwords; i++)
+                dst[i] = src1[i] & ~src2[i];
+}
+
+#if defined(__x86_64__)
+/*
+  Each kernel processes 4 (AVX2) or 8 (AVX-512) words at a time, and the
+  words left by the scalar kernel. The loads are unaligned, since the
+  bitmaps can start at any word of a row or of a slab.
+*/
+__attribute__((target("avx2"))) static bool
+includes_avx2(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 4 <= nwords; i += 4) {
+                __m256i a = _mm256_loadu_si256((const __m256i*) (src1 + i));
+                __m256i b = _mm256_loadu_si256((const __m256i*) (src2 + i));
+/* testc is 1 iff a & ~b is zero */
+                if (!_mm256_testc_si256(b, a))
+                        return false;
+        }
+        return includes_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+__attribute__((target("avx2"))) static bool
+equal_avx2(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 4 <= nwords; i += 4) {
+                __m256i a = _mm256_loadu_si256((const __m256i*) (src1 + i));
+                __m256i b = _mm256_loadu_si256((const __m256i*) (src2 + i));
+                __m256i x = _mm256_xor_si256(a, b);
+                if (!_mm256_testz_si256(x, x))
+                        return false;
+        }
+        return equal_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+__attribute__((target("avx2"))) static void
+difference_avx2(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 4 <= nwords; i += 4) {
+                __m256i a = _mm256_loadu_si256((const __m256i*) (src1 + i));
+                __m256i b = _mm256_loadu_si256((const __m256i*) (src2 + i));
+                _mm256_storeu_si256((__m256i*) (dst + i), _mm256_andnot_si256(b, a));
+        }
+        difference_scalar(dst + i, src1 + i, src2 + i, nwords - i);
+}
+
+__attribute__((target("avx512f"))) static bool
+includes_avx512(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 8 <= nwords; i += 8) {
+                __m512i a = _mm512_loadu_si512(src1 + i);
+                __m512i b = _mm512_loadu_si512(src2 + i);
+                __m512i x = _mm512_andnot_si512(b, a);
+                if (_mm512_test_epi64_mask(x, x) != 0)
+                        return false;
+        }
+        return includes_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+__attribute__((target("avx512f"))) static bool
+equal_avx512(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 8 <= nwords; i += 8) {
+                __m512i a = _mm512_loadu_si512(src1 + i);
+                __m512i b = _mm512_loadu_si512(src2 + i);
+                if (_mm512_cmpneq_epi64_mask(a, b) != 0)
+                        return false;
+        }
+        return equal_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+__attribute__((target("avx512f"))) static void
+difference_avx512(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 8 <= nwords; i += 8) {
+                __m512i a = _mm512_loadu_si512(src1 + i);
+                __m512i b = _mm512_loadu_si512(src2 + i);
+                _mm512_storeu_si512(dst + i, _mm512_andnot_si512(b, a));
+        }
+        difference_scalar(dst + i, src1 + i, src2 + i, nwords - i);
+}
+#elif defined(__aarch64__)
+/*
+  NEON is always available on AArch64, hence it does not need to be
+  detected.
+*/
+static bool
+includes_neon(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 2 <= nwords; i += 2) {
+                uint64x2_t x = vbicq_u64(vld1q_u64(src1 + i), vld1q_u64(src2 + i));
+                if (vmaxvq_u32(vreinterpretq_u32_u64(x)) != 0)
+                        return false;
+        }
+        return includes_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+static bool
+equal_neon(const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 2 <= nwords; i += 2) {
+                uint64x2_t x = veorq_u64(vld1q_u64(src1 + i), vld1q_u64(src2 + i));
+                if (vmaxvq_u32(vreinterpretq_u32_u64(x)) != 0)
+                        return false;
+        }
+        return equal_scalar(src1 + i, src2 + i, nwords - i);
+}
+
+static void
+difference_neon(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, size_t nwords) {
+        size_t i = 0;
+        for (; i + 2 <= nwords; i += 2)
+                vst1q_u64(dst + i, vbicq_u64(vld1q_u64(src1 + i), vld1q_u64(src2 + i)));
+        difference_scalar(dst + i, src1 + i, src2 + i, nwords - i);
+}
+#endif
+
+bitmap_kernels_s bitmap_kernels = {
+#if defined(__aarch64__)
+        .includes = includes_neon,
+        .equal = equal_neon,
+        .difference = difference_neon,
+        .name = "neon"
+#else
+        .includes = includes_scalar,
+        .equal = equal_scalar,
+        .difference = difference_scalar,
+        .name = "scalar"
+#endif
+};
+
+/*
+  The kernels are chosen before main, hence before any thread is started.
+*/
+__attribute__((constructor)) static void
+bitmap_select_kernels(void) {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+                bitmap_kernels = (bitmap_kernels_s) {
+                        .includes = includes_avx512,
+                        .equal = equal_avx512,
+                        .difference = difference_avx512,
+                        .name = "avx512"
+                };
+        else if (__builtin_cpu_supports("avx2"))
+                bitmap_kernels = (bitmap_kernels_s) {
+                        .includes = includes_avx2,
+                        .equal = equal_avx2,
+                        .difference = difference_avx2,
+                        .name = "avx2"
+                };
+#endif
+}
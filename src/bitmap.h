@@ -1,13 +1,15 @@
 /* Licensed under LGPLv2+
    Originally from CCAN bitmap.h
 */
+#ifndef CCAN_BITMAP_H
+#define CCAN_BITMAP_H
 
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <gc.h>
+#include "memory.h"
 
 
 typedef uint64_t bitmap_word;
@@ -20,7 +22,7 @@ typedef uint64_t bitmap_word;
 #define BITMAP_HEADWORDS(_n)    ((_n) / BITMAP_WORD_BITS)
 #define BITMAP_TAILWORD(_bm,_n) ((_bm)[BITMAP_HEADWORDS(_n)])
 #define BITMAP_HASTAIL(_n)      (((_n) % BITMAP_WORD_BITS) != 0)
-#define BITMAP_TAILBITS(_n)     (~(-1UL >> ((_n) % BITMAP_WORD_BITS)))
+#define BITMAP_TAILBITS(_n)     (~(-1UL << ((_n) % BITMAP_WORD_BITS)))
 #define BITMAP_TAIL(_bm,_n)     (BITMAP_TAILWORD(_bm, _n) & BITMAP_TAILBITS(_n))
 #define BITMAP_WORD(_bm,_n)     ((_bm)[(_n) >> LOG_BITMAP_WORD_BITS])
 #define BITMAP_BIT_MASK(_n)     (1UL << (BITMAP_BIT_OFFSET(_n)))
@@ -37,6 +39,16 @@ static inline void bitmap_zero(bitmap_word *bitmap, unsigned long nbits) {
         memset(bitmap, 0, bitmap_sizeof(nbits));
 }
 
+/**
+   \brief sets the first \c nbits bits of \c bitmap, and clears the others
+   of its last word
+*/
+static inline void bitmap_fill(bitmap_word *bitmap, unsigned long nbits) {
+        memset(bitmap, 0xff, BITMAP_HEADWORDS(nbits) * sizeof(bitmap_word));
+        if (BITMAP_HASTAIL(nbits))
+                BITMAP_TAILWORD(bitmap, nbits) = BITMAP_TAILBITS(nbits);
+}
+
 static inline bitmap_word *bitmap_alloc0(unsigned long nbits) {
         bitmap_word *bitmap;
         bitmap = bitmap_alloc(nbits);
@@ -48,7 +60,7 @@ static inline void bitmap_set_bit(bitmap_word *bitmap, unsigned long n) {
         BITMAP_WORD(bitmap, n) |= BITMAP_BIT_MASK(n);
 }
 
-static inline bool bitmap_get_bit(bitmap_word *bitmap, unsigned long n) {
+static inline bool bitmap_get_bit(const bitmap_word *bitmap, unsigned long n) {
         return ((BITMAP_WORD(bitmap, n) & BITMAP_BIT_MASK(n))  > 0);
 }
 
@@ -60,11 +72,40 @@ static inline void bitmap_copy(bitmap_word *dst, const bitmap_word *src, unsigne
         memcpy(dst, src, bitmap_sizeof(nbits));
 }
 
-static inline bool bitmap_includes(bitmap_word *src1, const bitmap_word *src2, unsigned long nbits) {
+/**
+   \struct bitmap_kernels_s
+   \brief the implementations of the set operations on the first \c nwords
+   words of two bitmaps, chosen at startup among those supported by the CPU
+   (AVX-512, AVX2, NEON or plain words).
+*/
+typedef struct bitmap_kernels_s {
+        bool (*includes)(const bitmap_word *src1, const bitmap_word *src2, size_t nwords);
+        bool (*equal)(const bitmap_word *src1, const bitmap_word *src2, size_t nwords);
+        void (*difference)(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, size_t nwords);
+        const char *name;
+} bitmap_kernels_s;
+
+extern bitmap_kernels_s bitmap_kernels;
+
+/*
+  Shorter bitmaps, such as those of most instances, are processed inline,
+  since a vector kernel would not pay off the indirect call.
+*/
+#define BITMAP_KERNEL_WORDS     8
+
+/**
+   \brief true if \c src1 is included in \c src2
+*/
+static inline bool bitmap_includes(const bitmap_word *src1, const bitmap_word *src2, unsigned long nbits) {
         unsigned long i;
-        for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
-                if (src1[i]  & ~src2[i])
+        if (BITMAP_HEADWORDS(nbits) >= BITMAP_KERNEL_WORDS) {
+                if (!bitmap_kernels.includes(src1, src2, BITMAP_HEADWORDS(nbits)))
                         return false;
+        } else {
+                for (i = 0; i < BITMAP_HEADWORDS(nbits); i++) {
+                        if (src1[i]  & ~src2[i])
+                                return false;
+                }
         }
 
         if (BITMAP_HASTAIL(nbits) && (BITMAP_TAIL(src1, nbits) & ~BITMAP_TAIL(src2, nbits)))
@@ -72,40 +113,67 @@ static inline bool bitmap_includes(bitmap_word *src1, const bitmap_word *src2, u
         return true;
 }
 
-
 /**
-   \brief true if the first array includes the second
+   \brief true if the first \c nbits bits of \c src1 and \c src2 are the same
 */
-static inline bool
-bool_array_includes(bool* a1, bool* a2, uint32_t n) {
-        for (uint32_t i = 0; i < n; i++)
-                if (a2[i] && !a1[i])
+static inline bool bitmap_equal(const bitmap_word *src1, const bitmap_word *src2, unsigned long nbits) {
+        if (BITMAP_HEADWORDS(nbits) >= BITMAP_KERNEL_WORDS) {
+                if (!bitmap_kernels.equal(src1, src2, BITMAP_HEADWORDS(nbits)))
                         return false;
-        return true;
+        } else {
+                for (unsigned long i = 0; i < BITMAP_HEADWORDS(nbits); i++)
+                        if (src1[i] != src2[i])
+                                return false;
+        }
+        return !BITMAP_HASTAIL(nbits) || BITMAP_TAIL(src1, nbits) == BITMAP_TAIL(src2, nbits);
 }
 
-
 /**
-   \brief true if the two arrays are the same
+   \brief stores in \c dst, which can be \c src1 or \c src2, the difference
+   \c src1 - \c src2 of the first \c nbits bits. The bits of the last word
+   after \c nbits are cleared.
 */
-static inline bool
-bool_array_equal(bool* a1, bool* a2, uint32_t n) {
-        for (uint32_t i = 0; i < n; i++)
-                if (a1[i] != a2[i])
-                        return false;
-        return true;
+static inline void bitmap_difference(bitmap_word *dst, const bitmap_word *src1, const bitmap_word *src2, unsigned long nbits) {
+        if (BITMAP_HEADWORDS(nbits) >= BITMAP_KERNEL_WORDS)
+                bitmap_kernels.difference(dst, src1, src2, BITMAP_HEADWORDS(nbits));
+        else
+                for (unsigned long i = 0; i < BITMAP_HEADWORDS(nbits); i++)
+                        dst[i] = src1[i] & ~src2[i];
+        if (BITMAP_HASTAIL(nbits))
+                BITMAP_TAILWORD(dst, nbits) = BITMAP_TAIL(src1, nbits) & ~BITMAP_TAIL(src2, nbits);
 }
 
+/**
+   \brief number of bits set in the first \c nbits bits of \c bitmap.
 
+   All bitmaps used in the library keep the bits after \c nbits cleared,
+   therefore the tail word does not need to be masked.
+*/
+static inline uint32_t bitmap_popcount(const bitmap_word *bitmap, unsigned long nbits) {
+        uint32_t count = 0;
+        for (unsigned long i = 0; i < BITMAP_NWORDS(nbits); i++)
+                count += __builtin_popcountll(bitmap[i]);
+        return count;
+}
 
 /**
-   \brief computes the difference a1-a2 of two sets a1, a2, receiving the
-   characteristics function of those two sets.
+   \brief the smallest position \c p such that
+   \c p >= from and the bit \c p is set, or \c nbits if there is no such position
 */
-static inline bool*
-bool_array_difference(const bool* a1, const bool* a2, uint32_t n) {
-        bool* b = GC_MALLOC(n * sizeof(bool));
-        for (uint32_t i = 0; i < n; i++)
-                b[i] = (a1[i] && !a2[i]);
-        return b;
+static inline unsigned long bitmap_next_bit(const bitmap_word *bitmap, unsigned long from, unsigned long nbits) {
+        if (from >= nbits)
+                return nbits;
+        unsigned long i = BITMAP_BIT_PLACE(from);
+        bitmap_word w = bitmap[i] & (-1UL << BITMAP_BIT_OFFSET(from));
+        for (;;) {
+                if (w != 0) {
+                        unsigned long p = (i << LOG_BITMAP_WORD_BITS) + __builtin_ctzll(w);
+                        return (p < nbits) ? p : nbits;
+                }
+                if (++i >= BITMAP_NWORDS(nbits))
+                        return nbits;
+                w = bitmap[i];
+        }
 }
+
+#endif /* CCAN_BITMAP_H */
@@ -0,0 +1,396 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "checkpoint.h"
+#include <unistd.h>
+
+/*
+  The first line of a checkpoint file, followed by the line
+  instances <instance> <last_instance> <output_offset>
+  and, if the search has started, by the line
+  search <num_species> <num_characters> <fingerprint> <fingerprint> <nodes> <partial> <root> <num_levels>
+  and a line for each node:
+  <backtrack_level> <realized> <queue_size> <queue...>
+  where -1 is written as such.
+*/
+#define CHECKPOINT_HEADER "cppp checkpoint 1"
+
+void
+checkpoint_init(checkpoint_s *cp) {
+        *cp = (checkpoint_s) {
+                .instance = 0,
+                .last_instance = UINT64_MAX,
+                .root = 0,
+                .num_levels = 0,
+                .backtrack_levels = NULL,
+                .realized = NULL,
+                .queue_sizes = NULL,
+                .queues = NULL,
+                .capacity_levels = 0,
+                .capacity_queues = 0
+        };
+}
+
+void
+checkpoint_release(checkpoint_s *cp) {
+        xfree(cp->backtrack_levels);
+        xfree(cp->realized);
+        xfree(cp->queue_sizes);
+        xfree(cp->queues);
+        checkpoint_init(cp);
+}
+
+/*
+  Makes room for num_levels nodes and num_queued untried characters
+*/
+static void
+checkpoint_reserve(checkpoint_s *cp, uint32_t num_levels, size_t num_queued) {
+        if (num_levels > cp->capacity_levels) {
+                cp->backtrack_levels = xrealloc(cp->backtrack_levels, num_levels * sizeof(uint32_t));
+                cp->realized = xrealloc(cp->realized, num_levels * sizeof(uint32_t));
+                cp->queue_sizes = xrealloc(cp->queue_sizes, num_levels * sizeof(uint32_t));
+                cp->capacity_levels = num_levels;
+        }
+        if (num_queued > cp->capacity_queues) {
+                cp->queues = xrealloc(cp->queues, num_queued * sizeof(uint32_t));
+                cp->capacity_queues = num_queued;
+        }
+}
+
+static size_t
+num_queued(const checkpoint_s *cp) {
+        size_t size = 0;
+        for (uint32_t l = 0; l < cp->num_levels; l++)
+                size += cp->queue_sizes[l];
+        return size;
+}
+
+static void
+checkpoint_copy(checkpoint_s *dst, const checkpoint_s *src) {
+        size_t queued = num_queued(src);
+        checkpoint_reserve(dst, src->num_levels, queued);
+        uint32_t *backtrack_levels = dst->backtrack_levels;
+        uint32_t *realized = dst->realized;
+        uint32_t *queue_sizes = dst->queue_sizes;
+        uint32_t *queues = dst->queues;
+        uint32_t capacity_levels = dst->capacity_levels;
+        size_t capacity_queues = dst->capacity_queues;
+        *dst = *src;
+        dst->backtrack_levels = backtrack_levels;
+        dst->realized = realized;
+        dst->queue_sizes = queue_sizes;
+        dst->queues = queues;
+        dst->capacity_levels = capacity_levels;
+        dst->capacity_queues = capacity_queues;
+        if (src->num_levels == 0)
+                return;
+        memcpy(dst->backtrack_levels, src->backtrack_levels, src->num_levels * sizeof(uint32_t));
+        memcpy(dst->realized, src->realized, src->num_levels * sizeof(uint32_t));
+        memcpy(dst->queue_sizes, src->queue_sizes, src->num_levels * sizeof(uint32_t));
+        if (queued > 0)
+                memcpy(dst->queues, src->queues, queued * sizeof(uint32_t));
+}
+
+/*
+  Reads a number that is at most max, or -1
+*/
+static bool
+read_value(FILE *f, uint32_t max, uint32_t *x) {
+        int64_t value;
+        if (fscanf(f, "%" SCNd64, &value) != 1 || value < -1 || value > max)
+                return false;
+        *x = (uint32_t) value;
+        return true;
+}
+
+static bool
+read_nodes(FILE *f, checkpoint_s *cp) {
+        uint32_t m = cp->num_characters;
+        size_t queued = 0;
+        for (uint32_t l = 0; l < cp->num_levels; l++) {
+                uint32_t size;
+                if (!read_value(f, (l > 0) ? l - 1 : 0, cp->backtrack_levels + l) ||
+                    (l == 0 && cp->backtrack_levels[l] != -1) ||
+                    !read_value(f, m - 1, cp->realized + l) ||
+                    (cp->realized[l] == -1) != (l + 1 == cp->num_levels) ||
+                    !read_value(f, m, &size) || size == -1)
+                        return false;
+                cp->queue_sizes[l] = size;
+                checkpoint_reserve(cp, cp->num_levels, queued + size);
+                for (uint32_t i = 0; i < size; i++)
+                        if (!read_value(f, m - 1, cp->queues + queued + i) || cp->queues[queued + i] == -1)
+                                return false;
+                queued += size;
+        }
+        return true;
+}
+
+bool
+checkpoint_read(checkpoint_s *cp, const char *filename) {
+        FILE *f = fopen(filename, "r");
+        if (f == NULL)
+                return false;
+        char header[sizeof(CHECKPOINT_HEADER) + 1];
+        bool ok = fgets(header, sizeof(header), f) != NULL && strcmp(header, CHECKPOINT_HEADER "\n") == 0 &&
+                fscanf(f, " instances %" SCNu64 " %" SCNu64 " %" SCNu64, &(cp->instance), &(cp->last_instance),
+                       &(cp->output_offset)) == 3 &&
+                cp->instance <= cp->last_instance;
+        cp->num_levels = 0;
+        cp->partial = false;
+        cp->root = 0;
+        cp->nodes = 0;
+        if (ok) {
+                uint32_t partial;
+                int read = fscanf(f, " search %" SCNu32 " %" SCNu32 " %" SCNx64 " %" SCNx64 " %" SCNu64 " %" SCNu32
+                                  " %" SCNu32 " %" SCNu32, &(cp->num_species), &(cp->num_characters),
+                                  cp->fingerprint, cp->fingerprint + 1, &(cp->nodes), &partial, &(cp->root),
+                                  &(cp->num_levels));
+                if (read == 8) {
+                        uint32_t n = cp->num_species;
+                        uint32_t m = cp->num_characters;
+                        /* the nodes are at most those allocated by new_levels */
+                        ok = n > 0 && m > 0 && partial <= 1 && cp->num_levels > 0 &&
+                                cp->num_levels <= n + 2 * m + 2 && cp->root < cp->num_levels;
+                        cp->partial = (partial == 1);
+                        if (ok) {
+                                checkpoint_reserve(cp, cp->num_levels, 0);
+                                ok = read_nodes(f, cp);
+                        }
+                } else {
+                        cp->num_levels = 0;
+                        ok = (read == EOF || read == 0) && feof(f);
+                }
+        }
+        fclose(f);
+        if (!ok)
+                cp->num_levels = 0;
+        return ok;
+}
+
+static bool
+write_checkpoint(const checkpoint_s *cp, FILE *f) {
+        fprintf(f, "%s\ninstances %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", CHECKPOINT_HEADER, cp->instance,
+                cp->last_instance, cp->output_offset);
+        if (cp->num_levels > 0) {
+                fprintf(f, "search %" PRIu32 " %" PRIu32 " %" PRIx64 " %" PRIx64 " %" PRIu64 " %d %" PRIu32
+                        " %" PRIu32 "\n", cp->num_species, cp->num_characters, cp->fingerprint[0],
+                        cp->fingerprint[1], cp->nodes, cp->partial ? 1 : 0, cp->root, cp->num_levels);
+                const uint32_t *queue = cp->queues;
+                for (uint32_t l = 0; l < cp->num_levels; l++) {
+                        fprintf(f, "%" PRId32 " %" PRId32 " %" PRIu32, (int32_t) cp->backtrack_levels[l],
+                                (int32_t) cp->realized[l], cp->queue_sizes[l]);
+                        for (uint32_t i = 0; i < cp->queue_sizes[l]; i++)
+                                fprintf(f, " %" PRIu32, queue[i]);
+                        fputc('\n', f);
+                        queue += cp->queue_sizes[l];
+                }
+        }
+        return fflush(f) == 0 && fsync(fileno(f)) == 0 && !ferror(f);
+}
+
+bool
+checkpoint_write(const checkpoint_s *cp, const char *filename) {
+        char *temp;
+        if (asprintf(&temp, "%s.tmp", filename) == -1)
+                return false;
+        FILE *f = fopen(temp, "w");
+        bool ok = (f != NULL) && write_checkpoint(cp, f);
+        if (f != NULL && fclose(f) != 0)
+                ok = false;
+        if (ok)
+                ok = rename(temp, filename) == 0;
+        else
+                remove(temp);
+        free(temp);
+        return ok;
+}
+
+/*
+  The piece of the instance of cp made of its nodes up to level, whose root
+  is level and whose untried characters are the size characters chars
+*/
+static void
+frontier_piece(checkpoint_s *piece, const checkpoint_s *cp, uint32_t level, const uint32_t *chars, uint32_t size) {
+        checkpoint_reserve(piece, level + 1, size);
+        piece->instance = cp->instance;
+        piece->last_instance = cp->instance + 1;
+        piece->output_offset = 0;
+        piece->num_species = cp->num_species;
+        piece->num_characters = cp->num_characters;
+        piece->fingerprint[0] = cp->fingerprint[0];
+        piece->fingerprint[1] = cp->fingerprint[1];
+        piece->nodes = 0;
+        piece->partial = true;
+        piece->root = level;
+        piece->num_levels = level + 1;
+        memcpy(piece->backtrack_levels, cp->backtrack_levels, (level + 1) * sizeof(uint32_t));
+        memcpy(piece->realized, cp->realized, level * sizeof(uint32_t));
+        piece->realized[level] = -1;
+        for (uint32_t l = 0; l < level; l++)
+                piece->queue_sizes[l] = 0;
+        piece->queue_sizes[level] = size;
+        memcpy(piece->queues, chars, size * sizeof(uint32_t));
+}
+
+uint32_t
+checkpoint_split(const checkpoint_s *cp, uint32_t num_pieces, checkpoint_s *pieces) {
+        assert(num_pieces > 0);
+        checkpoint_copy(pieces, cp);
+        pieces->output_offset = 0;
+        if (cp->num_levels == 0 || num_pieces == 1)
+                return 1;
+        bool rest = (cp->instance + 1 < cp->last_instance);
+        uint32_t wanted = rest ? num_pieces - 1 : num_pieces;
+        uint32_t count = 1;
+        pieces->last_instance = cp->instance + 1;
+
+/*
+  The untried characters of each node, from the root, are split evenly
+  among the pieces still wanted. The current node keeps its first
+  character, as the worker of parallel_search does, and the first piece
+  keeps only the characters that have not been moved.
+*/
+        uint32_t last = cp->num_levels - 1;
+        const uint32_t *queue = cp->queues;
+        size_t kept = 0;
+        for (uint32_t l = 0; l < cp->num_levels; l++) {
+                uint32_t size = cp->queue_sizes[l];
+                uint32_t keep = (l == last) ? 1 : 0;
+                uint32_t available = (l >= cp->root && size > keep) ? size - keep : 0;
+                uint32_t new_pieces = (available < wanted - count) ? available : wanted - count;
+                for (uint32_t i = 0, from = keep; i < new_pieces; i++) {
+                        uint32_t chunk = available / new_pieces + ((i < available % new_pieces) ? 1 : 0);
+                        frontier_piece(pieces + count++, cp, l, queue + from, chunk);
+                        from += chunk;
+                }
+                if (new_pieces > 0) {
+                        pieces->partial = true;
+                        size = keep;
+                }
+                memmove(pieces->queues + kept, queue, size * sizeof(uint32_t));
+                pieces->queue_sizes[l] = size;
+                kept += size;
+                queue += cp->queue_sizes[l];
+        }
+        if (rest) {
+                checkpoint_s *piece = pieces + count++;
+                piece->instance = cp->instance + 1;
+                piece->last_instance = cp->last_instance;
+                piece->output_offset = 0;
+                piece->nodes = 0;
+                piece->partial = false;
+                piece->root = 0;
+                piece->num_levels = 0;
+        }
+        return count;
+}
+
+void
+checkpointer_init(checkpointer_s *cp, const char *filename, double interval, FILE *output,
+                  uint64_t first_instance, uint64_t last_instance) {
+        cp->filename = filename;
+        cp->interval = interval;
+        cp->next = omp_get_wtime() + interval;
+        cp->output = output;
+        cp->resume = NULL;
+        checkpoint_init(&(cp->checkpoint));
+        cp->checkpoint.instance = first_instance;
+        cp->checkpoint.last_instance = last_instance;
+}
+
+void
+checkpointer_resume(checkpointer_s *cp, const checkpoint_s *resume) {
+        cp->checkpoint.instance = resume->instance;
+        cp->checkpoint.last_instance = resume->last_instance;
+        cp->checkpoint.partial = resume->partial;
+        cp->resume = (resume->num_levels > 0) ? resume : NULL;
+}
+
+void
+checkpointer_release(checkpointer_s *cp) {
+        checkpoint_release(&(cp->checkpoint));
+        cp->resume = NULL;
+}
+
+bool
+checkpoint_due(const checkpointer_s *cp) {
+        return omp_get_wtime() >= cp->next;
+}
+
+/*
+  The results written so far are flushed, so that the checkpoint never
+  refers to results that are lost
+*/
+static void
+checkpoint_save(checkpointer_s *cp) {
+        checkpoint_s *ckp = &(cp->checkpoint);
+        ckp->output_offset = 0;
+        if (cp->output != NULL) {
+                fflush(cp->output);
+                fsync(fileno(cp->output));
+                off_t offset = ftello(cp->output);
+                if (offset > 0)
+                        ckp->output_offset = offset;
+        }
+        if (!checkpoint_write(ckp, cp->filename))
+                log_error("Could not write the checkpoint %s", cp->filename);
+        log_debug("checkpoint: instance %" PRIu64 ", %d nodes", ckp->instance, ckp->num_levels);
+        cp->next = omp_get_wtime() + cp->interval;
+}
+
+void
+checkpoint_instance(checkpointer_s *cp, uint64_t instance, bool force) {
+        checkpoint_s *ckp = &(cp->checkpoint);
+        /* until its search starts, the checkpoint is still resume */
+        if (cp->resume != NULL && cp->resume->instance == instance)
+                return;
+        if (instance != ckp->instance)
+                ckp->partial = false;
+        ckp->instance = instance;
+        ckp->num_levels = 0;
+        if (force || checkpoint_due(cp))
+                checkpoint_save(cp);
+}
+
+void
+checkpoint_search(checkpointer_s *cp, const state_s *stp, const level_s *levels, uint32_t root,
+                  uint32_t level, uint64_t nodes) {
+        uint32_t m = stp->num_characters_orig;
+        checkpoint_s *ckp = &(cp->checkpoint);
+        checkpoint_reserve(ckp, level + 1, (size_t) (level + 1) * m);
+        ckp->num_species = stp->num_species_orig;
+        ckp->num_characters = m;
+        ckp->fingerprint[0] = levels->fingerprint[0];
+        ckp->fingerprint[1] = levels->fingerprint[1];
+        ckp->nodes = nodes;
+        ckp->root = root;
+        ckp->num_levels = level + 1;
+        uint32_t *queue = ckp->queues;
+        for (uint32_t l = 0; l <= level; l++) {
+                const level_s *lp = levels + l;
+                ckp->backtrack_levels[l] = lp->backtrack_level;
+                ckp->realized[l] = (l < level) ? lp->realize : -1;
+                ckp->queue_sizes[l] = lp->character_queue_size;
+                memcpy(queue, lp->character_queue + lp->character_queue_first,
+                       lp->character_queue_size * sizeof(uint32_t));
+                queue += lp->character_queue_size;
+        }
+        checkpoint_save(cp);
+}
@@ -0,0 +1,192 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_CHECKPOINT_H
+#define CPPP_CHECKPOINT_H
+#include "perfect_phylogeny.h"
+
+/**
+   \struct checkpoint_s
+   \brief the progress of a run over the instances of a file, and of the
+   sequential search of its current instance
+
+   The instances from \c instance to \c last_instance (excluded) are still
+   to be solved, and the results of the previous ones are the first
+   \c output_offset bytes of the output file.
+
+   If \c num_levels is 0 the search of \c instance has not started.
+   Otherwise the checkpoint is the frontier of its decision tree: it
+   contains only the decisions, since the instance of each node is rebuilt
+   by realizing again the characters from the root. For each node l, from
+   0 to \c num_levels-1, \c backtrack_levels[l] is its \c backtrack_level,
+   \c realized[l] is its character being realized (-1 for the last node),
+   and its untried characters are the next \c queue_sizes[l] characters of
+   \c queues. The search stops when it backtracks above the node \c root.
+   \c num_species, \c num_characters and \c fingerprint identify the instance
+   at the root, and \c nodes is the number of nodes already visited.
+
+   A checkpoint that is \c partial covers only part of the decision tree,
+   since the other untried characters have been given to other checkpoints
+   by \c checkpoint_split: the table of failures cannot be used when it is
+   resumed.
+
+   \c capacity_levels and \c capacity_queues are the allocated sizes of
+   the arrays.
+*/
+typedef struct checkpoint_s {
+        uint64_t instance;
+        uint64_t last_instance;
+        uint64_t output_offset;
+        uint32_t num_species;
+        uint32_t num_characters;
+        uint64_t fingerprint[2];
+        uint64_t nodes;
+        bool partial;
+        uint32_t root;
+        uint32_t num_levels;
+        uint32_t *backtrack_levels;
+        uint32_t *realized;
+        uint32_t *queue_sizes;
+        uint32_t *queues;
+        uint32_t capacity_levels;
+        size_t capacity_queues;
+} checkpoint_s;
+
+/**
+   \struct checkpointer_s
+   \brief writes periodically the checkpoint of a run to a file
+
+   The \c checkpoint is written to \c filename at most once every
+   \c interval seconds, the next time being \c next, as returned by
+   \c omp_get_wtime. Before writing it, \c output, which receives the
+   results of the run, is flushed, so that its size is the output offset of
+   the checkpoint.
+
+   If \c resume is not \c NULL, the search of its instance continues from
+   its frontier instead of starting from the root. Checkpoints are taken
+   only by the sequential search, without iterative deepening.
+*/
+typedef struct checkpointer_s {
+        const char *filename;
+        double interval;
+        double next;
+        FILE *output;
+        checkpoint_s checkpoint;
+        const checkpoint_s *resume;
+} checkpointer_s;
+
+/**
+   \brief initializes the empty checkpoint \c cp
+*/
+void
+checkpoint_init(checkpoint_s *cp);
+
+/**
+   \brief releases the arrays of the checkpoint \c cp
+*/
+void
+checkpoint_release(checkpoint_s *cp);
+
+/**
+   \brief reads the checkpoint \c cp, which must be initialized, from the
+   file \c filename
+
+   \return \c false if the file cannot be read or it is not a checkpoint
+*/
+bool
+checkpoint_read(checkpoint_s *cp, const char *filename);
+
+/**
+   \brief writes the checkpoint \c cp to the file \c filename, atomically:
+   it is written to a temporary file, which replaces \c filename only when
+   it is complete.
+
+   \return \c false if the file cannot be written
+*/
+bool
+checkpoint_write(const checkpoint_s *cp, const char *filename);
+
+/**
+   \brief splits the frontier of the checkpoint \c cp into at most
+   \c num_pieces checkpoints \c pieces, which must be initialized, so that
+   solving all of them solves the same instances as \c cp.
+
+   The untried characters of the shallowest nodes of the frontier are given
+   to new checkpoints, whose root is such node, just as the idle threads of
+   \c parallel_search receive them, until there are \c num_pieces - 1
+   pieces of the instance or the frontier has no untried character left.
+   The first piece keeps the rest of the frontier. Each piece solves only
+   the instance of \c cp, and a last piece, starting from the next
+   instance, solves the instances that follow, if any. The output offset
+   of each piece is 0, since each one has its own output.
+
+   \return the number of pieces
+*/
+uint32_t
+checkpoint_split(const checkpoint_s *cp, uint32_t num_pieces, checkpoint_s *pieces);
+
+/**
+   \brief initializes the checkpointer \c cp, writing to \c filename every
+   \c interval seconds and flushing \c output.
+
+   The first checkpoint is solving the instances from \c first_instance to
+   \c last_instance (excluded).
+*/
+void
+checkpointer_init(checkpointer_s *cp, const char *filename, double interval, FILE *output,
+                  uint64_t first_instance, uint64_t last_instance);
+
+/**
+   \brief continues the run of the checkpoint \c resume, which must be
+   valid as long as \c cp: the first checkpoint is \c resume, and the search
+   of its instance continues from its frontier
+*/
+void
+checkpointer_resume(checkpointer_s *cp, const checkpoint_s *resume);
+
+/**
+   \brief releases the memory of the checkpointer \c cp
+*/
+void
+checkpointer_release(checkpointer_s *cp);
+
+/**
+   \brief \c true iff a new checkpoint must be written
+*/
+bool
+checkpoint_due(const checkpointer_s *cp);
+
+/**
+   \brief records that the search of the instance \c instance is starting,
+   and writes such checkpoint if it is due or if \c force is \c true
+*/
+void
+checkpoint_instance(checkpointer_s *cp, uint64_t instance, bool force);
+
+/**
+   \brief writes the checkpoint of the sequential search of the current
+   instance \c stp, whose nodes are \c levels and whose current node is at
+   \c level. The search stops when it backtracks above \c root, and it has
+   visited \c nodes nodes.
+*/
+void
+checkpoint_search(checkpointer_s *cp, const state_s *stp, const level_s *levels, uint32_t root,
+                  uint32_t level, uint64_t nodes);
+#endif
@@ -20,10 +20,83 @@
 */
 
 #include "cppp.h"
+#include <unistd.h>
 
-static uint32_t
-alphabetic(state_s *stp, uint32_t *arr) {
-        return (characters_list(stp, arr));
+/*
+  The results are written through a large buffer, so that a file with many
+  small instances is written with a few system calls
+*/
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/**
+   \brief parses a range of instances \c a:b, where both bounds are
+   optional, into \c props
+*/
+static void
+parse_range(const char *range, instances_schema_s *props) {
+        const char *colon = strchr(range, ':');
+        char *end = NULL;
+        if (colon == NULL)
+                error(8, 0, "Invalid range of instances: %s\n", range);
+        if (colon != range) {
+                props->first_instance = strtoull(range, &end, 10);
+                if (end != colon)
+                        error(8, 0, "Invalid range of instances: %s\n", range);
+        }
+        if (colon[1] != '\0') {
+                props->last_instance = strtoull(colon + 1, &end, 10);
+                if (*end != '\0')
+                        error(8, 0, "Invalid range of instances: %s\n", range);
+        }
+}
+
+/**
+   \brief splits the checkpoint in the file \c filename into at most
+   \c num_pieces checkpoints, written to the files \c filename.0,
+   \c filename.1, ..., whose names are written to the standard output
+*/
+static void
+split_checkpoint(const char *filename, int num_pieces) {
+        if (filename == NULL || num_pieces < 1)
+                error(15, 0, "--split-checkpoint needs --resume and a positive number of pieces\n");
+        checkpoint_s cp;
+        checkpoint_init(&cp);
+        if (!checkpoint_read(&cp, filename))
+                error(16, 0, "Could not read the checkpoint %s\n", filename);
+        checkpoint_s *pieces = xmalloc(num_pieces * sizeof(checkpoint_s));
+        for (int i = 0; i < num_pieces; i++)
+                checkpoint_init(pieces + i);
+        uint32_t count = checkpoint_split(&cp, num_pieces, pieces);
+        for (uint32_t i = 0; i < count; i++) {
+                char *name;
+                if (asprintf(&name, "%s.%" PRIu32, filename, i) == -1)
+                        exit(1);
+                if (!checkpoint_write(pieces + i, name))
+                        error(16, 0, "Could not write the checkpoint %s\n", name);
+                printf("%s\n", name);
+                free(name);
+                checkpoint_release(pieces + i);
+        }
+        xfree(pieces);
+        checkpoint_release(&cp);
+}
+
+/**
+   \brief opens the output file \c filename. When the run continues from
+   the checkpoint \c resume, the file keeps only the results of the
+   instances solved before the checkpoint, and it is written after them.
+*/
+static FILE *
+open_output(const char *filename, const checkpoint_s *resume) {
+        if (resume == NULL)
+                return fopen(filename, "w");
+        FILE *outf = fopen(filename, "r+");
+        if (outf == NULL && resume->output_offset == 0)
+                return fopen(filename, "w");
+        if (outf == NULL || ftruncate(fileno(outf), (off_t) resume->output_offset) != 0 ||
+            fseeko(outf, 0, SEEK_END) != 0)
+                error(16, 0, "Could not restore the output file %s of the checkpoint\n", filename);
+        return outf;
 }
 
 int main(int argc, char **argv) {
@@ -31,45 +104,153 @@ int main(int argc, char **argv) {
         int cmd_status = cmdline_parser(argc, argv, &args_info);
         if (cmd_status != 0)
                 error(4, 0, "Could not parse the command line\n");
-        if (args_info.inputs_num < 1)
-                error(5, 0, "There is no input matrix to analyze\n");
         start_logging(args_info);
+        if (args_info.split_checkpoint_given) {
+                split_checkpoint(args_info.resume_arg, args_info.split_checkpoint_arg);
+                cmdline_parser_free(&args_info);
+                return 0;
+        }
+        bool server = args_info.server_flag;
+        if (server && (args_info.inputs_num > 0 || args_info.jobs_arg > 1 || args_info.range_given ||
+                       args_info.convert_flag))
+                error(14, 0, "The server mode cannot be used with an input file, --jobs, --range or --convert\n");
+        if (!server && args_info.inputs_num < 1)
+                error(5, 0, "There is no input matrix to analyze\n");
+        if (!server && !args_info.output_given)
+                error(13, 0, "There is no output file\n");
         log_debug("cppp: start");
-        FILE* outf = fopen(args_info.output_arg, "w");
+        bool checkpointing = args_info.checkpoint_given || args_info.resume_given;
+        if (checkpointing && (server || args_info.jobs_arg > 1 || args_info.threads_arg > 1 ||
+                              args_info.split_components_flag || args_info.convert_flag || args_info.deepening_flag ||
+                              strcmp(args_info.engine_arg, "search") != 0 ||
+                              (args_info.resume_given && args_info.range_given)))
+                error(15, 0, "Checkpoints can be used only with the sequential search engine, without --server, "
+                      "--jobs, --convert, --deepening, --threads, --split-components and, with --resume, --range\n");
+        if (checkpointing && args_info.checkpoint_interval_arg <= 0)
+                error(15, 0, "Invalid interval between checkpoints: %d\n", args_info.checkpoint_interval_arg);
+        checkpoint_s resume;
+        checkpoint_init(&resume);
+        if (args_info.resume_given && !checkpoint_read(&resume, args_info.resume_arg))
+                error(16, 0, "Could not read the checkpoint %s\n", args_info.resume_arg);
+        FILE* outf = args_info.output_given ?
+                open_output(args_info.output_arg, args_info.resume_given ? &resume : NULL) : stdout;
+        if (outf == NULL)
+                error(6, 0, "Could not open output file: %s\n", args_info.output_arg);
+        if (!server)
+                setvbuf(outf, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
+        arena_s instance_arena;
+        arena_init(&instance_arena);
         instances_schema_s props = {
                 .file = NULL,
-                .filename = args_info.inputs[0]
+                .filename = server ? NULL : args_info.inputs[0],
+                .arena = &instance_arena,
+                .first_instance = 0,
+                .last_instance = UINT64_MAX,
+                .collapse_duplicates = args_info.collapse_duplicates_flag,
+                .direct_phylogeny = args_info.direct_phylogeny_flag
         };
-        state_s temp;
-        while (read_instance_from_filename(&props, &temp)) {
-/**
-   Notice that each character is realized at most twice (once positive and once
-   negative) and that each species can be declared null at most once.
-
-   Therefore each partial solution con contain at most 2m+n states.
-*/
-                uint32_t maxdepth = temp.num_species_orig + 2 * temp.num_characters_orig + 1;
-                state_s states[maxdepth + 1];
-                for (uint32_t level = 0; level <= maxdepth; level++) {
-                        init_state(states + level, temp.num_species_orig, temp.num_characters_orig);
-                        log_debug("State #%d (max %d) = %p", level, maxdepth, states + level);
-                        log_debug("Initialized level %d", level);
-                        log_state(states + level);
+        strategy_fn strategy = get_strategy(args_info.strategy_arg);
+        if (strategy == NULL)
+                error(9, 0, "Unknown strategy: %d\n", args_info.strategy_arg);
+        if (args_info.memo_size_arg < 0)
+                error(10, 0, "Invalid size of the table of failures: %d\n", args_info.memo_size_arg);
+        size_t memo_size = (size_t) args_info.memo_size_arg << 20;
+        if (args_info.max_nodes_arg < 0 || args_info.timeout_ms_arg < 0 || args_info.batch_timeout_ms_arg < 0)
+                error(11, 0, "Invalid limit of the search\n");
+        search_limits_s limits = {
+                .max_nodes = args_info.max_nodes_arg,
+                .timeout_ms = args_info.timeout_ms_arg,
+                .deadline = 0,
+                .deepening = args_info.deepening_flag,
+                .cancelled = NULL,
+                .timed = args_info.stats_given
+        };
+        if (args_info.batch_timeout_ms_arg > 0)
+                limits.deadline = omp_get_wtime() + args_info.batch_timeout_ms_arg / 1000.0;
+        uint32_t engine = ENGINE_SEARCH;
+        if (strcmp(args_info.engine_arg, "sat") == 0)
+                engine = ENGINE_SAT;
+        else if (strcmp(args_info.engine_arg, "portfolio") == 0)
+                engine = ENGINE_PORTFOLIO;
+        if (engine != ENGINE_SEARCH && (args_info.split_components_flag || args_info.threads_arg > 1))
+                error(12, 0, "Only the search engine can be used with --threads or --split-components\n");
+        bool write_counters = args_info.max_nodes_given || args_info.timeout_ms_given ||
+                args_info.batch_timeout_ms_given || args_info.deepening_flag || engine == ENGINE_PORTFOLIO ||
+                args_info.stats_given;
+        bool json = args_info.stats_given;
+        if (args_info.range_given)
+                parse_range(args_info.range_arg, &props);
+        if (args_info.resume_given) {
+                props.first_instance = resume.instance;
+                props.last_instance = resume.last_instance;
+        }
+        if (args_info.convert_flag) {
+                uint64_t count = write_binary_instances(&props, outf);
+                log_info("Converted %" PRIu64 " instances\n", count);
+                fclose(outf);
+                cmdline_parser_free(&args_info);
+                log_debug("END");
+                return 0;
+        }
+        if (args_info.jobs_arg > 1) {
+                if (args_info.split_components_flag || args_info.threads_arg > 1)
+                        error(7, 0, "Batch mode cannot be used with --threads or --split-components\n");
+                solve_batch(&props, outf, engine, strategy, memo_size, args_info.jobs_arg, !args_info.unordered_flag,
+                            &limits, write_counters, json);
+                fclose(outf);
+                cmdline_parser_free(&args_info);
+                log_debug("END");
+                return 0;
+        }
+        cppp_options_s options = {
+                .engine = engine,
+                .strategy = args_info.strategy_arg,
+                .threads = args_info.threads_arg,
+                .split_components = args_info.split_components_flag,
+                .collapse_duplicates = args_info.collapse_duplicates_flag,
+                .direct_phylogeny = args_info.direct_phylogeny_flag,
+                .memo_size = memo_size,
+                .limits = limits
+        };
+        /* All instances of a file have the same size, hence the solver
+           allocates the nodes of the decision tree only once */
+        cppp_solver_s solver;
+        if (!cppp_solver_init(&solver, &options))
+                error(12, 0, "Only the search engine can be used with --threads or --split-components\n");
+        checkpointer_s checkpointer;
+        if (checkpointing) {
+                checkpointer_init(&checkpointer, args_info.checkpoint_given ? args_info.checkpoint_arg :
+                                  args_info.resume_arg, args_info.checkpoint_interval_arg, outf,
+                                  props.first_instance, props.last_instance);
+                if (args_info.resume_given)
+                        checkpointer_resume(&checkpointer, &resume);
+                solver.checkpointer = &checkpointer;
+        }
+        if (server) {
+                uint64_t count = serve(&solver, stdin, outf, write_counters, json);
+                log_info("Answered %" PRIu64 " requests\n", count);
+        } else {
+                state_s temp;
+                while (read_instance_from_filename(&props, &temp)) {
+                        check_state(&temp);
+                        char *tree = NULL;
+                        search_counters_s counters;
+                        if (checkpointing)
+                                checkpoint_instance(&checkpointer, props.next_instance - 1, false);
+                        uint32_t status = cppp_solve_state(&solver, &temp, &counters, &tree);
+                        write_result(outf, status, tree, write_counters ? &counters : NULL, json, props.next_instance - 1);
+                        log_debug("Instance solved");
+                }
+                /* the run is complete: resuming it does nothing */
+                if (checkpointing) {
+                        checkpoint_instance(&checkpointer, props.next_instance, true);
+                        checkpointer_release(&checkpointer);
                 }
-                log_debug("States initialized");
-                check_state(&temp);
-
-                copy_state(states + 0, &temp);
-                if (outf == NULL)
-                        error(6, 0, "Input file ended prematurely\n");
-                if (exhaustive_search(states, alphabetic, states[0].num_species + 2 * states[0].num_characters)) {
-                        log_debug("Writing solution");
-                        fprintf(outf, "%s\n", newick(states));
-                } else
-                        fprintf(outf, "Not found\n");
-                log_debug("Instance solved");
         }
+        checkpoint_release(&resume);
+        cppp_solver_release(&solver);
+        arena_release(&instance_arena);
         fclose(outf);
         cmdline_parser_free(&args_info);
         log_debug("END");
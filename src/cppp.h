@@ -1,2 +1,3 @@
-#include "decision_tree.h"
+#include "batch.h"
+#include "server.h"
 #include "cmdline.h"
@@ -21,19 +21,269 @@
 
 #include "decision_tree.h"
 
+/**
+   \struct budget_s
+   \brief the budget left to the search of an instance
+
+   \c nodes is the number of nodes visited so far, \c max_nodes and
+   \c deadline are the limits (0 means no limit), and \c exhausted is set as
+   soon as one of them is reached.
+   \c depth_cut is set when a branch is cut because it cannot be completed
+   within the maximum depth of the search.
+   \c cancelled is the flag of the limits, that exhausts the budget when it
+   is set.
+   \c stats are the statistics of the explorations of the search that have
+   ended, whose operations are timed if \c timed is \c true.
+*/
+typedef struct budget_s {
+        uint64_t nodes;
+        uint64_t max_nodes;
+        double deadline;
+        bool exhausted;
+        bool depth_cut;
+        const bool *cancelled;
+        bool timed;
+        search_stats_s stats;
+} budget_s;
+
+/**
+   \struct search_s
+   \brief the parameters of a search
+
+   If \c split_components is \c true, each time the red-black graph has more
+   than one nontrivial connected component, each component is solved by a
+   different OpenMP task.
+
+   If \c num_threads is larger than 1, the branches of the decision tree are
+   explored in parallel: as long as the number \c pending of subtrees that
+   are waiting or being explored is smaller than \c num_threads, a worker
+   gives the untried characters of its shallowest node to a new OpenMP task.
+   The first worker reaching a solution stores its nodes in \c solution,
+   and in \c solution_arena the arena of its copy of the instance, or
+   \c NULL if the nodes are the ones where the search has started.
+
+   \c cancelled is a flag shared by all searches that are solving the
+   components of the same instance, or the subtrees of the same decision
+   tree, and \c parent is the search that has generated such instance.
+   A search stops as soon as its flag, or the flag of one of its ancestors,
+   is set.
+
+   \c memo, if it is not \c NULL, is the table of the instances that are
+   known to have no solution. It is shared by the searches of the components
+   of an instance, hence it is locked when \c split_components is \c true.
+   When the branches are explored in parallel, a node whose characters have
+   been given to another worker is not refuted by exhausting its own
+   characters, so the table is not used if \c num_threads is larger than 1.
+
+   \c budget is shared by all searches of the same instance: when it is
+   exhausted, all of them stop as if they had been cancelled.
+
+   \c checkpointer, if it is not \c NULL, periodically writes the frontier
+   of the sequential search, and its \c resume, if any, is the frontier
+   where the search starts.
+*/
+typedef struct search_s {
+        strategy_fn strategy;
+        bool split_components;
+        uint32_t num_threads;
+        uint32_t *pending;
+        bool *cancelled;
+        level_s **solution;
+        arena_s **solution_arena;
+        const struct search_s *parent;
+        memo_s *memo;
+        budget_s *budget;
+        checkpointer_s *checkpointer;
+} search_s;
+
+double
+search_deadline(const search_limits_s *limits, double start) {
+        double deadline = 0;
+        if (limits == NULL)
+                return deadline;
+        if (limits->timeout_ms > 0)
+                deadline = start + limits->timeout_ms / 1000.0;
+        if (limits->deadline > 0 && (deadline == 0 || limits->deadline < deadline))
+                deadline = limits->deadline;
+        return deadline;
+}
+
+static void
+init_budget(budget_s *bp, const search_limits_s *limits, double start) {
+        bp->nodes = 0;
+        bp->max_nodes = (limits != NULL) ? limits->max_nodes : 0;
+        bp->deadline = search_deadline(limits, start);
+        bp->exhausted = false;
+        bp->depth_cut = false;
+        bp->cancelled = (limits != NULL) ? limits->cancelled : NULL;
+        bp->timed = (limits != NULL) ? limits->timed : false;
+        bp->stats = (search_stats_s) { 0 };
+}
+
+/**
+   \brief adds the statistics \c stats of an exploration to those of the
+   budget \c bp, which can be shared by several threads
+*/
+static void
+merge_stats(budget_s *bp, const search_stats_s *stats) {
+#pragma omp critical(cppp_stats)
+        {
+                search_stats_s *total = &(bp->stats);
+                total->realizations += stats->realizations;
+                total->failed_realizations += stats->failed_realizations;
+                total->pruned += stats->pruned;
+                total->backtracks += stats->backtracks;
+                if (stats->max_backtrack > total->max_backtrack)
+                        total->max_backtrack = stats->max_backtrack;
+                total->component_splits += stats->component_splits;
+                total->interchangeable += stats->interchangeable;
+                if (stats->max_depth > total->max_depth)
+                        total->max_depth = stats->max_depth;
+                total->times.realize += stats->times.realize;
+                total->times.conflict_graph += stats->times.conflict_graph;
+                total->times.components += stats->times.components;
+                total->times.smallest_component += stats->times.smallest_component;
+        }
+}
+
+/**
+   \brief counts a backtrack from \c level to \c backtrack_level, which is -1
+   if the search leaves the root
+*/
+static void
+count_backtrack(search_stats_s *stats, uint32_t level, uint32_t backtrack_level) {
+        uint32_t distance = (backtrack_level == -1) ? level + 1 : level - backtrack_level;
+        stats->backtracks++;
+        if (distance > stats->max_backtrack)
+                stats->max_backtrack = distance;
+}
+
+static bool
+budget_exhausted(const search_s *sp) {
+        budget_s *bp = sp->budget;
+        bool exhausted;
+#pragma omp atomic read
+        exhausted = bp->exhausted;
+        if (!exhausted && bp->cancelled != NULL) {
+#pragma omp atomic read
+                exhausted = *(bp->cancelled);
+                if (exhausted) {
+#pragma omp atomic write
+                        bp->exhausted = true;
+                }
+        }
+        return exhausted;
+}
+
+/**
+   \brief counts a visited node.
+
+   \return \c false iff the budget is exhausted
+*/
+static bool
+spend_node(const search_s *sp) {
+        budget_s *bp = sp->budget;
+        uint64_t nodes;
+#pragma omp atomic capture
+        nodes = ++(bp->nodes);
+        if ((bp->max_nodes > 0 && nodes > bp->max_nodes) ||
+            (bp->deadline > 0 && omp_get_wtime() >= bp->deadline)) {
+#pragma omp atomic write
+                bp->exhausted = true;
+                return false;
+        }
+        return true;
+}
+
+static bool
+search_cancelled(const search_s *sp) {
+        if (budget_exhausted(sp))
+                return true;
+        for (; sp != NULL; sp = sp->parent)
+                if (sp->cancelled != NULL) {
+                        bool cancelled;
+#pragma omp atomic read
+                        cancelled = *(sp->cancelled);
+                        if (cancelled)
+                                return true;
+                }
+        return false;
+}
+
+static bool
+solve_components(state_s *stp, const search_s *parent, char **trees);
+
+/**
+   \brief \c true if the instance \c stp is known to have no solution
+*/
+static bool
+known_failure(const search_s *sp, const state_s *stp) {
+        if (sp->memo == NULL)
+                return false;
+        bool found;
+        if (sp->split_components) {
+#pragma omp critical(cppp_memo)
+                found = memo_contains(sp->memo, stp->fingerprint);
+        } else
+                found = memo_contains(sp->memo, stp->fingerprint);
+        return found;
+}
+
+static void
+record_failure(const search_s *sp, const uint64_t fingerprint[2], uint32_t weight) {
+        if (sp->memo == NULL)
+                return;
+        if (sp->split_components) {
+#pragma omp critical(cppp_memo)
+                memo_insert(sp->memo, fingerprint, weight);
+        } else
+                memo_insert(sp->memo, fingerprint, weight);
+}
+
+/**
+   \brief records that the instances of the nodes from \c level up to, but
+   excluding, \c backtrack_level have no solution.
+
+   Since the search is exhaustive, backtracking to \c backtrack_level means
+   that the instance reached by the realization at \c backtrack_level has no
+   solution, and neither has any instance obtained from it.
+*/
+static void
+record_failed_levels(const search_s *sp, const level_s *levels, uint32_t level, uint32_t backtrack_level) {
+        if (sp->memo == NULL)
+                return;
+        for (uint32_t l = level; l != backtrack_level; l--)
+                record_failure(sp, (levels + l)->fingerprint, (levels + l)->num_species);
+}
+
+/**
+   \return the number of connected components of the red-black graph with
+   at least two vertices
+*/
+static uint32_t
+num_nontrivial_components(const state_s *stp) {
+        uint32_t count = 0;
+        for (uint32_t v = 0; v < stp->red_black->num_vertices; v++)
+                if (stp->component_size[v] > 1)
+                        count++;
+        return count;
+}
+
 /**
    \brief prints a dump of the sequence of characters realized
 
 */
-static void log_decisions(const state_s* arr_stp, const uint32_t max_depth) {
 #ifdef DEBUG
+static void log_decisions(const level_s* arr_lp, const uint32_t max_depth) {
         log_debug("log_decisions");
         fprintf(stderr, "=========BEGIN DECISIONS===============\n");
         for (uint32_t l = 0; l <= max_depth; l++)
-                fprintf(stderr, "level=%4d Character=%d\n", l, (arr_stp+l)->realize);
+                fprintf(stderr, "level=%4d Character=%d\n", l, (arr_lp+l)->realize);
         fprintf(stderr, "=========END DECISIONS=================\n");
-#endif
 }
+#else
+#define log_decisions(arr_lp, max_depth)
+#endif
 
 
 
@@ -42,45 +292,219 @@ static void log_decisions(const state_s* arr_stp, const uint32_t max_depth) {
    to try at the current level
 */
 static bool
-level_completed(const state_s * stp) {
-        return (stp->character_queue_size == 0);
+level_completed(const level_s * lp) {
+        return (lp->character_queue_size == 0);
 }
 
 /**
-   modifies the current state \c stp so that the next available
+   modifies the current node \c stp so that the next available
    character is computed and the list \c tried_characters and \c
    character_queue are updated
 */
 static uint32_t
-next_character(state_s *stp) {
+next_character(level_s *stp) {
         log_debug("next_character: stp=%p", stp);
-        log_state_lists(stp);
+        log_level_lists(stp);
         if (stp->character_queue_size > 0 ) {
 /* we have found a character to try */
-                uint32_t c = stp->character_queue[0];
+                uint32_t c = stp->character_queue[stp->character_queue_first];
                 stp->tried_characters[stp->tried_characters_size] = c;
                 stp->tried_characters_size += 1;
+                stp->character_queue_first += 1;
                 stp->character_queue_size -= 1;
-                for (uint32_t i = 0; i < stp->character_queue_size; i++)
-                        stp->character_queue[i] = stp->character_queue[i+1];
                 log_debug("next_character: %d", c);
                 log_debug("next_character: end");
-                log_state_lists(stp);
+                log_level_lists(stp);
                 return c;
         }
         return -1;
 }
 
+/*
+  Below this size, the insertion sort is faster than the heap sort.
+*/
+#define SORT_INSERTION_SIZE 16
+
+/*
+  Ties are broken by the character, hence the order does not depend on the
+  algorithm: since the queue built by \c smallest_component is in
+  increasing order, it is the order of a stable sort.
+*/
+static bool
+key_less(const uint32_t *chars, const int64_t *keys, uint32_t i, uint32_t j) {
+        return keys[i] < keys[j] || (keys[i] == keys[j] && chars[i] < chars[j]);
+}
+
+static void
+swap_characters(uint32_t *chars, int64_t *keys, uint32_t i, uint32_t j) {
+        uint32_t c = chars[i];
+        chars[i] = chars[j];
+        chars[j] = c;
+        int64_t key = keys[i];
+        keys[i] = keys[j];
+        keys[j] = key;
+}
+
+static void
+sift_down(uint32_t *chars, int64_t *keys, uint32_t root, uint32_t size) {
+        for (uint32_t child = 2 * root + 1; child < size; root = child, child = 2 * root + 1) {
+                if (child + 1 < size && key_less(chars, keys, child, child + 1))
+                        child++;
+                if (!key_less(chars, keys, root, child))
+                        return;
+                swap_characters(chars, keys, root, child);
+        }
+}
+
 /**
-   \brief set up the new node of the decision tree
+   \brief sorts the \c size characters in \c chars by increasing \c keys,
+   where \c keys[i] is the key of \c chars[i], and then by increasing
+   character.
+
+   Small queues are sorted by insertion, and the others with a heap sort, so
+   that the wide components cost O(size log size) at each node.
 */
 static void
-init_node(state_s *stp, strategy_fn get_characters_to_realize) {
+sort_characters(uint32_t *chars, int64_t *keys, uint32_t size) {
+        if (size <= SORT_INSERTION_SIZE) {
+                for (uint32_t i = 1; i < size; i++)
+                        for (uint32_t j = i; j > 0 && key_less(chars, keys, j, j - 1); j--)
+                                swap_characters(chars, keys, j, j - 1);
+                return;
+        }
+        for (uint32_t i = size / 2; i > 0; i--)
+                sift_down(chars, keys, i - 1, size);
+        for (uint32_t end = size - 1; end > 0; end--) {
+                swap_characters(chars, keys, 0, end);
+                sift_down(chars, keys, 0, end);
+        }
+}
+
+static uint32_t
+red_black_degree(const state_s *stp, uint32_t c) {
+        return graph_degree(stp->red_black, stp->num_species_orig + c);
+}
+
+static void
+input_order(const state_s *stp, uint32_t *chars, uint32_t size) {
+}
+
+static void
+max_degree(const state_s *stp, uint32_t *chars, uint32_t size) {
+        int64_t *keys = stp->workspace.keys;
+        for (uint32_t i = 0; i < size; i++)
+                keys[i] = -(int64_t) red_black_degree(stp, chars[i]);
+        sort_characters(chars, keys, size);
+}
+
+static void
+min_conflicts(const state_s *stp, uint32_t *chars, uint32_t size) {
+        int64_t *keys = stp->workspace.keys;
+        for (uint32_t i = 0; i < size; i++)
+                keys[i] = graph_degree(stp->conflict, chars[i]);
+        sort_characters(chars, keys, size);
+}
+
+/*
+  Realizing an inactive character c makes c adjacent to the species of its
+  component that do not have c, and only to them.
+*/
+static void
+fewest_species(const state_s *stp, uint32_t *chars, uint32_t size) {
+        int64_t *keys = stp->workspace.keys;
+        for (uint32_t i = 0; i < size; i++) {
+                uint32_t component = stp->connected_components[stp->num_species_orig + chars[i]];
+                keys[i] = (int64_t) stp->component_species[component] - red_black_degree(stp, chars[i]);
+        }
+        sort_characters(chars, keys, size);
+}
+
+/*
+  The characters with more conflicts are the most likely to lead to a
+  failure, which is better discovered as close as possible to the root.
+*/
+static void
+most_constrained(const state_s *stp, uint32_t *chars, uint32_t size) {
+        int64_t *keys = stp->workspace.keys;
+        for (uint32_t i = 0; i < size; i++)
+                keys[i] = -((int64_t) graph_degree(stp->conflict, chars[i]) * (stp->num_species_orig + 1) +
+                            red_black_degree(stp, chars[i]));
+        sort_characters(chars, keys, size);
+}
+
+static const strategy_fn strategies[NUM_STRATEGIES] = {
+        [STRATEGY_INPUT_ORDER] = input_order,
+        [STRATEGY_MAX_DEGREE] = max_degree,
+        [STRATEGY_MIN_CONFLICTS] = min_conflicts,
+        [STRATEGY_FEWEST_SPECIES] = fewest_species,
+        [STRATEGY_MOST_CONSTRAINED] = most_constrained
+};
+
+strategy_fn
+get_strategy(uint32_t id) {
+        return (id < NUM_STRATEGIES) ? strategies[id] : NULL;
+}
+
+/**
+   \brief removes from the \c size inactive characters \c chars each
+   character that is interchangeable with a previous one, that is with the
+   same neighbours in the red-black graph.
+
+   All neighbours of an inactive character are species of its connected
+   component, hence two interchangeable characters of the current component
+   have the same column on the current species: swapping them maps the
+   instance to itself, and realizing either of them leads to the same
+   subtree of the decision tree, up to their names. Only the first
+   character of each class, in the order of the strategy, is kept.
+
+   \return the number of characters kept
+*/
+static uint32_t
+break_symmetries(const state_s *stp, uint32_t *chars, uint32_t size) {
+        uint32_t n = stp->num_species_orig;
+        const graph_s *gp = stp->red_black;
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < size; i++) {
+                const bitmap_word *row = graph_neighbourhood(gp, n + chars[i]);
+                bool interchangeable = false;
+                for (uint32_t j = 0; j < kept && !interchangeable; j++)
+                        interchangeable = bitmap_equal(row, graph_neighbourhood(gp, n + chars[j]), n);
+                if (!interchangeable)
+                        chars[kept++] = chars[i];
+        }
+        return kept;
+}
+
+/**
+   \brief set up the new node \c lp of the decision tree, corresponding to
+   the current instance \c stp
+
+   The inactive characters of \c lp->character_queue are reordered by
+   \c get_characters_to_realize, while an active character that can be
+   freed stays in the first position. Then only one character of each
+   class of interchangeable characters is left (see \c break_symmetries).
+
+   \return the number of characters removed from the queue
+*/
+static uint32_t
+init_node(const state_s *stp, level_s *lp, strategy_fn get_characters_to_realize) {
         log_debug("init_node");
-        stp->tried_characters_size = 0;
-        smallest_component(stp);
+        lp->tried_characters_size = 0;
+        lp->num_species = stp->num_species;
+        lp->log_mark = stp->log_size;
+        lp->subtrees = NULL;
+        lp->fingerprint[0] = stp->fingerprint[0];
+        lp->fingerprint[1] = stp->fingerprint[1];
+        bitmap_copy(lp->characters, stp->characters, stp->num_characters_orig);
+        smallest_component(stp, lp);
+        uint32_t first = (lp->character_queue_size > 0 && stp->colors[lp->character_queue[0]] != BLACK) ? 1 : 0;
+        uint32_t size = lp->character_queue_size - first;
+        get_characters_to_realize(stp, lp->character_queue + first, size);
+        lp->character_queue_size = first + break_symmetries(stp, lp->character_queue + first, size);
         log_state(stp);
+        log_level(lp, stp->red_black->num_vertices);
         log_debug("init_node:end");
+        return first + size - lp->character_queue_size;
 }
 
 /**
@@ -97,15 +521,33 @@ init_node(state_s *stp, strategy_fn get_characters_to_realize) {
    those in the \c current_component at state root.
 */
 static bool
-component_borders(state_s* states, uint32_t root_level, uint32_t leaf_level) {
-        state_s* root = states + root_level;
-        state_s* leaf = states + leaf_level;
-        bool* solved = bool_array_difference(root->characters, leaf->characters, root->num_characters_orig);
-        bool found = bool_array_equal(solved, (root->current_component) + root->num_species_orig, root->num_characters_orig);
-        if (!found)
-                return false;
+component_borders(const state_s* stp, level_s* levels, uint32_t root_level, uint32_t leaf_level) {
+        level_s* root = levels + root_level;
+        level_s* leaf = levels + leaf_level;
+        uint32_t n = stp->num_species_orig;
+        for (uint32_t c = 0; c < stp->num_characters_orig; c++)
+                if ((bitmap_get_bit(root->characters, c) && !bitmap_get_bit(leaf->characters, c)) !=
+                    bitmap_get_bit(root->current_component, n + c))
+                        return false;
         for (uint32_t l = root_level + 1; l <= leaf_level; l++)
-                if (!bool_array_includes(root->current_component , (states + l)->current_component, root->red_black->num_vertices))
+                if (!bitmap_includes((levels + l)->current_component, root->current_component, stp->red_black->num_vertices))
+                        return false;
+        return true;
+}
+
+/**
+   \brief checks if all species and characters left in \c stp belong to the
+   current connected component of the node \c lp, that is if no other
+   component is still waiting to be solved
+*/
+static bool
+only_current_component(const state_s* stp, const level_s* lp) {
+        uint32_t n = stp->num_species_orig;
+        for (uint32_t s = 0; s < n; s++)
+                if (bitmap_get_bit(stp->species, s) && !bitmap_get_bit(lp->current_component, s))
+                        return false;
+        for (uint32_t c = 0; c < stp->num_characters_orig; c++)
+                if (bitmap_get_bit(stp->characters, c) && !bitmap_get_bit(lp->current_component, n + c))
                         return false;
         return true;
 }
@@ -113,13 +555,18 @@ component_borders(state_s* states, uint32_t root_level, uint32_t leaf_level) {
 /**
    \brief computes the next node of the decision tree
 
-   \param states: the set of states, since the decision tree can move to the
+   \param stp: the instance at the current level. It is modified when a
+   character is realized, and it is restored by replaying the undo log in
+   reverse when backtracking
+   \param levels: the set of nodes, since the decision tree can move to the
    next level or to get back to the previous level
    \param level: the current level
-   \param strategy_fn: a pointer to the function encoding the order of the
-   characters that we will try in the current level
+   \param sp: the parameters of the search, including the function encoding
+   the order of the characters that we will try in the current level
+   \param max_depth: the deepest level that the search can reach
+   \param stats: the statistics of the exploration, that are updated
 
-   \return the new level. It can differ from the input level at most by 1.
+   \return the new level. It can be larger than the input level at most by 1.
 
    We keep track of the lists of \c tried_character (that is the characters that
    we have already tried to realized in the current level) and of \c
@@ -132,37 +579,116 @@ component_borders(state_s* states, uint32_t root_level, uint32_t leaf_level) {
    The function \c smallest_component must take care of setting \c character_queue accordingly.
 */
 static uint32_t
-next_node(state_s *states, uint32_t level, strategy_fn get_characters_to_realize) {
+next_node(state_s *stp, level_s *levels, uint32_t level, const search_s *sp, uint32_t max_depth, search_stats_s *stats) {
         log_debug("next_node: level=%d", level);
-        state_s *current = states + level;
-        log_state(current);
-        log_decisions(states, level);
+        level_s *current = levels + level;
+        log_state(stp);
+        log_level(current, stp->red_black->num_vertices);
+        log_decisions(levels, level);
 
         if (level_completed(current)) {
                 /* it is not possible to extend the solution. We have
-                   to backtrack */
+                   to backtrack, restoring the instance of the node
+                   where we backtrack to */
                 log_debug("next_node: end. LEVEL. Backtrack to level: %d from %d", current->backtrack_level, level);
+                record_failed_levels(sp, levels, level, current->backtrack_level);
+                count_backtrack(stats, level, current->backtrack_level);
+                if (current->backtrack_level != -1)
+                        state_undo(stp, (levels + current->backtrack_level)->log_mark);
                 return (current->backtrack_level);
         }
         log_debug("Inside next_node");
         current->realize = next_character(current);
-        assert(current->realize <= current->num_characters_orig);
-        state_s *next = states + (level + 1);
+        current->subtrees = NULL;
+        assert(current->realize <= stp->num_characters_orig);
+        level_s *next = levels + (level + 1);
         log_debug("next_node: realizing level=%d current->realize=%d %p %p", level, current->realize, next, current);
-        bool status = realize_character(next, current);
+        bool status = realize_character(stp, current);
         log_debug("next_node: result of realizing level=%d current->realize=%d outcome=%d", level, current->realize, status);
         if (status) {
+                stats->realizations++;
                 /* The realization has been successful.
                    First check if we have resolved the whole instance */
-                if (next->num_species == 0) {
+                if (stp->num_species == 0) {
                         log_debug("next_node: Solution found");
+                        next->num_species = 0;
                         return(level + 1);
                 }
 
+                /* The instance has already been refuted in another
+                   branch: the realization fails */
+                if (known_failure(sp, stp)) {
+                        log_debug("next_node: end. Known failure. Stay at level: %d", level);
+                        stats->pruned++;
+                        state_undo(stp, current->log_mark);
+                        return (level);
+                }
+
+                /* The realization also fails if the instance has no
+                   solution, or no solution within max_depth levels. The
+                   bound is computed only when it might be too large. */
+                if (red_sigma_graph(stp)) {
+                        log_debug("next_node: end. Infeasible. Stay at level: %d", level);
+                        stats->pruned++;
+                        state_undo(stp, current->log_mark);
+                        return (level);
+                }
+                if (level + 1 + 2 * stp->num_characters > max_depth &&
+                    level + 1 + realizations_lower_bound(stp) > max_depth) {
+                        log_debug("next_node: end. Too deep. Stay at level: %d", level);
+                        stats->pruned++;
+#pragma omp atomic write
+                        sp->budget->depth_cut = true;
+                        state_undo(stp, current->log_mark);
+                        return (level);
+                }
+
+                /* If the instance does not need any loss, its phylogeny
+                   is built directly below the edge of the realized
+                   character. The other components, if any, would not be
+                   below such edge. */
+                if (stp->direct_phylogeny && only_current_component(stp, current)) {
+                        current->subtrees = perfect_phylogeny_forest(stp, false);
+                        if (current->subtrees != NULL) {
+                                log_debug("next_node: Solution built directly");
+                                next->num_species = 0;
+                                return(level + 1);
+                        }
+                }
+
+                /* If the realization has split the current component, each
+                   resulting component is solved separately.
+                   If all of them have a solution, then we have resolved the
+                   whole instance. Otherwise we backtrack as if realizing
+                   the character had failed at the next level. */
+                if (sp->split_components && num_nontrivial_components(stp) > 1) {
+                        log_debug("next_node: component split");
+                        stats->component_splits++;
+                        if (solve_components(stp, sp, &(current->subtrees))) {
+                                log_debug("next_node: Solution found");
+                                next->num_species = 0;
+                                return(level + 1);
+                        }
+                        current->subtrees = NULL;
+                        uint32_t backtrack_level = level;
+                        for (; backtrack_level != -1 && (levels + backtrack_level)->operation != 1; backtrack_level--) ;
+                        log_debug("next_node: end. Components not solved. Backtrack to level: %d from %d", backtrack_level, level);
+                        /* A component may have been stopped because an
+                           ancestor search has been cancelled */
+                        if (!search_cancelled(sp)) {
+                                record_failure(sp, stp->fingerprint, stp->num_species);
+                                record_failed_levels(sp, levels, level, backtrack_level);
+                        }
+                        count_backtrack(stats, level, backtrack_level);
+                        if (backtrack_level != -1)
+                                state_undo(stp, (levels + backtrack_level)->log_mark);
+                        return (backtrack_level);
+                }
+
                 /* Since we had realized a character, we move to a
                    deeper level of the decision tree. */
                 log_debug("next_node: LEVEL. Go to level: %d", level + 1);
-                init_node(next, get_characters_to_realize);
+                stats->interchangeable += init_node(stp, next, sp->strategy);
 
                 /* Since the realization of the negated characters are forced, we backtrack to the lowest level of the
                    decision tree where the operation is the realization of an inactive character.
@@ -170,7 +696,7 @@ next_node(state_s *states, uint32_t level, strategy_fn get_characters_to_realize
                    In fact, this implies that we permute over all realization of inactive characters, instead of the
                    naive permutation of all possible characters.
                 */
-                for (next->backtrack_level = level; (states + next->backtrack_level)->operation != 1; next->backtrack_level--) ;
+                for (next->backtrack_level = level; next->backtrack_level != -1 && (levels + next->backtrack_level)->operation != 1; next->backtrack_level--) ;
 
                 if (level_completed(current)) {
                         log_debug("next_node: connected component completed");
@@ -178,19 +704,19 @@ next_node(state_s *states, uint32_t level, strategy_fn get_characters_to_realize
  * we have started resolving such connected component.
  * It is equal to the topmost level whose current_component includes the original species and all characters that are not current. */
                         for (uint32_t blevel = 0; blevel < level; blevel++)
-                                if (component_borders(states, blevel, level + 1)) {
-                                        next->backtrack_level = (blevel > 0) ? (states + blevel - 1)->backtrack_level : -1;
-                                        log_decisions(states, level);
+                                if (component_borders(stp, levels, blevel, level + 1)) {
+                                        next->backtrack_level = (blevel > 0) ? (levels + blevel - 1)->backtrack_level : -1;
+                                        log_decisions(levels, level);
                                         log_debug("Preparing backtrack to level %d from %d (level=%d)", blevel - 1, level + 1, level);
                                         for (uint32_t l = blevel; l <= level; l++) {
                                                 log_debug("Level=%d (%d-%d)", l, blevel, level);
-                                                log_array_bool("current_component", (states + l)->current_component, (states + blevel)->red_black->num_vertices);
-                                                log_array_bool("characters", (states + l)->characters, (states + blevel)->num_characters_orig);
+                                                log_bitmap("current_component", (levels + l)->current_component, stp->red_black->num_vertices);
+                                                log_bitmap("characters", (levels + l)->characters, stp->num_characters_orig);
                                         }
-                                        log_debug("Next state");
-                                        log_state(next);
-                                        log_debug("Backtracked state");
-                                        log_state(states + blevel);
+                                        log_debug("Next node");
+                                        log_level(next, stp->red_black->num_vertices);
+                                        log_debug("Backtracked node");
+                                        log_level(levels + blevel, stp->red_black->num_vertices);
                                         break;
                                 }
                 }
@@ -201,27 +727,589 @@ next_node(state_s *states, uint32_t level, strategy_fn get_characters_to_realize
 /* The next solution is not feasible        */
 /***********************************************/
         log_debug("next_node: end. LEVEL. Stay at level: %d", level);
+        stats->failed_realizations++;
         return (level);
 }
 
-bool
-exhaustive_search(state_s *states, strategy_fn strategy, uint32_t max_depth) {
-        log_debug("exhaustive_search: init");
-        cleanup(states + 0);
-        update_connected_components(states + 0);
-        log_debug("exhaustive_search: end init");
-        init_node(states + 0, strategy);
-        (states + 0)->backtrack_level = -1;
-        for(uint32_t level = 0; level != -1; level = next_node(states, level, strategy)) {
-                log_debug("exhaustive_search: level %d", level);
-                log_decisions(states, level);
-                log_state(states + level);
+/**
+   \brief the search loop on the nodes \c levels, starting from the node at
+   level \c root. The search stops when it backtracks above \c root.
+
+   \return \c true iff a solution is found
+*/
+static bool
+explore(state_s *stp, level_s *levels, uint32_t root, const search_s *sp, uint32_t max_depth);
+
+/**
+   \brief explores the subtree rooted at level \c root, and records the
+   solution, if any, as the solution of the whole search \c sp.
+
+   If \c ap is not \c NULL, it is the arena containing \c stp and
+   \c levels, and it is released unless \c levels is the solution.
+*/
+static void
+explore_subtree(state_s *stp, level_s *levels, uint32_t root, const search_s *sp, uint32_t max_depth, arena_s *ap) {
+        bool winner = false;
+        if (explore(stp, levels, root, sp, max_depth)) {
+#pragma omp critical(cppp_solution)
+                {
+                        if (*(sp->solution) == NULL) {
+                                *(sp->solution) = levels;
+                                *(sp->solution_arena) = ap;
+                                winner = true;
+                        }
+                }
+#pragma omp atomic write
+                *(sp->cancelled) = true;
+                if (!winner)
+                        free_subtrees(levels);
+        }
+        if (ap != NULL && !winner) {
+                arena_release(ap);
+                xfree(ap);
+        }
+#pragma omp atomic
+        *(sp->pending) -= 1;
+}
+
+/**
+   \struct stolen_s
+   \brief a subtree that has been given to another worker
+*/
+typedef struct stolen_s {
+        state_s *stp;
+        level_s *levels;
+        arena_s *arena;
+} stolen_s;
+
+/**
+   \brief gives part of the subtree rooted at level \c root and currently at
+   level \c level to another worker, if some thread is idle.
+
+   The untried characters of the shallowest node that has any are moved to
+   a new task, which explores them on its own copy of the instance, reverted
+   to such node. The current worker keeps the first untried character of
+   the current level.
+*/
+static void
+donate(state_s *stp, level_s *levels, uint32_t root, uint32_t level, const search_s *sp, uint32_t max_depth) {
+        uint32_t pending;
+#pragma omp atomic read
+        pending = *(sp->pending);
+        if (pending >= sp->num_threads)
+                return;
+        uint32_t l = root;
+        for (; l < level && level_completed(levels + l); l++) ;
+        uint32_t keep = (l == level) ? 1 : 0;
+        if ((levels + l)->character_queue_size <= keep)
+                return;
+        log_debug("donate: level %d (root %d, current level %d)", l, root, level);
+
+        uint32_t n = stp->num_species_orig;
+        uint32_t m = stp->num_characters_orig;
+        arena_s *arena = xmalloc_root(sizeof(arena_s));
+        arena_init(arena);
+        state_s *thief = arena_alloc(arena, sizeof(state_s));
+        init_state(thief, n, m, arena);
+        fork_state(thief, stp);
+        state_undo(thief, (levels + l)->log_mark);
+        level_s *thief_levels = new_levels(n, m, arena);
+        for (uint32_t i = 0; i <= l; i++)
+                copy_level(thief_levels + i, levels + i, n, m);
+
+        level_s *victim = levels + l;
+        level_s *stolen = thief_levels + l;
+        stolen->character_queue_first = victim->character_queue_first + keep;
+        stolen->character_queue_size = victim->character_queue_size - keep;
+        victim->character_queue_size = keep;
+
+        stolen_s *subtree = xmalloc_root(sizeof(stolen_s));
+        subtree->stp = thief;
+        subtree->levels = thief_levels;
+        subtree->arena = arena;
+#pragma omp atomic
+        *(sp->pending) += 1;
+#pragma omp task default(shared) firstprivate(subtree, l)
+        {
+                state_s *task_stp = subtree->stp;
+                level_s *task_levels = subtree->levels;
+                arena_s *task_arena = subtree->arena;
+                xfree(subtree);
+                explore_subtree(task_stp, task_levels, l, sp, max_depth, task_arena);
+        }
+}
+
+static bool
+explore_nodes(state_s *stp, level_s *levels, uint32_t root, uint32_t start, const search_s *sp, uint32_t max_depth,
+              search_stats_s *stats) {
+        for(uint32_t level = start; level != -1 && level >= root; level = next_node(stp, levels, level, sp, max_depth, stats)) {
+                log_debug("search: level %d", level);
+                log_decisions(levels, level);
+                log_state(stp);
                 assert(level <= max_depth);
-                if ((states + level)->num_species == 0) {
-                        log_debug("exhaustive_search: solution found");
+                if (level > stats->max_depth)
+                        stats->max_depth = level;
+                if ((levels + level)->num_species == 0) {
+                        log_debug("search: solution found");
                         return true;
                 }
+                if (search_cancelled(sp)) {
+                        log_debug("search: cancelled");
+                        return false;
+                }
+                if (sp->checkpointer != NULL && checkpoint_due(sp->checkpointer))
+                        checkpoint_search(sp->checkpointer, stp, levels, root, level, sp->budget->nodes);
+                if (!spend_node(sp)) {
+                        log_debug("search: budget exhausted");
+                        return false;
+                }
+                if (sp->num_threads > 1)
+                        donate(stp, levels, root, level, sp, max_depth);
         }
-        log_debug("exhaustive_search: solution not found");
+        log_debug("search: solution not found");
         return false;
 }
+
+/*
+  The statistics of each exploration are kept locally until they are added
+  to the budget, and so are the times of the operations on its state.
+  The exploration starts from the node at level start, which is root unless
+  the search is resumed from a checkpoint.
+*/
+static bool
+explore_from(state_s *stp, level_s *levels, uint32_t root, uint32_t start, const search_s *sp, uint32_t max_depth) {
+        search_stats_s stats = { 0 };
+        state_times_s *times = stp->times;
+        stp->times = sp->budget->timed ? &(stats.times) : NULL;
+        bool found = explore_nodes(stp, levels, root, start, sp, max_depth, &stats);
+        stp->times = times;
+        merge_stats(sp->budget, &stats);
+        return found;
+}
+
+static bool
+explore(state_s *stp, level_s *levels, uint32_t root, const search_s *sp, uint32_t max_depth) {
+        return explore_from(stp, levels, root, root, sp, max_depth);
+}
+
+/**
+   \brief moves the search from the root of \c levels to the frontier of
+   the checkpoint \c cp, realizing again its characters, and gives each node
+   the untried characters of the checkpoint.
+
+   \return \c false if \c cp is not a checkpoint of the instance \c stp
+*/
+static bool
+resume_levels(state_s *stp, level_s *levels, strategy_fn strategy, const checkpoint_s *cp) {
+        log_debug("resume_levels: %d nodes", cp->num_levels);
+        if (cp->num_species != stp->num_species_orig || cp->num_characters != stp->num_characters_orig ||
+            cp->fingerprint[0] != levels->fingerprint[0] || cp->fingerprint[1] != levels->fingerprint[1])
+                return false;
+        const uint32_t *queue = cp->queues;
+        for (uint32_t l = 0; l < cp->num_levels; l++) {
+                level_s *lp = levels + l;
+                if (l > 0)
+                        init_node(stp, lp, strategy);
+                lp->backtrack_level = cp->backtrack_levels[l];
+                lp->character_queue_first = 0;
+                lp->character_queue_size = cp->queue_sizes[l];
+                memcpy(lp->character_queue, queue, cp->queue_sizes[l] * sizeof(uint32_t));
+                queue += cp->queue_sizes[l];
+                if (l + 1 == cp->num_levels)
+                        break;
+                lp->realize = cp->realized[l];
+                lp->tried_characters[0] = lp->realize;
+                lp->tried_characters_size = 1;
+                lp->subtrees = NULL;
+                if (!realize_character(stp, lp) || stp->num_species == 0)
+                        return false;
+        }
+        return true;
+}
+
+/**
+   \brief the whole search on the instance \c stp, using the nodes \c levels
+
+   \return the nodes encoding the solution, that are \c levels, or \c NULL
+   if there is no solution. When the branches are explored in parallel and
+   the solution is found by another worker, its nodes are copied to
+   \c levels, so that the copy of the instance of such worker is released.
+*/
+static level_s *
+search_levels(state_s *stp, level_s *levels, const search_s *sp, uint32_t max_depth, search_stats_s *stats) {
+        log_debug("search: init");
+        cleanup(stp);
+        update_connected_components(stp);
+        log_debug("search: end init");
+        stats->interchangeable += init_node(stp, levels + 0, sp->strategy);
+        (levels + 0)->backtrack_level = -1;
+        if (stp->direct_phylogeny && stp->num_species > 0) {
+                char *forest = perfect_phylogeny_forest(stp, true);
+                if (forest != NULL) {
+                        log_debug("search: solution built directly");
+                        (levels + 0)->num_species = 0;
+                        (levels + 0)->subtrees = forest;
+                        return levels;
+                }
+        }
+        if (sp->checkpointer != NULL && sp->checkpointer->resume != NULL) {
+                const checkpoint_s *cp = sp->checkpointer->resume;
+                sp->checkpointer->resume = NULL;
+                if (!resume_levels(stp, levels, sp->strategy, cp))
+                        error(16, 0, "The checkpoint does not match the instance %" PRIu64 "\n", cp->instance);
+                return explore_from(stp, levels, cp->root, cp->num_levels - 1, sp, max_depth) ? levels : NULL;
+        }
+        if (sp->num_threads <= 1)
+                return explore(stp, levels, 0, sp, max_depth) ? levels : NULL;
+
+        level_s *solution = NULL;
+        arena_s *solution_arena = NULL;
+        bool cancelled = false;
+        search_s branches = *sp;
+        branches.cancelled = &cancelled;
+        branches.solution = &solution;
+        branches.solution_arena = &solution_arena;
+        branches.parent = sp;
+#pragma omp atomic
+        *(sp->pending) += 1;
+#pragma omp taskgroup
+        explore_subtree(stp, levels, 0, &branches, max_depth, NULL);
+        if (solution_arena != NULL) {
+                uint32_t l = 0;
+                for (; (solution + l)->num_species > 0; l++)
+                        copy_level(levels + l, solution + l, stp->num_species_orig, stp->num_characters_orig);
+                copy_level(levels + l, solution + l, stp->num_species_orig, stp->num_characters_orig);
+                arena_release(solution_arena);
+                xfree(solution_arena);
+                solution = levels;
+        }
+        return solution;
+}
+
+/**
+   \brief same as \c search_levels, timing also the operations performed
+   before exploring the decision tree
+*/
+static level_s *
+search(state_s *stp, level_s *levels, const search_s *sp, uint32_t max_depth) {
+        search_stats_s stats = { 0 };
+        state_times_s *times = stp->times;
+        stp->times = sp->budget->timed ? &(stats.times) : NULL;
+        level_s *solution = search_levels(stp, levels, sp, max_depth, &stats);
+        stp->times = times;
+        merge_stats(sp->budget, &stats);
+        return solution;
+}
+
+/**
+   \brief same as \c search, but with iterative deepening if \c deepening is
+   \c true: the maximum depth is first the number of characters, so that no
+   character can be lost, and it is increased by one at each iteration, until
+   an iteration does not cut any branch because of the depth.
+*/
+static level_s *
+deepening_search(state_s *stp, level_s *levels, search_s *sp, uint32_t max_depth, bool deepening, search_counters_s *counters) {
+        counters->iterations = 1;
+        counters->max_losses = -1;
+        if (!deepening)
+                return search(stp, levels, sp, max_depth);
+        cleanup(stp);
+        uint32_t mark = stp->log_size;
+        memo_s *memo = sp->memo;
+        level_s *result = NULL;
+        for (uint32_t losses = 0; ; losses++) {
+                uint32_t depth = stp->num_characters + losses;
+                bool bounded = depth < max_depth;
+                log_debug("deepening_search: at most %d losses", losses);
+                counters->iterations = losses + 1;
+                counters->max_losses = bounded ? losses : -1;
+                /* a failure may be due to the bound */
+                sp->memo = bounded ? NULL : memo;
+                sp->budget->depth_cut = false;
+                result = search(stp, levels, sp, bounded ? depth : max_depth);
+                if (result != NULL || !bounded || !sp->budget->depth_cut || sp->budget->exhausted)
+                        break;
+                state_undo(stp, mark);
+        }
+        sp->memo = memo;
+        return result;
+}
+
+/**
+   \brief the outcome of a search, from its budget, and its counters
+*/
+static uint32_t
+search_status(bool found, const budget_s *bp, double start, search_counters_s *partial, search_counters_s *counters) {
+        /* the nodes that have exceeded the budget have not been visited */
+        partial->nodes = bp->nodes;
+        if (bp->max_nodes > 0 && partial->nodes > bp->max_nodes)
+                partial->nodes = bp->max_nodes;
+        partial->time_us = (uint64_t) ((omp_get_wtime() - start) * 1000000);
+        partial->engine = -1;
+        partial->stats = bp->stats;
+        if (counters != NULL)
+                *counters = *partial;
+        if (found)
+                return SEARCH_FOUND;
+        return bp->exhausted ? SEARCH_UNKNOWN : SEARCH_NOT_FOUND;
+}
+
+uint32_t
+checkpointed_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo,
+                    const search_limits_s *limits, search_counters_s *counters, uint32_t max_depth,
+                    checkpointer_s *checkpointer) {
+        bool deepening = (limits != NULL && limits->deepening);
+        if (deepening)
+                checkpointer = NULL;
+        const checkpoint_s *resume = (checkpointer != NULL) ? checkpointer->resume : NULL;
+        if (resume != NULL && resume->partial)
+                memo = NULL;
+        if (memo != NULL)
+                memo_clear(memo);
+        double start = omp_get_wtime();
+        budget_s budget;
+        init_budget(&budget, limits, start);
+        if (resume != NULL)
+                budget.nodes = resume->nodes;
+        search_s s = {
+                .strategy = strategy,
+                .split_components = false,
+                .num_threads = 1,
+                .pending = NULL,
+                .cancelled = NULL,
+                .solution = NULL,
+                .solution_arena = NULL,
+                .parent = NULL,
+                .memo = memo,
+                .budget = &budget,
+                .checkpointer = checkpointer
+        };
+        search_counters_s partial;
+        bool found = deepening_search(stp, levels, &s, max_depth, deepening, &partial) != NULL;
+        /* the instance may have been solved before reaching the frontier */
+        if (checkpointer != NULL)
+                checkpointer->resume = NULL;
+        return search_status(found, &budget, start, &partial, counters);
+}
+
+uint32_t
+exhaustive_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo,
+                  const search_limits_s *limits, search_counters_s *counters, uint32_t max_depth) {
+        return checkpointed_search(stp, levels, strategy, memo, limits, counters, max_depth, NULL);
+}
+
+/**
+   \brief solves each nontrivial connected component of \c stp in a separate
+   OpenMP task, each one with its own copy of the component and its own
+   stack of levels.
+
+   As soon as a component has no solution, all other tasks are cancelled.
+
+   \return \c true iff all components have a solution. In that case \c trees
+   is the comma-separated list of their trees, freed by the caller.
+*/
+static bool
+solve_components(state_s *stp, const search_s *parent, char **trees) {
+        uint32_t nv = stp->red_black->num_vertices;
+        uint32_t *labels = stp->workspace.labels;
+        uint32_t num_components = 0;
+        for (uint32_t v = 0; v < nv; v++)
+                if (stp->component_size[v] > 1)
+                        labels[num_components++] = v;
+        log_debug("solve_components: %d components", num_components);
+
+        bool cancelled = false;
+        search_s sub = *parent;
+        sub.cancelled = &cancelled;
+        sub.parent = parent;
+        char **results = stp->workspace.results;
+        for (uint32_t i = 0; i < num_components; i++) {
+#pragma omp task default(shared) firstprivate(i)
+                {
+                        arena_s arena;
+                        arena_init(&arena);
+                        state_s component;
+                        uint32_t n = stp->num_species_orig;
+                        uint32_t m = stp->num_characters_orig;
+                        init_state(&component, n, m, &arena);
+                        copy_component(&component, stp, labels[i]);
+                        level_s *levels = search(&component, new_levels(n, m, &arena), &sub, n + 2 * m);
+                        results[i] = NULL;
+                        if (levels != NULL) {
+                                results[i] = newick_subtree(&component, levels);
+                                free_subtrees(levels);
+                        } else {
+#pragma omp atomic write
+                                cancelled = true;
+                        }
+                        arena_release(&arena);
+                }
+        }
+#pragma omp taskwait
+        if (cancelled) {
+                for (uint32_t i = 0; i < num_components; i++)
+                        if (results[i] != NULL)
+                                xfree(results[i]);
+                return false;
+        }
+
+        strbuf_s sb;
+        strbuf_init(&sb);
+        for (uint32_t i = 0; i < num_components; i++) {
+                if (i > 0)
+                        strbuf_putc(&sb, ',');
+                strbuf_puts(&sb, results[i]);
+                xfree(results[i]);
+        }
+        *trees = sb.data;
+        log_debug("solve_components: %s", *trees);
+        return true;
+}
+
+uint32_t
+parallel_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo, uint32_t num_threads,
+                bool split_components, const search_limits_s *limits, search_counters_s *counters, char **tree) {
+        uint32_t pending = 0;
+        if (num_threads > 1)
+                memo = NULL;
+        if (memo != NULL)
+                memo_clear(memo);
+        double start = omp_get_wtime();
+        budget_s budget;
+        init_budget(&budget, limits, start);
+        search_counters_s partial = {
+                .iterations = 1,
+                .max_losses = -1
+        };
+        bool deepening = (limits != NULL && limits->deepening);
+        search_s s = {
+                .strategy = strategy,
+                .split_components = split_components,
+                .num_threads = num_threads,
+                .pending = &pending,
+                .cancelled = NULL,
+                .solution = NULL,
+                .solution_arena = NULL,
+                .parent = NULL,
+                .memo = memo,
+                .budget = &budget,
+                .checkpointer = NULL
+        };
+        bool found = false;
+        memory_init_threads();
+        cleanup(stp);
+        update_connected_components(stp);
+        uint32_t team_size = (num_threads > 1) ? num_threads : omp_get_max_threads();
+#pragma omp parallel default(shared) num_threads(team_size)
+        {
+                memory_register_thread();
+#pragma omp barrier
+#pragma omp single
+                {
+                        if (split_components) {
+                                char *trees = NULL;
+                                uint32_t num_components = num_nontrivial_components(stp);
+                                if (num_components > 1)
+                                        budget.stats.component_splits++;
+                                found = (num_components == 0) || solve_components(stp, &s, &trees);
+                                if (found) {
+                                        size_t length = (trees != NULL) ? strlen(trees) : 0;
+                                        *tree = xmalloc((length + 4) * sizeof(char));
+                                        sprintf(*tree, (num_components > 1) ? "(%s);" : "%s;",
+                                                (trees != NULL) ? trees : "");
+                                }
+                                if (trees != NULL)
+                                        xfree(trees);
+                        } else {
+                                uint32_t max_depth = stp->num_species_orig + 2 * stp->num_characters_orig;
+                                found = (deepening_search(stp, levels, &s, max_depth, deepening, &partial) != NULL);
+                                if (found) {
+                                        *tree = newick(stp, levels);
+                                        free_subtrees(levels);
+                                }
+                        }
+                }
+        }
+        return search_status(found, &budget, start, &partial, counters);
+}
+
+static const char *engine_names[] = { "search", "sat" };
+
+/**
+   \brief writes in \c line, of \c size characters, the JSON record of the
+   counters of the search of the instance \c instance
+*/
+static void
+json_counters(char *line, size_t size, const char *status, const search_counters_s *counters, uint64_t instance) {
+        const search_stats_s *st = &(counters->stats);
+        int written = snprintf(line, size, "{\"instance\":%" PRIu64 ",\"status\":\"%s\",\"nodes\":%" PRIu64
+                               ",\"time_ms\":%" PRIu64 ",\"elapsed_us\":%" PRIu64 ",\"iterations\":%" PRIu32,
+                               instance, status, counters->nodes, counters->time_us / 1000, counters->time_us,
+                               counters->iterations);
+        if (counters->max_losses != -1)
+                written += snprintf(line + written, size - written, ",\"max_losses\":%" PRIu32, counters->max_losses);
+        if (counters->engine != -1)
+                written += snprintf(line + written, size - written, ",\"engine\":\"%s\"", engine_names[counters->engine]);
+        snprintf(line + written, size - written,
+                 ",\"realizations\":%" PRIu64 ",\"failed_realizations\":%" PRIu64 ",\"pruned\":%" PRIu64
+                 ",\"backtracks\":%" PRIu64 ",\"max_backtrack\":%" PRIu32 ",\"component_splits\":%" PRIu64
+                 ",\"max_depth\":%" PRIu32 ",\"interchangeable\":%" PRIu64 ",\"time_us\":{\"realize\":%" PRIu64 ",\"conflict_graph\":%" PRIu64
+                 ",\"components\":%" PRIu64 ",\"smallest_component\":%" PRIu64 "},\"peak_rss_kb\":%" PRIu64 "}",
+                 st->realizations, st->failed_realizations, st->pruned, st->backtracks, st->max_backtrack,
+                 st->component_splits, st->max_depth, st->interchangeable, st->times.realize / 1000, st->times.conflict_graph / 1000,
+                 st->times.components / 1000, st->times.smallest_component / 1000, memory_peak_rss());
+}
+
+/*
+  The line of the counters, starting with a newline, in line, whose size is
+  COUNTERS_LINE_SIZE, or an empty string if counters is NULL
+*/
+#define COUNTERS_LINE_SIZE 640
+
+static void
+counters_line(char *line, uint32_t status, const search_counters_s *counters, bool json, uint64_t instance) {
+        static const char *names[] = { "found", "not_found", "unknown" };
+        line[0] = '\0';
+        if (counters != NULL && json) {
+                strcpy(line, "\n# ");
+                json_counters(line + 3, COUNTERS_LINE_SIZE - 3, names[status], counters, instance);
+        } else if (counters != NULL) {
+                int written = snprintf(line, COUNTERS_LINE_SIZE,
+                                       "\n# status=%s nodes=%" PRIu64 " time_ms=%" PRIu64 " iterations=%" PRIu32,
+                                       names[status], counters->nodes, counters->time_us / 1000, counters->iterations);
+                if (counters->max_losses != -1)
+                        written += snprintf(line + written, COUNTERS_LINE_SIZE - written,
+                                            " max_losses=%" PRIu32, counters->max_losses);
+                if (counters->engine != -1)
+                        snprintf(line + written, COUNTERS_LINE_SIZE - written,
+                                 " engine=%s", engine_names[counters->engine]);
+        }
+}
+
+static const char *
+outcome(uint32_t status, const char *tree) {
+        return (status == SEARCH_FOUND) ? tree : (status == SEARCH_NOT_FOUND) ? "Not found" : "Unknown";
+}
+
+char *
+result_line(uint32_t status, const char *tree, const search_counters_s *counters, bool json, uint64_t instance) {
+        const char *result_outcome = outcome(status, tree);
+        char line[COUNTERS_LINE_SIZE];
+        counters_line(line, status, counters, json, instance);
+        size_t length = strlen(result_outcome);
+        size_t line_length = strlen(line);
+        char *result = xmalloc((length + line_length + 1) * sizeof(char));
+        memcpy(result, result_outcome, length);
+        memcpy(result + length, line, line_length + 1);
+        return result;
+}
+
+void
+write_result(FILE *outf, uint32_t status, const char *tree, const search_counters_s *counters, bool json,
+             uint64_t instance) {
+        char line[COUNTERS_LINE_SIZE];
+        counters_line(line, status, counters, json, instance);
+        fputs(outcome(status, tree), outf);
+        fputs(line, outf);
+        putc('\n', outf);
+}
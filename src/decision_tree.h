@@ -18,29 +18,242 @@
   Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 
 */
-#include "perfect_phylogeny.h"
+#include "checkpoint.h"
+#include "memo.h"
 
 /**
    The strategy is a function that take as a parameter a pointer to a new
-   state, analyzes such state to which characters can be realized and
-   their order.
+   state and the \c size inactive characters of the component that will be
+   solved at the current node of the decision tree, and reorders such
+   characters.
 
    In other words, it computes in which order we try to realize the characters
    at the current node of the decision tree
 */
-typedef uint32_t (*strategy_fn)(state_s *stp, uint32_t *chars);
+typedef void (*strategy_fn)(const state_s *stp, uint32_t *chars, uint32_t size);
+
+/*
+  id codes of the strategies, selected with -s
+  STRATEGY_INPUT_ORDER      => same order as the input
+  STRATEGY_MAX_DEGREE       => largest degree in the red-black graph first
+  STRATEGY_MIN_CONFLICTS    => smallest degree in the conflict graph first
+  STRATEGY_FEWEST_SPECIES   => fewest species in the component of the
+                               character after its realization first
+  STRATEGY_MOST_CONSTRAINED => largest degree in the conflict graph first,
+                               ties broken by the red-black degree
+*/
+#define STRATEGY_INPUT_ORDER      0
+#define STRATEGY_MAX_DEGREE       1
+#define STRATEGY_MIN_CONFLICTS    2
+#define STRATEGY_FEWEST_SPECIES   3
+#define STRATEGY_MOST_CONSTRAINED 4
+#define NUM_STRATEGIES            5
+
+/*
+  outcomes of a search
+  SEARCH_FOUND     => the instance has a solution
+  SEARCH_NOT_FOUND => the instance has no solution
+  SEARCH_UNKNOWN   => a limit has been reached before the decision tree has
+                      been completely explored
+*/
+#define SEARCH_FOUND     0
+#define SEARCH_NOT_FOUND 1
+#define SEARCH_UNKNOWN   2
+
+/*
+  engines that solve an instance, selected with --engine
+  ENGINE_SEARCH    => exploration of the decision tree
+  ENGINE_SAT       => reduction to satisfiability, as in bin/cppp-sat
+  ENGINE_PORTFOLIO => both engines at the same time, the first answer wins
+*/
+#define ENGINE_SEARCH    0
+#define ENGINE_SAT       1
+#define ENGINE_PORTFOLIO 2
+
+/**
+   \struct search_limits_s
+   \brief the budget of the search of an instance
+
+   \c max_nodes is the maximum number of nodes of the decision tree that are
+   visited, and \c timeout_ms is the maximum time, in milliseconds, spent on
+   the instance. \c deadline is an absolute time, as returned by
+   \c omp_get_wtime, when all searches stop: it bounds a whole batch of
+   instances. A value 0 means no limit.
+
+   If \c deepening is \c true, the decision tree is explored again and again,
+   allowing at most 0, 1, 2, ... characters to be lost, until a solution is
+   found or the tree is explored without cutting any branch because of such
+   bound. The components that are solved separately are always explored
+   without bound.
+
+   \c cancelled, if it is not \c NULL, stops the search as soon as it is
+   set, as if the budget was exhausted.
+
+   If \c timed is \c true, the times of the counters are measured. Reading
+   the clock at each operation is not free, hence they are otherwise 0.
+*/
+typedef struct search_limits_s {
+        uint64_t max_nodes;
+        uint64_t timeout_ms;
+        double deadline;
+        bool deepening;
+        const bool *cancelled;
+        bool timed;
+} search_limits_s;
+
+/**
+   \struct search_stats_s
+   \brief what the exploration of a decision tree has done
+
+   \c realizations and \c failed_realizations are the numbers of calls to
+   \c realize_character that have succeeded and failed, and \c pruned is the
+   number of successful realizations whose instance has been cut, since it
+   is known to have no solution, or it has none within the maximum depth.
+   \c backtracks is the number of times that the search has moved back to
+   a shallower node, and \c max_backtrack is the largest number of levels
+   climbed at once.
+   \c component_splits is the number of realizations whose components have
+   been solved separately, and \c max_depth is the deepest level reached.
+   \c interchangeable is the number of characters that have not been tried,
+   since they are interchangeable with a character of the same node.
+   \c times is the time spent in the main operations on the states, if the
+   search is timed.
+*/
+typedef struct search_stats_s {
+        uint64_t realizations;
+        uint64_t failed_realizations;
+        uint64_t pruned;
+        uint64_t backtracks;
+        uint32_t max_backtrack;
+        uint64_t component_splits;
+        uint32_t max_depth;
+        uint64_t interchangeable;
+        state_times_s times;
+} search_stats_s;
+
+/**
+   \struct search_counters_s
+   \brief what a search has done
+
+   \c nodes is the number of nodes of the decision tree that have been
+   visited, \c time_us is the time spent, in microseconds.
+   With iterative deepening, \c iterations is the number of times that the
+   decision tree has been explored, and \c max_losses is the maximum number
+   of losses allowed in the last iteration, or -1 if the last iteration had
+   no bound.
+   With the portfolio, \c engine is the engine that has given the answer,
+   otherwise it is -1.
+   \c stats are those of all the decision trees explored, including those
+   of the components solved separately. They are all 0 for the SAT engine.
+*/
+typedef struct search_counters_s {
+        uint64_t nodes;
+        uint64_t time_us;
+        uint32_t iterations;
+        uint32_t max_losses;
+        uint32_t engine;
+        search_stats_s stats;
+} search_counters_s;
+
+/**
+   \brief the time, as returned by \c omp_get_wtime, when the search of an
+   instance that has started at \c start must stop because of \c limits, or
+   0 if there is no such time
+*/
+double
+search_deadline(const search_limits_s *limits, double start);
+
+/**
+   \brief the line describing the outcome \c status of a search: the tree, in
+   Newick format, if \c status is \c SEARCH_FOUND, or "Not found" or
+   "Unknown".
+
+   If \c counters is not \c NULL, a second line, starting with #, contains
+   the status and the counters of the search. If \c json is \c true, such
+   line is a JSON record, with all the counters and the index \c instance of
+   the instance in the input file.
+*/
+char *
+result_line(uint32_t status, const char *tree, const search_counters_s *counters, bool json, uint64_t instance);
+
+/**
+   \brief writes to \c outf the result line of \c result_line, followed by
+   a newline, without building it in memory
+*/
+void
+write_result(FILE *outf, uint32_t status, const char *tree, const search_counters_s *counters, bool json,
+             uint64_t instance);
+
+/**
+   \brief the strategy with id code \c id
+
+   returns \c NULL if there is no such strategy
+*/
+strategy_fn
+get_strategy(uint32_t id);
 
 /**
    \brief visits the entire tree of the possible completions
 
-   \param states: an array of states. In \c states[0] is stored the initial
-   instance
+   \param stp: the initial instance. It is modified in place during the
+   search, and it is restored by undoing the changes when backtracking.
+   \param levels: an array of at least \c max_depth+1 nodes of the decision
+   tree, allocated with \c init_level. When a solution is found, \c levels
+   encodes the realizations leading to such solution.
    \param strategy: the callback function that determines the order according to
    which all characters are tried
+   \param memo: if it is not \c NULL, the table where the instances without a
+   solution are recorded, so that they are not explored again. The table is
+   not used by the iterations of iterative deepening that have a bound on the
+   number of losses, since their failures may be due to the bound.
+   \param limits: the budget of the search, or \c NULL if there is no limit
+   \param counters: if it is not \c NULL, it receives the counters of the
+   search
    \param max_depth: maximum depth of the search tree
 
-   returns \c true iff a solution is found
+   returns one of \c SEARCH_FOUND, \c SEARCH_NOT_FOUND and \c SEARCH_UNKNOWN
 */
 
-bool
-exhaustive_search(state_s *states, strategy_fn strategy, uint32_t max_depth);
+uint32_t
+exhaustive_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo,
+                  const search_limits_s *limits, search_counters_s *counters, uint32_t max_depth);
+
+/**
+   \brief same as \c exhaustive_search, but the frontier of the search is
+   written periodically by \c checkpointer, if it is not \c NULL, and the
+   search continues from the frontier of its \c resume, if any, which is
+   then cleared. The node counter starts from the nodes of such checkpoint,
+   and the table of failures is not used if it is partial.
+
+   There are no checkpoints with iterative deepening.
+*/
+uint32_t
+checkpointed_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo,
+                    const search_limits_s *limits, search_counters_s *counters, uint32_t max_depth,
+                    checkpointer_s *checkpointer);
+
+/**
+   \brief same as \c exhaustive_search, but the search is performed by a
+   team of \c num_threads OpenMP threads, starting from the nodes
+   \c levels, that are not used if \c split_components is \c true.
+
+   The branches of the decision tree are split among the threads: an idle
+   thread receives the untried characters of the shallowest node of a busy
+   thread, and the first thread that finds a solution stops all others.
+
+   If \c split_components is \c true, each connected component of the
+   red-black graph is solved by a different OpenMP task, each with its own
+   copy of the component and its own decision tree.
+   The same happens every time a realization splits a component.
+
+   \c memo is used only if the branches are not explored in parallel, that
+   is if \c num_threads is at most 1.
+
+   \param tree: if a solution is found, it contains the resulting tree in
+   Newick format
+
+   returns one of \c SEARCH_FOUND, \c SEARCH_NOT_FOUND and \c SEARCH_UNKNOWN
+*/
+uint32_t
+parallel_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo, uint32_t num_threads,
+                bool split_components, const search_limits_s *limits, search_counters_s *counters, char **tree);
@@ -26,71 +26,59 @@
 #include "graph.h"
 
 
+static inline bitmap_word*
+graph_row(const graph_s* gp, uint32_t v) {
+        return gp->adjacency + (size_t) v * gp->row_words;
+}
+
+#ifdef DEBUG
 void
 graph_check(const graph_s *gp) {
         assert(gp != NULL);
         unsigned int err = 0;
-#ifdef DEBUG
-        if (gp->degrees == NULL)
-                err = 1;
         if (gp->adjacency == NULL)
                 err = 2;
         uint32_t n = gp->num_vertices;
-
-        for (uint32_t v=0; v < n; v++)
-                if (gp->degrees[v] > n)
-                        err = 3;
+        if (gp->row_words != BITMAP_NWORDS(n))
+                err = 3;
 
         if (err == 0)
-                for (uint32_t v=0; v < n; v++) {
-                        uint32_t deg = 0;
-                        for (uint32_t v2=0; v2 < n; v2++) {
-                                if (graph_get_edge(gp, v, v2) != graph_get_edge(gp, v, v2))
+                for (uint32_t v=0; v < n; v++)
+                        for (uint32_t v2=0; v2 < n; v2++)
+                                if (graph_get_edge(gp, v, v2) != graph_get_edge(gp, v2, v))
                                         err = 4;
-                                if (graph_get_edge(gp, v, v2))
-                                        deg += 1;
-                        }
-                        if (deg != graph_degree(gp, v))
-                                err = 5;
-                }
 
-        /* Check if adjacency matrix and lists are the same
+        /* Check that no vertex is adjacent to itself
          */
         if (err == 0)
-                for (uint32_t v=0; v < n; v++) {
-                        bool from_matrix[n];
-                        bool from_list[n];
-                        memset(from_list, 0, n * sizeof(bool));
-                        for (uint32_t v2=0; v2 < n; v2++)
-                                from_matrix[v2] = graph_get_edge(gp, v, v2);
-                        for (uint32_t pos=0; pos < graph_degree(gp, v); pos++)
-                                from_list[graph_get_edge_pos(gp, v, pos)] = true;
-                        for (uint32_t v2=0; v2 < n; v2++)
-                                if (from_matrix[v2] != from_list[v2])
-                                        err = 6;
-                }
+                for (uint32_t v=0; v < n; v++)
+                        if (graph_get_edge(gp, v, v))
+                                err = 5;
 
+        /* Check that the bits after the last vertex are cleared, since
+           degrees are computed with a popcount over the whole row
+         */
+        if (err == 0 && BITMAP_HASTAIL(n))
+                for (uint32_t v=0; v < n; v++)
+                        if (BITMAP_TAILWORD(graph_row(gp, v), n) & ~BITMAP_TAILBITS(n))
+                                err = 6;
 
-#endif
         if (err > 0) {
                 graph_pp(gp);
                 log_debug("check_graph code: %d", err);
         }
         assert(err == 0);
 }
+#endif
 
 
 graph_s*
-graph_new(uint32_t n) {
+graph_new(uint32_t n, arena_s *ap) {
         log_debug("graph_new (n=%d)", n);
-        graph_s* gp = xmalloc(sizeof(graph_s));
+        graph_s* gp = arena_alloc(ap, sizeof(graph_s));
         gp->num_vertices = n;
-        gp->adjacency = xmalloc(n * n * sizeof(bool));
-        memset(gp->adjacency, 0, n * n * sizeof(bool));
-        gp->degrees = xmalloc(n * sizeof(uint32_t));
-        memset(gp->degrees, 0, n * sizeof(uint32_t));
-        gp->adjacency_lists = xmalloc(n * n * sizeof(uint32_t));
-        memset(gp->adjacency_lists, 0, n * n * sizeof(uint32_t));
+        gp->row_words = BITMAP_NWORDS(n);
+        gp->adjacency = arena_alloc(ap, n * gp->row_words * sizeof(bitmap_word));
 
         return gp;
 }
@@ -101,52 +89,55 @@ void
 graph_add_edge(graph_s* gp, uint32_t v1, uint32_t v2) {
         log_debug("graph_add_edge %d %d", v1, v2);
         graph_check(gp);
-        gp->adjacency[v1 * (gp->num_vertices) + v2] = true;
-        gp->adjacency[v2 * (gp->num_vertices) + v1] = true;
-        (gp->adjacency_lists)[v1 * (gp->num_vertices) + graph_degree(gp, v1)] = v2;
-        (gp->adjacency_lists)[v2 * (gp->num_vertices) + graph_degree(gp, v2)] = v1;
-
-        (gp->degrees)[v1] += 1;
-        (gp->degrees)[v2] += 1;
+        bitmap_set_bit(graph_row(gp, v1), v2);
+        bitmap_set_bit(graph_row(gp, v2), v1);
         graph_check(gp);
 }
 
 
 bool
 graph_get_edge(const graph_s* gp, uint32_t v1, uint32_t v2) {
-        return (gp->adjacency[v1 * (gp->num_vertices) + v2]);
+        return bitmap_get_bit(graph_row(gp, v1), v2);
 }
 
 /**
    \brief returns the (pos+1)-th vertex that is adjacent to v1
+
+   The neighbours are enumerated in increasing order, skipping whole words
+   with a popcount.
 */
 uint32_t
 graph_get_edge_pos(const graph_s* gp, uint32_t v, uint32_t pos) {
         assert(pos < graph_degree(gp, v));
-        return (gp->adjacency_lists)[v * (gp->num_vertices) + pos];
+        const bitmap_word* row = graph_row(gp, v);
+        uint32_t i = 0;
+        for (uint32_t count = __builtin_popcountll(row[i]); pos >= count; count = __builtin_popcountll(row[i])) {
+                pos -= count;
+                i++;
+        }
+        bitmap_word w = row[i];
+        for (; pos > 0; pos--)
+                w &= w - 1;
+        return (i << LOG_BITMAP_WORD_BITS) + __builtin_ctzll(w);
+}
+
+uint32_t
+graph_next_neighbour(const graph_s* gp, uint32_t v, uint32_t from) {
+        return bitmap_next_bit(graph_row(gp, v), from, gp->num_vertices);
+}
+
+const bitmap_word*
+graph_neighbourhood(const graph_s* gp, uint32_t v) {
+        return graph_row(gp, v);
 }
 
 void
 graph_del_edge(graph_s* gp, uint32_t v1, uint32_t v2) {
         log_debug("graph_del_edge %d %d", v1, v2);
         graph_check(gp);
-        gp->adjacency[v1 * (gp->num_vertices) + v2] = false;
-        gp->adjacency[v2 * (gp->num_vertices) + v1] = false;
-
-        uint32_t pos = 0;
-        while ((gp->adjacency_lists)[v1 * (gp->num_vertices) + pos] != v2)
-                pos += 1;
-        assert(pos < graph_degree(gp, v1));
-        (gp->adjacency_lists)[v1 * (gp->num_vertices) + pos] = (gp->adjacency_lists)[v1 * (gp->num_vertices) + graph_degree(gp, v1) - 1];
-
-        pos = 0;
-        while ((gp->adjacency_lists)[v2 * (gp->num_vertices) + pos] != v1)
-                pos += 1;
-        assert(pos < graph_degree(gp, v2));
-        (gp->adjacency_lists)[v2 * (gp->num_vertices) + pos] = (gp->adjacency_lists)[v2 * (gp->num_vertices) + graph_degree(gp ,v2) - 1];
-
-        (gp->degrees)[v1] -= 1;
-        (gp->degrees)[v2] -= 1;
+        assert(graph_get_edge(gp, v1, v2));
+        bitmap_clear_bit(graph_row(gp, v1), v2);
+        bitmap_clear_bit(graph_row(gp, v2), v1);
 
         log_debug("graph_del_edge %d %d: completed", v1, v2);
         graph_pp(gp);
@@ -157,95 +148,101 @@ void
 graph_nuke_edges(graph_s* gp) {
         log_debug("graph_nuke_edges");
         graph_check(gp);
-        memset(gp->degrees, 0, (gp->num_vertices) * sizeof((gp->degrees)[0]));
-        memset(gp->adjacency, 0, (gp->num_vertices) * (gp->num_vertices) * sizeof((gp->adjacency)[0]));
-        memset(gp->adjacency_lists, 0, (gp->num_vertices) * (gp->num_vertices) * sizeof((gp->adjacency_lists)[0]));
+        memset(gp->adjacency, 0, (gp->num_vertices) * (gp->row_words) * sizeof((gp->adjacency)[0]));
         graph_check(gp);
 }
 
 
+/**
+   The visit is performed one level at a time: the new border is the union of
+   the rows of all vertices in the current border, minus the vertices
+   already reached.
+*/
 void
-graph_reachable(const graph_s* gp, uint32_t v, bool* reached) {
+graph_reachable_bitmap(const graph_s* gp, uint32_t v, bitmap_word* reached, bitmap_word* scratch) {
         assert(gp != NULL);
         assert(reached != NULL);
-        graph_check(gp);
-        log_debug("graph_reachable: graph_s=%p, v=%d, reached=%p", gp, v, reached);
         uint32_t n = gp->num_vertices;
-        uint32_t border[n];
-        uint32_t new_border[n];
-        uint32_t border_size = 1;
-        memset(reached, 0, n * sizeof(bool));
-        border[0] = v;
-        reached[v] = true;
-        while (border_size > 0) {
-                uint32_t new_border_size = 0;
-                for (uint32_t vx = 0; vx < border_size; vx++) {
-                        uint32_t v1 = border[vx];
-                        for (uint32_t p = 0; p < graph_degree(gp, v1); p++) {
-                                uint32_t w = graph_get_edge_pos(gp, v1, p);
-                                if (!reached[w]) {
-                                        new_border[new_border_size++] = w;
-                                        reached[w] = true;
-                                }
-                        }
+        uint32_t words = gp->row_words;
+        bitmap_word* border = scratch;
+        bitmap_word* new_border = scratch + words;
+        bitmap_zero(reached, n);
+        bitmap_zero(border, n);
+        bitmap_set_bit(reached, v);
+        bitmap_set_bit(border, v);
+        for (bool nonempty = true; nonempty; ) {
+                bitmap_zero(new_border, n);
+                for (uint32_t w = bitmap_next_bit(border, 0, n); w < n; w = bitmap_next_bit(border, w + 1, n)) {
+                        const bitmap_word* row = graph_row(gp, w);
+                        for (uint32_t i = 0; i < words; i++)
+                                new_border[i] |= row[i];
+                }
+                nonempty = false;
+                for (uint32_t i = 0; i < words; i++) {
+                        border[i] = new_border[i] & ~reached[i];
+                        reached[i] |= border[i];
+                        nonempty = nonempty || (border[i] != 0);
                 }
-                memcpy(border, new_border, new_border_size * sizeof(new_border[0]));
-                border_size = new_border_size;
         }
+}
+
+void
+graph_reachable(const graph_s* gp, uint32_t v, bool* reached, bitmap_word* scratch) {
+        assert(gp != NULL);
+        assert(reached != NULL);
+        graph_check(gp);
+        log_debug("graph_reachable: graph_s=%p, v=%d, reached=%p", gp, v, reached);
+        uint32_t n = gp->num_vertices;
+        bitmap_word* reached_bm = scratch + GRAPH_REACHABLE_ROWS * gp->row_words;
+        graph_reachable_bitmap(gp, v, reached_bm, scratch);
+        for (uint32_t w = 0; w < n; w++)
+                reached[w] = bitmap_get_bit(reached_bm, w);
         log_array_bool("reached: ", reached, gp->num_vertices);
         log_debug("graph_reachable: end");
 }
 
+/**
+   The vertices are visited in increasing order, therefore the first vertex
+   of each connected component that is visited is its smallest vertex.
+*/
 void
-connected_components(graph_s* gp, uint32_t* components) {
+connected_components(graph_s* gp, uint32_t* components, bitmap_word* scratch) {
         assert(gp!=NULL);
         assert(components != NULL);
         log_debug("connected_components");
         log_debug("connected_components: graph_s=%p", gp);
         graph_check(gp);
         graph_pp(gp);
-        memset(components, 0, (gp->num_vertices) * sizeof(uint32_t));
-        bool visited[gp->num_vertices];
-        memset(visited, 0, gp->num_vertices * sizeof(bool));
+        uint32_t n = gp->num_vertices;
+        bitmap_word* unvisited = scratch + GRAPH_REACHABLE_ROWS * gp->row_words;
+        bitmap_word* reached = unvisited + gp->row_words;
+        bitmap_fill(unvisited, n);
 
-        uint32_t color = 0;
-        for (uint32_t v = 0; v < gp->num_vertices; color++) {
+        for (uint32_t v = bitmap_next_bit(unvisited, 0, n); v < n; v = bitmap_next_bit(unvisited, v + 1, n)) {
                 log_debug("Reaching from %d", v);
 /*
   Check if v is an isolated vertex.
   In that case we do not call graph_reachable to find its connected
 */
                 if (graph_degree(gp, v) == 0) {
-                        components[v] = color;
-                        visited[v] = true;
-                } else {
-                        bool current_component[gp->num_vertices];
-                        graph_reachable(gp, v, current_component);
-                        for (uint32_t w = 0; w < gp->num_vertices; w++)
-                                if (current_component[w]) {
-                                        components[w] = color;
-                                        visited[w] = true;
-                                }
+                        components[v] = v;
+                        bitmap_clear_bit(unvisited, v);
+                        continue;
+                }
+                graph_reachable_bitmap(gp, v, reached, scratch);
+                for (uint32_t w = bitmap_next_bit(reached, v, n); w < n; w = bitmap_next_bit(reached, w + 1, n)) {
+                        components[w] = v;
+                        bitmap_clear_bit(unvisited, w);
                 }
-/*
-  Find the next vertex in an unexplored component
-*/
-                uint32_t next = gp->num_vertices;
-                for (uint32_t w = v + 1; w < gp->num_vertices; w++)
-                        if (!visited[w]) {
-                                next = w;
-                                break;
-                        }
-                v = next;
         }
         log_array_uint32_t("component",components, gp->num_vertices);
         log_debug("connected_components: end");
 }
 
 
+#ifdef DEBUG
 void
 graph_pp(const graph_s* gp) {
-#ifdef DEBUG
         assert(gp != NULL);
         log_debug("graph_pp");
         uint32_t n = gp->num_vertices;
@@ -260,15 +257,15 @@ graph_pp(const graph_s* gp) {
                 fprintf(stderr, "\n");
         }
 
-        fprintf(stderr, "Adjacency lists\n");
+        fprintf(stderr, "Neighbourhoods\n");
         for (uint32_t v=0; v < n; v++) {
                 fprintf(stderr, "Vertex %d (degree %d):", v, graph_degree(gp, v));
-                for (uint32_t p=0; p < graph_degree(gp, v); p++)
-                        fprintf(stderr, " %d", graph_get_edge_pos(gp, v, p));
+                for (uint32_t w = graph_next_neighbour(gp, v, 0); w < n; w = graph_next_neighbour(gp, v, w + 1))
+                        fprintf(stderr, " %d", w);
                 fprintf(stderr, "\n");
         }
-#endif
 }
+#endif
 
 
 void
@@ -278,9 +275,8 @@ graph_copy(graph_s* dst, const graph_s* src) {
         graph_check(src);
         graph_pp(src);
         dst->num_vertices = src->num_vertices;
-        memcpy(dst->adjacency, src->adjacency, (src->num_vertices) * (src->num_vertices) * sizeof((src->adjacency)[0]));
-        memcpy(dst->adjacency_lists, src->adjacency_lists, (src->num_vertices) * (src->num_vertices) * sizeof((src->adjacency_lists)[0]));
-        memcpy(dst->degrees, src->degrees, (src->num_vertices) * sizeof((src->degrees)[0]));
+        dst->row_words = src->row_words;
+        memcpy(dst->adjacency, src->adjacency, (src->num_vertices) * (src->row_words) * sizeof((src->adjacency)[0]));
         log_debug("graph_copy: copied");
 
         if (graph_cmp(src, dst) != 0)
@@ -295,7 +291,7 @@ graph_copy(graph_s* dst, const graph_s* src) {
 uint32_t
 graph_degree(const graph_s* gp, uint32_t v) {
         assert(v < gp->num_vertices);
-        return (gp->degrees)[v];
+        return bitmap_popcount(graph_row(gp, v), gp->num_vertices);
 }
 
 
@@ -308,15 +304,7 @@ uint32_t graph_cmp(const graph_s *gp1, const graph_s *gp2) {
         if (gp1->num_vertices != gp2->num_vertices)
                 return 1;
 
-        if (memcmp(gp1->degrees, gp2->degrees, (gp1->num_vertices) * sizeof((gp1->degrees)[0])))
-                return 2;
-
-        for (uint32_t v = 0; v < gp1->num_vertices; v++)
-                for (uint32_t w = 0; w < (gp1->degrees)[v]; w++)
-                        if (gp1->adjacency_lists[w] != gp2->adjacency_lists[w])
-                                return 3;
-
-        if (memcmp(gp1->adjacency, gp2->adjacency, (gp1->num_vertices) * (gp1->num_vertices) * sizeof((gp1->adjacency)[0])))
+        if (memcmp(gp1->adjacency, gp2->adjacency, (gp1->num_vertices) * (gp1->row_words) * sizeof((gp1->adjacency)[0])))
                 return 4;
 
         return 0;
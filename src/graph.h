@@ -41,28 +41,33 @@
 #include <string.h>
 #include <err.h>
 #include <inttypes.h>
-#include <gc.h>
 #include <error.h>
 #include "logging.h"
 #include "memory.h"
+#include "bitmap.h"
 #include <omp.h>
 /**
    \struct graph_s
-   \brief a graph is made of the adjacency list and the degree of each
-   vertex, as well as the number of vertices
+   \brief a graph is made of the adjacency matrix, stored as a sequence of
+   packed rows (one bitmap for each vertex), as well as the number of vertices
+
+   Each row consists of \c row_words words, so that the neighbourhood of \c v
+   starts at \c adjacency + v * row_words.
+   The degree of a vertex is the popcount of its row.
+   Copying and comparing a graph only touches O(n^2/64) words.
 */
 
 typedef struct graph_s {
-        uint32_t *degrees;
-        bool *adjacency;
-        uint32_t *adjacency_lists;
+        bitmap_word *adjacency;
         uint32_t num_vertices;
+        uint32_t row_words;
 } graph_s;
 
 /**
    \brief managing graphs:
    \c graph_new creates a new graph, allocating the necessary memory
-   to store the desired number of vertices.
+   to store the desired number of vertices in the arena \c ap (or in the
+   heap, if \c ap is \c NULL).
 
    \c graph_add_edge adds an edge (returning false if the two vertices
    are already adjacent)
@@ -71,7 +76,7 @@ typedef struct graph_s {
    are already adjacent)
 */
 graph_s*
-graph_new(uint32_t num_vertices);
+graph_new(uint32_t num_vertices, arena_s *ap);
 
 void
 graph_add_edge(graph_s* gp, uint32_t v1, uint32_t v2);
@@ -85,17 +90,64 @@ graph_get_edge(const graph_s* gp, uint32_t v1, uint32_t v2);
 uint32_t
 graph_get_edge_pos(const graph_s* gp, uint32_t v1, uint32_t pos);
 
+/**
+   \brief iterates over the neighbourhood of \c v
+
+   \return the smallest vertex \c w such that \c w >= from and \c w is
+   adjacent to \c v, or \c num_vertices if there is no such vertex.
+
+   A typical loop is
+   \code
+   for (uint32_t w = graph_next_neighbour(gp, v, 0); w < gp->num_vertices; w = graph_next_neighbour(gp, v, w + 1))
+   \endcode
+*/
+uint32_t
+graph_next_neighbour(const graph_s* gp, uint32_t v, uint32_t from);
+
+/**
+   \brief the packed row encoding the neighbourhood of \c v
+*/
+const bitmap_word*
+graph_neighbourhood(const graph_s* gp, uint32_t v);
+
 /**
    \brief removes all edges of a graph
 */
 void
 graph_nuke_edges(graph_s* gp);
 
+/*
+  The visits of the graph borrow their temporary bitmaps from the caller:
+  \c scratch must have room for the given number of rows of the graph,
+  that is of \c row_words words each.
+*/
+#define GRAPH_REACHABLE_ROWS 2
+#define GRAPH_COMPONENTS_ROWS (GRAPH_REACHABLE_ROWS + 2)
+
+/**
+   \brief as \c graph_reachable_bitmap, with \c reached an array of booleans,
+   using \c GRAPH_REACHABLE_ROWS + 1 rows of \c scratch
+*/
 void
-graph_reachable(const graph_s* gp, uint32_t v, bool* reached);
+graph_reachable(const graph_s* gp, uint32_t v, bool* reached, bitmap_word* scratch);
+
+/**
+   \brief computes the set \c reached of vertices reachable from \c v, as a
+   bitmap of \c num_vertices bits, using \c GRAPH_REACHABLE_ROWS rows of
+   \c scratch.
 
+   The cost is proportional to the size of the connected component of \c v
+   times the number of words of a row.
+*/
+void
+graph_reachable_bitmap(const graph_s* gp, uint32_t v, bitmap_word* reached, bitmap_word* scratch);
+
+#ifdef DEBUG
 void
 graph_pp(const graph_s* gp);
+#else
+#define graph_pp(gp)
+#endif
 
 void
 graph_copy(graph_s* dst, const graph_s* src);
@@ -107,14 +159,16 @@ uint32_t
 graph_degree(const graph_s* gp, uint32_t v);
 
 /**
-   \brief computes the connected components of a graph
+   \brief computes the connected components of a graph, using
+   \c GRAPH_COMPONENTS_ROWS rows of \c scratch
 
    \return a pointer to the array where each vertex has a number
    encoding the connected component it belongs to.
+   Such number is the smallest vertex of the connected component.
 */
 
 void
-connected_components(graph_s* gp, uint32_t* components);
+connected_components(graph_s* gp, uint32_t* components, bitmap_word* scratch);
 
 /**
    \brief check if two graphs are the same.
@@ -126,6 +180,15 @@ uint32_t graph_cmp(const graph_s *gp1, const graph_s *gp2);
    \brief check if a graph is internally consistent
 
    Exits with an error code in case of a problem.
+   Without DEBUG, only the pointer is checked, so that the calls on the hot
+   path vanish when NDEBUG is also defined.
 */
+#ifdef DEBUG
 void
 graph_check(const graph_s *gp);
+#else
+static inline void
+graph_check(const graph_s *gp) {
+        assert(gp != NULL);
+}
+#endif
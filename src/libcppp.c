@@ -0,0 +1,135 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "libcppp.h"
+
+#define DEFAULT_MEMO_SIZE ((size_t) 16 << 20)
+
+void
+cppp_default_options(cppp_options_s *op) {
+        *op = (cppp_options_s) {
+                .engine = ENGINE_SEARCH,
+                .strategy = 0,
+                .threads = 1,
+                .split_components = false,
+                .collapse_duplicates = false,
+                .direct_phylogeny = false,
+                .memo_size = DEFAULT_MEMO_SIZE,
+                .limits = { 0 }
+        };
+}
+
+bool
+cppp_solver_init(cppp_solver_s *sp, const cppp_options_s *op) {
+        strategy_fn strategy = get_strategy(op->strategy);
+        if (strategy == NULL)
+                return false;
+        if (op->engine != ENGINE_SEARCH && (op->split_components || op->threads > 1))
+                return false;
+        sp->options = *op;
+        sp->strategy = strategy;
+        sp->levels = NULL;
+        sp->num_species = 0;
+        sp->num_characters = 0;
+        arena_init(&(sp->levels_arena));
+        arena_init(&(sp->instance_arena));
+        memo_init(&(sp->memo), (op->engine != ENGINE_SAT) ? op->memo_size : 0);
+        sat_engine_init(&(sp->sat_engine));
+        strbuf_init(&(sp->tree));
+        sp->checkpointer = NULL;
+        return true;
+}
+
+void
+cppp_solver_release(cppp_solver_s *sp) {
+        memo_release(&(sp->memo));
+        sat_engine_release(&(sp->sat_engine));
+        arena_release(&(sp->levels_arena));
+        arena_release(&(sp->instance_arena));
+        xfree(sp->tree.data);
+        strbuf_init(&(sp->tree));
+        sp->levels = NULL;
+}
+
+/*
+  The nodes of the decision tree of the instances of the size of stp
+*/
+static level_s *
+solver_levels(cppp_solver_s *sp, const state_s *stp) {
+        if (sp->levels == NULL || sp->num_species != stp->num_species_orig ||
+            sp->num_characters != stp->num_characters_orig) {
+                arena_reset(&(sp->levels_arena));
+                sp->levels = new_levels(stp->num_species_orig, stp->num_characters_orig, &(sp->levels_arena));
+                sp->num_species = stp->num_species_orig;
+                sp->num_characters = stp->num_characters_orig;
+                log_debug("solver_levels: %d %d", sp->num_species, sp->num_characters);
+        }
+        return sp->levels;
+}
+
+uint32_t
+cppp_solve_state(cppp_solver_s *sp, state_s *stp, search_counters_s *counters, char **tree) {
+        const cppp_options_s *op = &(sp->options);
+        level_s *levels = solver_levels(sp, stp);
+        char *result = NULL;
+        uint32_t status;
+        *tree = NULL;
+        strbuf_reset(&(sp->tree));
+        if (op->engine == ENGINE_SAT) {
+                status = sat_search(&(sp->sat_engine), stp, &(op->limits), counters, &result);
+        } else if (op->engine == ENGINE_PORTFOLIO) {
+                status = portfolio_search(stp, levels, sp->strategy, &(sp->memo), &(sp->sat_engine), &(op->limits),
+                                          counters, &result);
+        } else if (op->split_components || op->threads > 1) {
+                status = parallel_search(stp, levels, sp->strategy, &(sp->memo), op->threads, op->split_components,
+                                         &(op->limits), counters, &result);
+        } else {
+                status = checkpointed_search(stp, levels, sp->strategy, &(sp->memo), &(op->limits), counters,
+                                             stp->num_species + 2 * stp->num_characters, sp->checkpointer);
+                if (status == SEARCH_FOUND) {
+                        log_debug("Writing solution");
+                        newick_append(&(sp->tree), stp, levels);
+                        strbuf_putc(&(sp->tree), ';');
+                        free_subtrees(levels);
+                        *tree = sp->tree.data;
+                }
+                return status;
+        }
+/*
+  The other engines return a new string, which is moved to sp->tree, so
+  that every tree is owned by the solver
+*/
+        if (result != NULL) {
+                strbuf_puts(&(sp->tree), result);
+                xfree(result);
+                *tree = sp->tree.data;
+        }
+        return status;
+}
+
+uint32_t
+cppp_solve(cppp_solver_s *sp, const uint32_t *matrix, uint32_t num_species, uint32_t num_characters,
+           search_counters_s *counters, char **tree) {
+        arena_reset(&(sp->instance_arena));
+        state_from_matrix(&(sp->state), matrix, num_species, num_characters, &(sp->instance_arena),
+                          sp->options.collapse_duplicates, sp->options.direct_phylogeny);
+        check_state(&(sp->state));
+        return cppp_solve_state(sp, &(sp->state), counters, tree);
+}
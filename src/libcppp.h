@@ -0,0 +1,137 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_LIBCPPP_H
+#define CPPP_LIBCPPP_H
+#include "portfolio.h"
+
+/**
+   \file libcppp.h
+   \brief the C API of libcppp, which solves instances given as matrices in
+   memory, without files or command line parsing.
+
+   A solver is initialized once and then solves any number of instances,
+   of any size, keeping its nodes of the decision tree, its table of
+   failures and its SAT solver between them, so that solving a small
+   instance allocates almost nothing.
+*/
+
+/**
+   \struct cppp_options_s
+   \brief how a solver solves its instances
+
+   \c engine is one of \c ENGINE_SEARCH, \c ENGINE_SAT and
+   \c ENGINE_PORTFOLIO, and \c strategy is the id code of a strategy (see
+   \c get_strategy). \c threads and \c split_components are the arguments of
+   \c parallel_search, that is used only by the search engine when
+   \c threads is larger than 1 or \c split_components is \c true.
+   \c memo_size is the size, in bytes, of the table of failures, and
+   \c limits is the budget of each instance.
+   \c collapse_duplicates and \c direct_phylogeny are the fields of the
+   same name of each instance (see \c state_s).
+*/
+typedef struct cppp_options_s {
+        uint32_t engine;
+        uint32_t strategy;
+        uint32_t threads;
+        bool split_components;
+        bool collapse_duplicates;
+        bool direct_phylogeny;
+        size_t memo_size;
+        search_limits_s limits;
+} cppp_options_s;
+
+/**
+   \struct cppp_solver_s
+   \brief a solver, with all the memory that survives an instance
+
+   \c levels are the nodes of the decision tree for instances with
+   \c num_species species and \c num_characters characters, allocated in
+   \c levels_arena: they are reallocated only when the size of the
+   instances changes. The instances given as matrices are built in
+   \c state, whose arrays are in \c instance_arena, and the trees found by
+   every engine are written in \c tree.
+   \c checkpointer, \c NULL after \c cppp_solver_init, is the checkpointer
+   of the sequential search (see \c checkpointed_search).
+*/
+typedef struct cppp_solver_s {
+        cppp_options_s options;
+        strategy_fn strategy;
+        level_s *levels;
+        uint32_t num_species;
+        uint32_t num_characters;
+        arena_s levels_arena;
+        arena_s instance_arena;
+        memo_s memo;
+        sat_engine_s sat_engine;
+        strbuf_s tree;
+        state_s state;
+        checkpointer_s *checkpointer;
+} cppp_solver_s;
+
+/**
+   \brief the default options of the command line: the search engine with
+   the strategy 0, a single thread, a table of failures of 16 MiB and no
+   limit
+*/
+void
+cppp_default_options(cppp_options_s *op);
+
+/**
+   \brief initializes the solver \c sp with the options \c op
+
+   \return \c false, and \c sp is not initialized, if the options are
+   invalid: an unknown strategy, or the SAT or portfolio engine with more
+   threads or with \c split_components
+*/
+bool
+cppp_solver_init(cppp_solver_s *sp, const cppp_options_s *op);
+
+/**
+   \brief releases all memory of the solver \c sp
+*/
+void
+cppp_solver_release(cppp_solver_s *sp);
+
+/**
+   \brief solves the instance \c stp, which has been read with
+   \c read_instance_from_filename or built with \c state_from_matrix, and
+   is modified by the search.
+
+   \param counters: if it is not \c NULL, it receives the counters of the
+   search
+   \param tree: if a solution is found, it contains the resulting tree in
+   Newick format, which is valid until the next instance is solved by
+   \c sp
+
+   returns one of \c SEARCH_FOUND, \c SEARCH_NOT_FOUND and \c SEARCH_UNKNOWN
+*/
+uint32_t
+cppp_solve_state(cppp_solver_s *sp, state_s *stp, search_counters_s *counters, char **tree);
+
+/**
+   \brief same as \c cppp_solve_state, for the instance whose matrix
+   \c matrix has \c num_species rows and \c num_characters columns, stored
+   row by row. Each value is 0, 1 or 2, as in the input files.
+*/
+uint32_t
+cppp_solve(cppp_solver_s *sp, const uint32_t *matrix, uint32_t num_species, uint32_t num_characters,
+           search_counters_s *counters, char **tree);
+#endif
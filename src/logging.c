@@ -73,8 +73,8 @@ void start_logging(struct gengetopt_args_info args_info) {
         if (args_info.debug_given)   _cppp_log_level_ = LOG_DEBUG;
 }
 
-void log_array_bool(const char* name, const bool* arr, const uint32_t size) {
 #ifdef DEBUG
+void log_array_bool(const char* name, const bool* arr, const uint32_t size) {
         fprintf(stderr, "  %s. Size: %d  Address: %p Values: ", name, size, arr);
         if (arr != NULL)
                 for(uint32_t i = 0; i < size; i++)
@@ -82,11 +82,9 @@ void log_array_bool(const char* name, const bool* arr, const uint32_t size) {
         else
                 fprintf(stderr, "NULL");
         fprintf(stderr, "\n");
-#endif
 }
 
 void log_array_uint32_t(const char* name, const uint32_t* arr, const uint32_t size) {
-#ifdef DEBUG
         fprintf(stderr, "  %s. Size %d  Address %p Values: ", name, size, arr);
         if (arr != NULL)
                 for(uint32_t i = 0; i < size; i++)
@@ -94,11 +92,9 @@ void log_array_uint32_t(const char* name, const uint32_t* arr, const uint32_t si
         else
                 fprintf(stderr, "NULL");
         fprintf(stderr, "\n");
-#endif
 }
 
 void log_array_uint8_t(const char* name, const uint8_t* arr, const uint32_t size) {
-#ifdef DEBUG
         fprintf(stderr, "  %s. Size %d  Address %p Values: ", name, size, arr);
         if (arr != NULL)
                 for(uint8_t i = 0; i < size; i++)
@@ -106,12 +102,10 @@ void log_array_uint8_t(const char* name, const uint8_t* arr, const uint32_t size
         else
                 fprintf(stderr, "NULL");
         fprintf(stderr, "\n");
-#endif
 }
 
 void
-log_bitmap(const char* name, bitmap_word* arr, const uint32_t nbits) {
-#ifdef DEBUG
+log_bitmap(const char* name, const bitmap_word* arr, const uint32_t nbits) {
         fprintf(stderr, "  %s. Size %d. Words %d  Address %p Values: ", name, nbits, BITMAP_NWORDS(nbits), arr);
         if (arr != NULL)
                 for(uint32_t i = 0; i < nbits; i++)
@@ -119,8 +113,8 @@ log_bitmap(const char* name, bitmap_word* arr, const uint32_t nbits) {
         else
                 fprintf(stderr, "NULL");
         fprintf(stderr, "\n");
-#endif
 }
+#endif
 
 /* Obtain a backtrace and print it to stdout. */
 void
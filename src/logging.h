@@ -34,15 +34,23 @@ unsigned int log_info(const char* message, ...);
 unsigned int log_debug2(const char* message, ...);
 void start_logging(struct gengetopt_args_info args_info);
 
+/*
+  Without DEBUG, the dumps of arrays and the debug messages are removed at
+  compile time, arguments included.
+*/
+#ifdef DEBUG
 void log_array_bool(const char* name, const bool* arr, const uint32_t size);
 void log_array_uint32_t(const char* name, const uint32_t* arr, const uint32_t size);
 void log_array_uint8_t(const char* name, const uint8_t* arr, const uint32_t size);
-void log_bitmap(const char* name, bitmap_word* arr, const uint32_t nbits);
+void log_bitmap(const char* name, const bitmap_word* arr, const uint32_t nbits);
 
-#ifdef DEBUG
 #define log_debug(...)                          \
         log_debug2(__VA_ARGS__);
 #else
+#define log_array_bool(...)
+#define log_array_uint32_t(...)
+#define log_array_uint8_t(...)
+#define log_bitmap(...)
 #define log_debug(...)
 #endif
 
@@ -0,0 +1,92 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "memo.h"
+
+void
+memo_init(memo_s *mp, size_t bytes) {
+        size_t bucket_size = MEMO_WAYS * sizeof(memo_entry_s);
+        mp->entries = NULL;
+        mp->num_buckets = 0;
+        mp->generation = 1;
+        if (bytes < bucket_size)
+                return;
+        for (mp->num_buckets = 1; 2 * mp->num_buckets * bucket_size <= bytes; mp->num_buckets *= 2) ;
+        mp->entries = xmalloc_atomic(mp->num_buckets * bucket_size);
+}
+
+void
+memo_release(memo_s *mp) {
+        if (mp->entries != NULL)
+                xfree(mp->entries);
+        mp->entries = NULL;
+        mp->num_buckets = 0;
+}
+
+void
+memo_clear(memo_s *mp) {
+        if (mp->entries == NULL)
+                return;
+/* The entries of new tables have generation 0, and they are never valid */
+        if (++(mp->generation) == 0) {
+                memset(mp->entries, 0, mp->num_buckets * MEMO_WAYS * sizeof(memo_entry_s));
+                mp->generation = 1;
+        }
+}
+
+static memo_entry_s *
+bucket(const memo_s *mp, const uint64_t fingerprint[2]) {
+        return mp->entries + (fingerprint[0] & (mp->num_buckets - 1)) * MEMO_WAYS;
+}
+
+bool
+memo_contains(const memo_s *mp, const uint64_t fingerprint[2]) {
+        if (mp->entries == NULL)
+                return false;
+        const memo_entry_s *b = bucket(mp, fingerprint);
+        for (uint32_t i = 0; i < MEMO_WAYS; i++)
+                if (b[i].generation == mp->generation &&
+                    b[i].fingerprint[0] == fingerprint[0] && b[i].fingerprint[1] == fingerprint[1])
+                        return true;
+        return false;
+}
+
+void
+memo_insert(memo_s *mp, const uint64_t fingerprint[2], uint32_t weight) {
+        if (mp->entries == NULL)
+                return;
+        memo_entry_s *b = bucket(mp, fingerprint);
+        memo_entry_s *victim = b;
+        for (uint32_t i = 0; i < MEMO_WAYS; i++) {
+                if (b[i].generation != mp->generation) {
+                        victim = b + i;
+                        break;
+                }
+                if (b[i].fingerprint[0] == fingerprint[0] && b[i].fingerprint[1] == fingerprint[1])
+                        return;
+                if (b[i].weight < victim->weight)
+                        victim = b + i;
+        }
+        *victim = (memo_entry_s) {
+                .fingerprint = { fingerprint[0], fingerprint[1] },
+                .generation = mp->generation,
+                .weight = weight
+        };
+}
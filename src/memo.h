@@ -0,0 +1,94 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_MEMO_H
+#define CPPP_MEMO_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "memory.h"
+
+/**
+   \struct memo_entry_s
+   \brief an instance that is known to have no solution
+
+   The instance is identified by its \c fingerprint (see \c state_s).
+   \c weight is the number of species of the instance, and it measures the
+   size of the subtree of the decision tree that is pruned by the entry.
+   The entry is valid only if \c generation is the current generation of
+   the table.
+*/
+typedef struct memo_entry_s {
+        uint64_t fingerprint[2];
+        uint32_t generation;
+        uint32_t weight;
+} memo_entry_s;
+
+/**
+   \struct memo_s
+   \brief a transposition table of the instances without a solution that
+   have been found during the search
+
+   The table has \c num_buckets buckets (a power of 2) of \c MEMO_WAYS
+   entries each, and the first word of the fingerprint of an instance
+   determines its bucket. When a bucket is full, a new instance replaces the
+   entry with the minimum weight, so that the table keeps the instances
+   that prune the largest subtrees.
+
+   Emptying the table only increments \c generation, since the entries of
+   the previous generations are not valid anymore.
+
+   If \c entries is \c NULL the table is disabled: it is always empty.
+*/
+#define MEMO_WAYS 4
+
+typedef struct memo_s {
+        memo_entry_s *entries;
+        uint64_t num_buckets;
+        uint32_t generation;
+} memo_s;
+
+/**
+   \brief allocates a table of at most \c bytes bytes, which is disabled if
+   \c bytes is too small to contain a bucket
+*/
+void memo_init(memo_s *mp, size_t bytes);
+
+void memo_release(memo_s *mp);
+
+/**
+   \brief empties the table. It must be called at the beginning of the
+   search of each instance, since fingerprints of different instances are
+   unrelated.
+*/
+void memo_clear(memo_s *mp);
+
+/**
+   \brief \c true if the instance with the fingerprint \c fingerprint is in
+   the table
+*/
+bool memo_contains(const memo_s *mp, const uint64_t fingerprint[2]);
+
+/**
+   \brief adds an instance without solution to the table, possibly evicting
+   another instance
+*/
+void memo_insert(memo_s *mp, const uint64_t fingerprint[2], uint32_t weight);
+#endif
@@ -1,4 +1,11 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "memory.h"
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
 
 
 void *
@@ -20,3 +27,239 @@ xcopy(void* src, size_t n)
         memcpy(dst, src, n);
         return(dst);
 }
+
+void *
+xrealloc(void* p, unsigned n)
+{
+        void *q = GC_REALLOC(p, n);
+        if (q != NULL)
+                return q;
+        fprintf(stderr, "insufficient memory\n");
+        assert(q != NULL);
+        exit(EXIT_FAILURE);
+}
+
+void *
+xmalloc_atomic(unsigned n)
+{
+        void *p = GC_MALLOC_ATOMIC(n);
+        if (p != NULL)
+                return memset(p, 0, n);
+        fprintf(stderr, "insufficient memory\n");
+        assert(p != NULL);
+        exit(EXIT_FAILURE);
+}
+
+void *
+xmalloc_root(unsigned n)
+{
+        void *p = GC_MALLOC_UNCOLLECTABLE(n);
+        if (p != NULL)
+                return p;
+        fprintf(stderr, "insufficient memory\n");
+        assert(p != NULL);
+        exit(EXIT_FAILURE);
+}
+
+void
+xfree(void* p)
+{
+        GC_FREE(p);
+}
+
+void
+memory_init_threads(void)
+{
+#ifndef NO_GC
+        GC_allow_register_threads();
+#endif
+}
+
+void
+memory_register_thread(void)
+{
+#ifndef NO_GC
+        struct GC_stack_base sb;
+        if (GC_get_stack_base(&sb) != GC_SUCCESS) {
+                fprintf(stderr, "could not register thread\n");
+                exit(EXIT_FAILURE);
+        }
+        GC_register_my_thread(&sb);
+#endif
+}
+
+/*
+  On Linux, the peak given by getrusage also counts the memory of the
+  parent process before exec, that is the memory of the program that has
+  started cppp, hence VmHWM is read instead. The file is opened before
+  main, and pread can be called by all threads.
+*/
+static int status_fd = -1;
+
+__attribute__((constructor)) static void
+memory_open_status(void)
+{
+        status_fd = open("/proc/self/status", O_RDONLY);
+}
+
+uint64_t
+memory_peak_rss(void)
+{
+        uint64_t kb = 0;
+        char buffer[2048];
+        ssize_t size = (status_fd != -1) ? pread(status_fd, buffer, sizeof(buffer) - 1, 0) : -1;
+        if (size > 0) {
+                buffer[size] = '\0';
+                char *line = strstr(buffer, "VmHWM:");
+                if (line != NULL)
+                        sscanf(line, "VmHWM: %" SCNu64, &kb);
+        }
+        struct rusage usage;
+        if (kb == 0 && getrusage(RUSAGE_SELF, &usage) == 0)
+                kb = (uint64_t) usage.ru_maxrss;
+        return kb;
+}
+
+#define STRBUF_MIN_CAPACITY 256
+
+void
+strbuf_init(strbuf_s *sb)
+{
+        sb->data = NULL;
+        sb->size = 0;
+        sb->capacity = 0;
+}
+
+void
+strbuf_reset(strbuf_s *sb)
+{
+        sb->size = 0;
+        if (sb->data != NULL)
+                sb->data[0] = '\0';
+}
+
+/*
+  Makes room for n more characters and the terminating nul. The strings
+  do not contain pointers, hence they are never scanned.
+*/
+static void
+strbuf_reserve(strbuf_s *sb, size_t n)
+{
+        if (sb->size + n < sb->capacity)
+                return;
+        size_t capacity = (sb->capacity > 0) ? sb->capacity : STRBUF_MIN_CAPACITY;
+        while (sb->size + n >= capacity)
+                capacity *= 2;
+        sb->data = (sb->data == NULL) ? xmalloc_atomic(capacity) : xrealloc(sb->data, capacity);
+        sb->capacity = capacity;
+}
+
+void
+strbuf_append(strbuf_s *sb, const char *s, size_t n)
+{
+        strbuf_reserve(sb, n);
+        memcpy(sb->data + sb->size, s, n);
+        sb->size += n;
+        sb->data[sb->size] = '\0';
+}
+
+void
+strbuf_puts(strbuf_s *sb, const char *s)
+{
+        strbuf_append(sb, s, strlen(s));
+}
+
+void
+strbuf_putc(strbuf_s *sb, char c)
+{
+        strbuf_reserve(sb, 1);
+        sb->data[sb->size++] = c;
+        sb->data[sb->size] = '\0';
+}
+
+void
+strbuf_printf(strbuf_s *sb, const char *format, ...)
+{
+        strbuf_reserve(sb, 0);
+        for (;;) {
+                va_list ap;
+                va_start(ap, format);
+                int written = vsnprintf(sb->data + sb->size, sb->capacity - sb->size, format, ap);
+                va_end(ap);
+                assert(written >= 0);
+                if (sb->size + written < sb->capacity) {
+                        sb->size += written;
+                        return;
+                }
+                strbuf_reserve(sb, written);
+        }
+}
+
+/* all objects of an arena are aligned to 16 bytes */
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_BLOCK 4096
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_block_s))
+
+static arena_block_s *
+arena_new_block(size_t capacity, arena_block_s *next)
+{
+        arena_block_s *bp = xmalloc_root(ARENA_HEADER + capacity);
+        bp->next = next;
+        bp->capacity = capacity;
+        bp->used = 0;
+        return bp;
+}
+
+void
+arena_init(arena_s *ap)
+{
+        ap->head = NULL;
+        ap->capacity = 0;
+}
+
+void *
+arena_alloc(arena_s *ap, size_t n)
+{
+        if (ap == NULL)
+                return xmalloc(n);
+        n = ARENA_ROUND(n);
+        arena_block_s *bp = ap->head;
+        if (bp == NULL || bp->used + n > bp->capacity) {
+                size_t capacity = (ap->capacity > ARENA_MIN_BLOCK) ? ap->capacity : ARENA_MIN_BLOCK;
+                if (capacity < n)
+                        capacity = n;
+                bp = arena_new_block(capacity, ap->head);
+                ap->head = bp;
+                ap->capacity += capacity;
+        }
+        char *p = (char *) bp + ARENA_HEADER + bp->used;
+        bp->used += n;
+        memset(p, 0, n);
+        return p;
+}
+
+void
+arena_reset(arena_s *ap)
+{
+        if (ap->head == NULL)
+                return;
+        if (ap->head->next != NULL) {
+                size_t capacity = ap->capacity;
+                arena_release(ap);
+                ap->head = arena_new_block(capacity, NULL);
+                ap->capacity = capacity;
+        }
+        ap->head->used = 0;
+}
+
+void
+arena_release(arena_s *ap)
+{
+        while (ap->head != NULL) {
+                arena_block_s *next = ap->head->next;
+                xfree(ap->head);
+                ap->head = next;
+        }
+        ap->capacity = 0;
+}
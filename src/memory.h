@@ -1,9 +1,149 @@
+#ifndef CPPP_MEMORY_H
+#define CPPP_MEMORY_H
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
-#include <gc.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
 
+/*
+  The Boehm garbage collector is used by default. Compiling with -DNO_GC
+  replaces it with the system allocator: the search does not allocate on
+  its hot path, and each instance lives in an arena, so only a few small
+  objects per instance (e.g. the trees) are not reclaimed.
+*/
+#ifdef NO_GC
+#define GC_MALLOC(n)               calloc(1, (n))
+#define GC_MALLOC_ATOMIC(n)        malloc(n)
+#define GC_MALLOC_UNCOLLECTABLE(n) calloc(1, (n))
+#define GC_REALLOC(p, n)           realloc((p), (n))
+#define GC_FREE(p)                 free(p)
+#else
+#include <gc.h>
+#endif
 
 void * xmalloc(unsigned n);
 void * xcopy(void* src, size_t n);
+void * xrealloc(void* p, unsigned n);
+
+/**
+   \brief allocates memory that is never collected, but is scanned for
+   pointers. It is used to keep alive the data handed to other threads
+   through structures that are not visible to the garbage collector, such
+   as OpenMP tasks, and must be released with \c xfree.
+*/
+void * xmalloc_root(unsigned n);
+
+/**
+   \brief allocates zeroed memory that does not contain pointers, so that
+   it is never scanned by the garbage collector. It is used for large
+   tables of integers.
+*/
+void * xmalloc_atomic(unsigned n);
+void xfree(void* p);
+
+/**
+   \brief registers the calling thread to the garbage collector.
+
+   \c memory_init_threads must be called by the main thread before starting
+   any other thread, while \c memory_register_thread must be called by each
+   thread (e.g. each OpenMP thread) before allocating any memory. Calling
+   them more than once is harmless.
+*/
+void memory_init_threads(void);
+void memory_register_thread(void);
+
+/**
+   \brief the peak resident set size of the process, in kilobytes, or 0 if
+   it cannot be known
+*/
+uint64_t memory_peak_rss(void);
+
+/**
+   \struct strbuf_s
+   \brief a growable string
+
+   \c data is always terminated by a nul character, that is not counted in
+   \c size. The capacity is doubled when needed, so that a string built by
+   many appends is copied only a logarithmic number of times, and
+   \c strbuf_reset keeps the memory for the next string.
+*/
+typedef struct strbuf_s {
+        char *data;
+        size_t size;
+        size_t capacity;
+} strbuf_s;
+
+/**
+   \brief initializes an empty string
+*/
+void strbuf_init(strbuf_s *sb);
+
+/**
+   \brief empties \c sb, keeping its memory
+*/
+void strbuf_reset(strbuf_s *sb);
+
+/**
+   \brief appends the \c n characters of \c s to \c sb
+*/
+void strbuf_append(strbuf_s *sb, const char *s, size_t n);
+void strbuf_puts(strbuf_s *sb, const char *s);
+void strbuf_putc(strbuf_s *sb, char c);
+
+/**
+   \brief appends to \c sb the string formatted as by \c printf
+*/
+void strbuf_printf(strbuf_s *sb, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+   \struct arena_s
+   \brief a region allocator
+
+   All objects allocated in an arena are released at once by \c arena_reset
+   or \c arena_release, in constant time. It is used for all data whose
+   lifetime is an instance, such as a state and its stack of nodes of the
+   decision tree.
+
+   An arena is a list of blocks: when \c arena_reset finds more than one
+   block, they are replaced by a single block large enough for all of them,
+   so that an arena that is reused for instances of the same size quickly
+   settles on a single block and does not allocate anymore.
+
+   Blocks are scanned by the garbage collector, hence objects allocated by
+   \c xmalloc can be referenced from an arena.
+*/
+typedef struct arena_block_s {
+        struct arena_block_s *next;
+        size_t capacity;
+        size_t used;
+} arena_block_s;
+
+typedef struct arena_s {
+        arena_block_s *head;
+        size_t capacity;
+} arena_s;
+
+/**
+   \brief initializes an empty arena
+*/
+void arena_init(arena_s *ap);
+
+/**
+   \brief allocates \c n zeroed bytes from the arena \c ap, or with
+   \c xmalloc if \c ap is \c NULL
+*/
+void * arena_alloc(arena_s *ap, size_t n);
+
+/**
+   \brief releases all objects allocated in \c ap, keeping the memory for
+   the next allocations
+*/
+void arena_reset(arena_s *ap);
+
+/**
+   \brief releases all objects and all memory of \c ap
+*/
+void arena_release(arena_s *ap);
+#endif
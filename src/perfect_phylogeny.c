@@ -24,14 +24,15 @@
 
 */
 #include "perfect_phylogeny.h"
+#include <ctype.h>
 
 /**
    Pretty print a state.
    Mainly used for debug
 */
+#ifdef DEBUG
 void
 log_state(const state_s* stp) {
-#ifdef DEBUG
         log_debug("log_state");
         fprintf(stderr, "=======================================\n");
         fprintf(stderr, "State=");
@@ -45,43 +46,45 @@ log_state(const state_s* stp) {
         fprintf(stderr, "  c   |characters|colors\n");
         fprintf(stderr, "------|----------|------\n");
         for (size_t i = 0; i < stp->num_characters_orig; i++)
-                fprintf(stderr, "%6d|%10d|%6d\n", i,stp->characters[i], stp->colors[i]);
+                fprintf(stderr, "%6d|%10d|%6d\n", i, bitmap_get_bit(stp->characters, i), stp->colors[i]);
         fprintf(stderr, "------|-------|----------|------\n");
 
         fprintf(stderr, "------|-------\n");
         fprintf(stderr, "  s   |species\n");
         fprintf(stderr, "------|-------\n");
         for (size_t i = 0; i < stp->num_species_orig; i++) {
-                fprintf(stderr, "%6d|%7d\n", i, stp->species[i]);
+                fprintf(stderr, "%6d|%7d\n", i, bitmap_get_bit(stp->species, i));
         }
 
         fprintf(stderr, "------|-------\n");
 
-        fprintf(stderr, "  operation: %d\n", stp->operation);
-        fprintf(stderr, "  realize: %d\n", stp->realize);
+        fprintf(stderr, "  log_size: %d\n", stp->log_size);
 
         fprintf(stderr, "connected_components: size %d\n", stp->red_black->num_vertices);
         log_array_uint32_t("connected_components", stp->connected_components, stp->red_black->num_vertices);
-
-        log_array_bool("current_component", stp->current_component, stp->red_black->num_vertices);
         fprintf(stderr, "\n");
 
-
-        log_state_lists(stp);
         log_state_graphs(stp);
-#endif
 }
 
-void log_state_lists(const state_s* stp) {
-#ifdef DEBUG
-        log_debug("log_state_lists");
-        log_array_uint32_t("  tried_characters", stp->tried_characters, stp->tried_characters_size);
-        log_array_uint32_t("  character_queue", stp->character_queue, stp->character_queue_size);
-#endif
+void log_level(const level_s* lp, uint32_t nvertices) {
+        log_debug("log_level");
+        fprintf(stderr, "  operation: %d\n", lp->operation);
+        fprintf(stderr, "  realize: %d\n", lp->realize);
+        fprintf(stderr, "  backtrack_level: %d\n", lp->backtrack_level);
+        fprintf(stderr, "  log_mark: %d\n", lp->log_mark);
+        log_bitmap("current_component", lp->current_component, nvertices);
+        log_level_lists(lp);
+}
+
+void log_level_lists(const level_s* lp) {
+        log_debug("log_level_lists");
+        log_array_uint32_t("  tried_characters", lp->tried_characters, lp->tried_characters_size);
+        log_array_uint32_t("  character_queue", lp->character_queue + lp->character_queue_first,
+                           lp->character_queue_size);
 }
 
 void log_state_graphs(const state_s* stp) {
-#ifdef DEBUG
         log_debug("log_state_graphs");
         fprintf(stderr, "  Red-black graph. Address\n", stp->red_black);
         graph_pp(stp->red_black);
@@ -90,26 +93,97 @@ void log_state_graphs(const state_s* stp) {
         fprintf(stderr, "  Conflict graph. Address\n", stp->conflict);
         graph_pp(stp->conflict);
         fprintf(stderr, "\n");
-#endif
 }
+#endif
 
 /**
    \brief some functions to abstract the access to the instance matrix
 */
 
-static uint32_t
-matrix_get_value(state_s *stp, uint32_t s, uint32_t c) {
-        return stp->matrix[c + stp->num_characters * s];
+uint32_t
+matrix_get_value(const state_s *stp, uint32_t s, uint32_t c) {
+        return stp->matrix[c + stp->num_characters_orig * s];
+}
+
+/**
+   \brief the time when an operation on \c stp starts, if the operations on
+   \c stp are timed
+*/
+static double
+timer_start(const state_s *stp) {
+        return (stp->times != NULL) ? omp_get_wtime() : 0;
+}
+
+/*
+  Adds to the field F of the times of the state STP the time elapsed since
+  START, as returned by timer_start
+*/
+#define TIMER_STOP(stp, F, start)                                       \
+        do {                                                            \
+                if ((stp)->times != NULL)                               \
+                        (stp)->times->F += (uint64_t) ((omp_get_wtime() - (start)) * 1e9); \
+        } while (0)
+
+static bitmap_word*
+column(const state_s *stp, uint32_t c) {
+        return stp->columns + (size_t) c * stp->species_words;
 }
 
+/*
+  The view of the columns restricted to the current species: since
+  species are only deleted, the words of the species bitmap that are 0 can
+  be skipped by the four gametes tests, that scale with the current number
+  of species instead of the original one. The view is computed on demand,
+  before a batch of tests, in the workspace.
+*/
+typedef struct columns_view_s {
+        const bitmap_word *live;
+        const uint32_t *words;
+        uint32_t num_words;
+} columns_view_s;
+
 static void
-matrix_set_value(state_s *stp, uint32_t s, uint32_t c, uint32_t value) {
-        stp->matrix[c + stp->num_characters * s] = value;
+columns_view(const state_s* stp, columns_view_s* vp) {
+        uint32_t *words = stp->workspace.words;
+        uint32_t size = 0;
+        for (uint32_t i = 0; i < stp->species_words; i++)
+                if (stp->species[i] != 0)
+                        words[size++] = i;
+        vp->live = stp->species;
+        vp->words = words;
+        vp->num_words = size;
+}
+
+/**
+   \brief the characters \c c1 and \c c2 induce the four gametes on the
+   species of the view \c vp.
+
+   Each gamete is computed for 64 species at a time.
+*/
+static bool
+four_gametes(const state_s* stp, const columns_view_s* vp, uint32_t c1, uint32_t c2) {
+        const bitmap_word* col1 = column(stp, c1);
+        const bitmap_word* col2 = column(stp, c2);
+        const bitmap_word* live = vp->live;
+        bitmap_word g00 = 0, g01 = 0, g10 = 0, g11 = 0;
+        for (uint32_t k = 0; k < vp->num_words; k++) {
+                uint32_t i = vp->words[k];
+                g11 |= live[i] & col1[i] & col2[i];
+                g10 |= live[i] & col1[i] & ~col2[i];
+                g01 |= live[i] & ~col1[i] & col2[i];
+                g00 |= live[i] & ~(col1[i] | col2[i]);
+        }
+        return (g00 != 0 && g01 != 0 && g10 != 0 && g11 != 0);
+}
+
+static bool
+inactive(const state_s* stp, uint32_t c) {
+        return (bitmap_get_bit(stp->characters, c) && stp->colors[c] == BLACK);
 }
 
+#ifdef DEBUG
 static uint32_t
 state_cmp(const state_s *stp1, const state_s *stp2) {
-#ifdef DEBUG
         if (stp1->num_characters != stp2->num_characters)
                 return 1;
         if (stp1->num_species != stp2->num_species)
@@ -118,40 +192,15 @@ state_cmp(const state_s *stp1, const state_s *stp2) {
                 return 3;
         if (stp1->num_species_orig != stp2->num_species_orig)
                 return 4;
-        if (stp1->tried_characters_size > 0 && stp2->tried_characters_size >0 && stp1->tried_characters_size != stp2->tried_characters_size)
-                return 41;
-        if (stp1->character_queue_size > 0&& stp2->character_queue_size > 0 && stp1->character_queue_size != stp2->character_queue_size)
-                return 42;
-        if (stp1->operation != stp2->operation)
-                return 43;
-        if (stp1->realize != stp2->realize)
-                return 44;
-        if (stp1->backtrack_level != stp2->backtrack_level)
-                return 45;
 
         if (stp1->species == NULL || stp2->species == NULL)
                 return 7;
-        if (memcmp(stp1->species, stp2->species, (stp2->num_species_orig) * sizeof((stp1->species)[0])) != 0)
+        if (!bitmap_equal(stp1->species, stp2->species, stp2->num_species_orig))
                 return 8;
         if (stp1->characters == NULL || stp2->characters == NULL)
                 return 9;
-        if (memcmp(stp1->characters, stp2->characters, (stp2->num_characters_orig) * sizeof((stp1->characters)[0])) != 0)
+        if (!bitmap_equal(stp1->characters, stp2->characters, stp2->num_characters_orig))
                 return 10;
-        if (stp1->character_queue_size > 0 && stp1->character_queue == NULL)
-                return 12;
-        if (stp2->character_queue_size > 0 && stp2->character_queue == NULL)
-                return 13;
-        if (stp1->character_queue_size > 0 && stp2->character_queue_size > 0 &&
-            memcmp(stp1->character_queue, stp2->character_queue, (stp1->num_characters_orig) * sizeof((stp1->character_queue)[0])) != 0)
-                return 14;
-
-        if (stp1->tried_characters_size > 0 && stp1->tried_characters == NULL)
-                return 61;
-        if (stp2->tried_characters_size > 0 && stp2->tried_characters == NULL)
-                return 62;
-        if (stp1->tried_characters_size > 0 && stp2->tried_characters_size > 0 &&
-            memcmp(stp1->tried_characters, stp2->tried_characters, (stp1->num_characters_orig) * sizeof((stp1->tried_characters)[0])) != 0)
-                return 63;
 
         if (stp1->characters == NULL || stp2->characters == NULL)
                 return 17;
@@ -164,14 +213,14 @@ state_cmp(const state_s *stp1, const state_s *stp2) {
                 return 20;
         if (memcmp(stp1->connected_components, stp2->connected_components, ((stp1->num_characters_orig) + (stp1->num_species_orig)) * sizeof((stp1->connected_components)[0])) != 0)
                 return 21;
-        if (stp1->current_component == NULL || stp2->current_component == NULL)
-                return 22;
-        if (memcmp(stp2->current_component, stp2->current_component, ((stp2->num_characters_orig) + (stp2->num_species_orig)) * sizeof((stp2->current_component)[0])) != 0)
-                return 23;
+        if (memcmp(stp1->component_size, stp2->component_size, ((stp1->num_characters_orig) + (stp1->num_species_orig)) * sizeof((stp1->component_size)[0])) != 0)
+                return 24;
+        if (memcmp(stp1->component_species, stp2->component_species, ((stp1->num_characters_orig) + (stp1->num_species_orig)) * sizeof((stp1->component_species)[0])) != 0)
+                return 25;
 
         if (stp1->matrix == NULL || stp2->matrix == NULL)
                 return 22;
-        if (memcmp(stp1->matrix, stp2->matrix, ((stp2->num_characters) * (stp2->num_species)) * sizeof((stp1->matrix)[0])) != 0)
+        if (memcmp(stp1->matrix, stp2->matrix, ((stp2->num_characters_orig) * (stp2->num_species_orig)) * sizeof((stp1->matrix)[0])) != 0)
                 return 23;
 
         if (stp1->red_black == NULL || stp2->red_black == NULL)
@@ -182,9 +231,9 @@ state_cmp(const state_s *stp1, const state_s *stp2) {
                 return 52;
         if (graph_cmp(stp1->conflict, stp2->conflict) != 0)
                 return 53;
-#endif
         return 0;
 }
+#endif
 
 void
 copy_state(state_s* dst, const state_s* src) {
@@ -192,40 +241,245 @@ copy_state(state_s* dst, const state_s* src) {
         log_debug("copy_state: input");
         check_state(src);
 
-        dst->realize = src->realize;
         dst->num_species = src->num_species;
         dst->num_characters = src->num_characters;
         graph_copy(dst->red_black, src->red_black);
         graph_copy(dst->conflict, src->conflict);
         dst->matrix = src->matrix;
+        dst->columns = src->columns;
         assert(dst != NULL);
 
         assert(dst->characters != NULL);
         assert(dst->colors != NULL);
         assert(dst->species != NULL);
-        memcpy(dst->characters, src->characters, src->num_characters_orig * sizeof(src->characters[0]));
+        bitmap_copy(dst->characters, src->characters, src->num_characters_orig);
         memcpy(dst->colors, src->colors, src->num_characters_orig * sizeof(src->colors[0]));
-        memcpy(dst->species, src->species, src->num_species_orig * sizeof(src->species[0]));
-
-        dst->operation = src->operation;
+        bitmap_copy(dst->species, src->species, src->num_species_orig);
+        memcpy(dst->twin, src->twin, src->num_characters_orig * sizeof(src->twin[0]));
+        dst->collapse_duplicates = src->collapse_duplicates;
+        dst->direct_phylogeny = src->direct_phylogeny;
 
         assert(dst->connected_components != NULL);
-        assert(dst->current_component != NULL);
         memcpy(dst->connected_components, src->connected_components, src->red_black->num_vertices * sizeof(src->connected_components[0]));
-        memcpy(dst->current_component, src->current_component, src->red_black->num_vertices * sizeof(src->current_component[0]));
-
-        dst->tried_characters_size = 0;
-        dst->character_queue_size = 0;
+        memcpy(dst->component_size, src->component_size, src->red_black->num_vertices * sizeof(src->component_size[0]));
+        memcpy(dst->component_species, src->component_species, src->red_black->num_vertices * sizeof(src->component_species[0]));
 
-        dst->backtrack_level = src->backtrack_level;
+        dst->fingerprint[0] = src->fingerprint[0];
+        dst->fingerprint[1] = src->fingerprint[1];
+        dst->log_size = 0;
+#ifdef DEBUG
         assert(state_cmp(src, dst) == 0);
+#endif
         log_debug("copy_state: return");
         check_state(dst);
         log_debug("Checking copy_state: %d", state_cmp(dst, src));
 }
 
 /**
-   We want to realize the character stored in \c src->realize.
+   \brief enlarges the undo log of \c stp to \c capacity entries, allocating
+   it in the arena of the state
+*/
+static void
+grow_log(state_s *stp, uint32_t capacity) {
+        change_s *log = arena_alloc(stp->arena, capacity * sizeof(change_s));
+        memcpy(log, stp->log, stp->log_size * sizeof(change_s));
+        stp->log = log;
+        stp->log_capacity = capacity;
+}
+
+/**
+   \brief the i-th random key (i is 0 or 1) of the element \c (type, a, b) of
+   a state, where \c type is one of the \c CHANGE_ codes.
+
+   Instead of storing a table of random keys, as in the original Zobrist
+   hashing, each key is obtained by mixing the element with the splitmix64
+   finalizer.
+*/
+static uint64_t
+zobrist_key(uint32_t type, uint32_t a, uint32_t b, uint32_t i) {
+        uint64_t x = ((uint64_t) type << 58) ^ ((uint64_t) a << 29) ^ b ^ (i ? 0xA0761D6478BD642FULL : 0x9E3779B97F4A7C15ULL);
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+}
+
+/**
+   \brief adds or removes the element \c (type, a, b) from \c fingerprint.
+   For an edge of the red-black graph, \c a must be smaller than \c b.
+*/
+static void
+toggle_fingerprint(uint64_t fingerprint[2], uint32_t type, uint32_t a, uint32_t b) {
+        fingerprint[0] ^= zobrist_key(type, a, b, 0);
+        fingerprint[1] ^= zobrist_key(type, a, b, 1);
+}
+
+static void
+toggle_edge_fingerprint(state_s *stp, uint32_t v1, uint32_t v2) {
+        if (v1 < v2)
+                toggle_fingerprint(stp->fingerprint, CHANGE_RED_BLACK_EDGE, v1, v2);
+        else
+                toggle_fingerprint(stp->fingerprint, CHANGE_RED_BLACK_EDGE, v2, v1);
+}
+
+void
+state_fingerprint(const state_s* stp, uint64_t fingerprint[2]) {
+        fingerprint[0] = 0;
+        fingerprint[1] = 0;
+        for (uint32_t s = 0; s < stp->num_species_orig; s++)
+                if (!bitmap_get_bit(stp->species, s))
+                        toggle_fingerprint(fingerprint, CHANGE_SPECIES, s, 0);
+        for (uint32_t c = 0; c < stp->num_characters_orig; c++) {
+                if (!bitmap_get_bit(stp->characters, c))
+                        toggle_fingerprint(fingerprint, CHANGE_CHARACTER, c, 0);
+                toggle_fingerprint(fingerprint, CHANGE_COLOR, c, stp->colors[c]);
+        }
+        uint32_t nv = stp->red_black->num_vertices;
+        for (uint32_t v = 0; v < nv; v++)
+                for (uint32_t w = graph_next_neighbour(stp->red_black, v, v + 1); w < nv; w = graph_next_neighbour(stp->red_black, v, w + 1))
+                        toggle_fingerprint(fingerprint, CHANGE_RED_BLACK_EDGE, v, w);
+}
+
+/**
+   \brief appends a change to the undo log of \c stp
+*/
+static void
+record_change(state_s *stp, uint32_t type, uint32_t a, uint32_t b) {
+        if (stp->log_size == stp->log_capacity)
+                grow_log(stp, 2 * stp->log_capacity);
+        stp->log[stp->log_size++] = (change_s) { .type = type, .a = a, .b = b };
+}
+
+static void
+graph_flip_edge(graph_s *gp, uint32_t v1, uint32_t v2) {
+        if (graph_get_edge(gp, v1, v2))
+                graph_del_edge(gp, v1, v2);
+        else
+                graph_add_edge(gp, v1, v2);
+}
+
+static void
+flip_red_black_edge(state_s *stp, uint32_t v1, uint32_t v2) {
+        graph_flip_edge(stp->red_black, v1, v2);
+        toggle_edge_fingerprint(stp, v1, v2);
+        record_change(stp, CHANGE_RED_BLACK_EDGE, v1, v2);
+}
+
+static void
+flip_conflict_edge(state_s *stp, uint32_t c1, uint32_t c2) {
+        graph_flip_edge(stp->conflict, c1, c2);
+        record_change(stp, CHANGE_CONFLICT_EDGE, c1, c2);
+}
+
+static void
+set_color(state_s *stp, uint32_t c, uint8_t color) {
+        record_change(stp, CHANGE_COLOR, c, stp->colors[c]);
+        toggle_fingerprint(stp->fingerprint, CHANGE_COLOR, c, stp->colors[c]);
+        toggle_fingerprint(stp->fingerprint, CHANGE_COLOR, c, color);
+        stp->colors[c] = color;
+}
+
+/**
+   \brief moves the vertex \c v to the connected component labeled \c label,
+   keeping the sizes of the connected components up to date
+*/
+static void
+assign_component(state_s *stp, uint32_t v, uint32_t label) {
+        uint32_t old = stp->connected_components[v];
+        stp->component_size[old]--;
+        stp->component_size[label]++;
+        if (v < stp->num_species_orig) {
+                stp->component_species[old]--;
+                stp->component_species[label]++;
+        }
+        stp->connected_components[v] = label;
+}
+
+static void
+set_component(state_s *stp, uint32_t v, uint32_t label) {
+        if (stp->connected_components[v] == label)
+                return;
+        record_change(stp, CHANGE_COMPONENT, v, stp->connected_components[v]);
+        assign_component(stp, v, label);
+}
+
+void
+fork_state(state_s* dst, const state_s* src) {
+        copy_state(dst, src);
+        if (dst->log_capacity < src->log_size)
+                grow_log(dst, src->log_capacity);
+        memcpy(dst->log, src->log, src->log_size * sizeof(change_s));
+        dst->log_size = src->log_size;
+}
+
+void
+copy_component(state_s* dst, const state_s* src, uint32_t label) {
+        log_debug("copy_component: label %d", label);
+        copy_state(dst, src);
+        uint32_t nv = dst->red_black->num_vertices;
+        for (uint32_t v = 0; v < nv; v++) {
+                if (dst->connected_components[v] == label)
+                        continue;
+                for (uint32_t w = graph_next_neighbour(dst->red_black, v, 0); w < nv; w = graph_next_neighbour(dst->red_black, v, w + 1))
+                        graph_del_edge(dst->red_black, v, w);
+                if (v < dst->num_species_orig) {
+                        if (bitmap_get_bit(dst->species, v))
+                                delete_species(dst, v);
+                } else if (bitmap_get_bit(dst->characters, v - dst->num_species_orig))
+                        delete_character(dst, v - dst->num_species_orig);
+                set_component(dst, v, v);
+        }
+        update_conflict_graph(dst);
+        state_fingerprint(dst, dst->fingerprint);
+        dst->log_size = 0;
+        check_state(dst);
+        log_debug("copy_component: end");
+}
+
+void
+state_undo(state_s *stp, uint32_t mark) {
+        log_debug("state_undo: from %d to %d", stp->log_size, mark);
+        assert(mark <= stp->log_size);
+        while (stp->log_size > mark) {
+                change_s *ch = stp->log + (--stp->log_size);
+                switch (ch->type) {
+                case CHANGE_RED_BLACK_EDGE:
+                        graph_flip_edge(stp->red_black, ch->a, ch->b);
+                        toggle_edge_fingerprint(stp, ch->a, ch->b);
+                        break;
+                case CHANGE_CONFLICT_EDGE:
+                        graph_flip_edge(stp->conflict, ch->a, ch->b);
+                        break;
+                case CHANGE_COLOR:
+                        toggle_fingerprint(stp->fingerprint, CHANGE_COLOR, ch->a, stp->colors[ch->a]);
+                        toggle_fingerprint(stp->fingerprint, CHANGE_COLOR, ch->a, ch->b);
+                        stp->colors[ch->a] = ch->b;
+                        break;
+                case CHANGE_SPECIES:
+                        bitmap_set_bit(stp->species, ch->a);
+                        stp->num_species++;
+                        toggle_fingerprint(stp->fingerprint, CHANGE_SPECIES, ch->a, 0);
+                        break;
+                case CHANGE_CHARACTER:
+                        bitmap_set_bit(stp->characters, ch->a);
+                        stp->num_characters++;
+                        toggle_fingerprint(stp->fingerprint, CHANGE_CHARACTER, ch->a, 0);
+                        break;
+                case CHANGE_COMPONENT:
+                        assign_component(stp, ch->a, ch->b);
+                        break;
+                case CHANGE_TWIN:
+                        stp->twin[ch->a] = ch->b;
+                        break;
+                default:
+                        assert(false);
+                }
+        }
+        check_state(stp);
+        log_debug("state_undo: end");
+}
+
+/**
+   We want to realize the character stored in \c lp->realize.
 
    To realize a character, first we have to find the id \c c of the vertex of
    the red-black graph encoding the input character.
@@ -240,29 +494,28 @@ copy_state(state_s* dst, const state_s* src) {
    other hand, if A is not equal to B, we return that the realization is
    impossible, setting \c error=1.
 
+   Only the edges incident on \c c change, therefore the undo log of a
+   realization has size that is linear in the size of \c A (plus the changes
+   due to the cleanup and to the updates of the connected components and of
+   the conflict graph).
 */
 bool
-realize_character(state_s* dst, state_s* src) {
-        assert (src != NULL);
-        assert (dst != NULL);
-        assert (src != dst);
-        log_debug("realize_character: dst=%p, src=%p character=%d", dst, src, src->realize);
-        check_state(src);
-        copy_state(dst, src);
-        assert(state_cmp(src, dst) == 0);
-        uint32_t character = src->realize;
-        assert(src->characters[character]);
-        uint32_t n = src->num_species_orig;
+realize_character(state_s* stp, level_s* lp) {
+        assert (stp != NULL);
+        assert (lp != NULL);
+        log_debug("realize_character: stp=%p, lp=%p character=%d", stp, lp, lp->realize);
+        check_state(stp);
+        double start = timer_start(stp);
+        uint32_t character = lp->realize;
+        assert(bitmap_get_bit(stp->characters, character));
+        uint32_t n = stp->num_species_orig;
 
         log_debug("realize_character: Trying to realize CHAR %d", character);
-        check_state(dst);
-        uint32_t character_vertex = src->num_species_orig + character;
-        assert(src->current_component[character_vertex]);
-        uint32_t color = src->colors[character];
-        log_array_bool("realize_character: src->current_component: ", src->current_component, src->red_black->num_vertices);
-        log_debug("realize_character: check dst");
+        uint32_t character_vertex = stp->num_species_orig + character;
+        assert(bitmap_get_bit(lp->current_component, character_vertex));
+        uint32_t color = stp->colors[character];
+        log_bitmap("realize_character: lp->current_component: ", lp->current_component, stp->red_black->num_vertices);
         log_debug("realize_character: color %d. Cases BLACK=>%d RED=>%d", color, (color == BLACK), (color == RED));
-        check_state(dst);
 
         if (color == BLACK) {
                 log_debug("realize_character: %d (vertex %d). inactive color %d = BLACK", character, character_vertex, color);
@@ -270,56 +523,371 @@ realize_character(state_s* dst, state_s* src) {
   for each species s in the same connected component as c, delete the
   edge (s,c) if it exists and create the edge (s,c) if it does not exist
 */
-                for (uint32_t v=0; v<n; v++)
-                        if (src->current_component[v])
-                                if (graph_get_edge(src->red_black, character_vertex, v) && character_vertex != v)
-                                        graph_del_edge(dst->red_black, character_vertex, v);
-                                else
-                                        graph_add_edge(dst->red_black, character_vertex, v);
+                for (uint32_t v = bitmap_next_bit(lp->current_component, 0, n); v < n; v = bitmap_next_bit(lp->current_component, v + 1, n))
+                        flip_red_black_edge(stp, character_vertex, v);
 
-                src->operation = 1;
-                dst->colors[character] = RED;
+                lp->operation = 1;
+                set_color(stp, character, RED);
         }
         if (color == RED) {
                 log_debug("realize_character: %d (vertex %d). active. color %d = RED", character, character_vertex, color);
 /*
   if there is a species in the same connected component as c, but that
   it is not adjacent to c, then the realization is impossible.
+  Such a check is performed before modifying the state, so that a failed
+  realization does not leave anything to undo.
 
   If c is adjacent to all species in its connected component, remove
   all edges incident on c, because c is free.
 */
-                for (uint32_t v=0; v<n; v++)
-                        if (src->current_component[v])
-                                if (graph_get_edge(src->red_black, character_vertex, v) && character_vertex != v) {
-                                        src->operation = 2;
-                                        dst->colors[character] = RED + 1;
-                                        graph_del_edge(dst->red_black, character_vertex, v);
-                                } else {
-                                        src->operation = 0;
-                                        log_debug("realize_character: end. REALIZATION IMPOSSIBLE");
-                                        return false;
-                                }
+                for (uint32_t v = bitmap_next_bit(lp->current_component, 0, n); v < n; v = bitmap_next_bit(lp->current_component, v + 1, n))
+                        if (!graph_get_edge(stp->red_black, character_vertex, v)) {
+                                lp->operation = 0;
+                                log_debug("realize_character: end. REALIZATION IMPOSSIBLE");
+                                TIMER_STOP(stp, realize, start);
+                                return false;
+                        }
+                for (uint32_t v = bitmap_next_bit(lp->current_component, 0, n); v < n; v = bitmap_next_bit(lp->current_component, v + 1, n))
+                        flip_red_black_edge(stp, character_vertex, v);
+                lp->operation = 2;
+                set_color(stp, character, RED + 1);
         }
 
-        dst->realize = character;
+/*
+  The duplicates of the character are realized together with it. The list
+  is stored before the cleanup, since the duplicates found by the cleanup
+  are realized only in the subsequent realizations of the character.
+*/
+        lp->twins_size = 0;
+        for (uint32_t t = stp->twin[character]; t != -1; t = stp->twin[t])
+                lp->twins[lp->twins_size++] = t;
+
         log_debug("realize_character: before cleanup");
-        check_state(dst);
-        cleanup(dst);
-        check_state(dst);
-        log_debug("realize_character: call update_connected_components");
-        update_connected_components(dst);
-        check_state(dst);
+        check_state(stp);
+        uint32_t num_species = stp->num_species;
+        cleanup(stp);
+        check_state(stp);
+        log_debug("realize_character: call update_component");
+        update_component(stp, lp->current_component);
+        check_state(stp);
         log_debug("realize_character: update_conflict_graph");
-        update_conflict_graph(dst);
-        check_state(dst);
+        update_conflict_graph_realization(stp, character, num_species != stp->num_species);
         log_debug("realize_character: color %d", color);
-        log_debug("realize_character: outcome %d (1=>activated, 2=>freed)", dst->operation);
+        log_debug("realize_character: outcome %d (1=>activated, 2=>freed)", lp->operation);
         log_debug("realize_character: return");
-        check_state(dst);
+        check_state(stp);
+        TIMER_STOP(stp, realize, start);
         return true;
 }
 
+/**
+   \brief makes sure that the buffer of \c props contains at least a byte
+   that has not been read, reading the next chunk of the file if necessary.
+
+   \return \c false at the end of the file
+*/
+static bool
+fill_buffer(instances_schema_s* props) {
+        if (props->buffer_position < props->buffer_length)
+                return true;
+        props->buffer_length = fread(props->buffer, 1, READ_BUFFER_SIZE, props->file);
+        props->buffer_position = 0;
+        return props->buffer_length > 0;
+}
+
+/**
+   \brief reads the next unsigned integer of the file, skipping the
+   whitespace before it.
+
+   The semantics is the same as \c fscanf with the \c SCNu32 conversion, in
+   particular a value that is immediately followed by the end of file
+   results in \c READ_EOF_AFTER_VALUE.
+*/
+static uint32_t
+read_value(instances_schema_s* props, uint32_t *x) {
+        for (;;) {
+                if (!fill_buffer(props))
+                        return READ_EOF;
+                const char *p = props->buffer + props->buffer_position;
+                const char *end = props->buffer + props->buffer_length;
+                while (p < end && isspace((unsigned char) *p))
+                        p++;
+                props->buffer_position = p - props->buffer;
+                if (p < end)
+                        break;
+        }
+        bool negative = false;
+        char sign = props->buffer[props->buffer_position];
+        if (sign == '-' || sign == '+') {
+                negative = (sign == '-');
+                props->buffer_position++;
+                if (!fill_buffer(props))
+                        return READ_EOF;
+        }
+        uint32_t value = 0;
+        bool digits = false;
+        for (;;) {
+                const char *p = props->buffer + props->buffer_position;
+                const char *end = props->buffer + props->buffer_length;
+                for (; p < end && isdigit((unsigned char) *p); p++) {
+                        value = 10 * value + (*p - '0');
+                        digits = true;
+                }
+                props->buffer_position = p - props->buffer;
+                if (p < end)
+                        break;
+                if (!fill_buffer(props)) {
+                        if (!digits)
+                                return READ_EOF;
+                        *x = negative ? -value : value;
+                        return READ_EOF_AFTER_VALUE;
+                }
+        }
+        if (!digits)
+                return READ_INVALID;
+        *x = negative ? -value : value;
+        return READ_VALUE;
+}
+
+/**
+   \brief little-endian encoding of the integers stored in the header of
+   a binary file, so that binary files do not depend on the host
+*/
+static void
+put_uint(unsigned char *p, uint64_t x, uint32_t bytes) {
+        for (uint32_t i = 0; i < bytes; i++)
+                p[i] = (x >> (8 * i)) & 0xFF;
+}
+
+static uint64_t
+get_uint(const unsigned char *p, uint32_t bytes) {
+        uint64_t x = 0;
+        for (uint32_t i = 0; i < bytes; i++)
+                x |= (uint64_t) p[i] << (8 * i);
+        return x;
+}
+
+static size_t
+binary_record_size(uint32_t num_species, uint32_t num_characters) {
+        return ((size_t) num_species * num_characters + BINARY_CELLS_PER_BYTE - 1) / BINARY_CELLS_PER_BYTE;
+}
+
+/**
+   \brief opens the file of \c props and reads its header, in the text or
+   in the binary format.
+
+   The format is recognized from the first bytes of the file. In the
+   binary format the file is positioned at the first instance of the range,
+   which costs a single seek, since all records have the same size.
+*/
+static void
+open_instances(instances_schema_s* props) {
+        props->file = fopen(props->filename, "rb");
+        if (props->file == NULL)
+                error(3, 0, "Could not open input file: %s\n", props->filename);
+        props->buffer = xmalloc(READ_BUFFER_SIZE);
+        props->buffer_length = 0;
+        props->buffer_position = 0;
+        props->next_instance = 0;
+        fill_buffer(props);
+        props->binary = props->buffer_length >= BINARY_MAGIC_LENGTH &&
+                memcmp(props->buffer, BINARY_MAGIC, BINARY_MAGIC_LENGTH) == 0;
+        if (!props->binary) {
+                if (read_value(props, &(props->num_species)) != READ_VALUE ||
+                    read_value(props, &(props->num_characters)) == READ_EOF)
+                        error(1, 0, "Could not read the first line of file: %s\n", props->filename);
+        } else {
+                if (props->buffer_length < BINARY_HEADER_SIZE)
+                        error(1, 0, "Could not read the header of file: %s\n", props->filename);
+                const unsigned char *header = (const unsigned char *) props->buffer;
+                props->num_species = get_uint(header + BINARY_MAGIC_LENGTH, 4);
+                props->num_characters = get_uint(header + BINARY_MAGIC_LENGTH + 4, 4);
+                props->num_instances = get_uint(header + BINARY_MAGIC_LENGTH + 8, 8);
+        }
+/*
+  An empty matrix is read without consuming any value, hence a file of
+  empty instances would never end.
+*/
+        if (props->num_species == 0 || props->num_characters == 0)
+                error(1, 0, "The instances of file %s are empty\n", props->filename);
+        if (!props->binary)
+                return;
+
+        size_t record_size = binary_record_size(props->num_species, props->num_characters);
+        if (record_size > READ_BUFFER_SIZE)
+                props->buffer = xrealloc(props->buffer, record_size);
+        props->next_instance = props->first_instance < props->num_instances ?
+                props->first_instance : props->num_instances;
+        if (fseeko(props->file, BINARY_HEADER_SIZE + (off_t) (props->next_instance * record_size), SEEK_SET) != 0)
+                error(2, 0, "Badly formatted input file: %s\n", props->filename);
+}
+
+static void
+close_instances(instances_schema_s* props) {
+        log_debug("Read instance: EOF");
+        fclose(props->file);
+        props->file = NULL;
+        xfree(props->buffer);
+        props->buffer = NULL;
+}
+
+/**
+   \brief reads the next matrix of the file in \c matrix, stored row by row.
+
+   \return \c false at the end of the file
+*/
+static bool
+read_matrix(instances_schema_s* props, uint32_t *matrix) {
+        size_t cells = (size_t) props->num_species * props->num_characters;
+        if (props->binary) {
+                if (props->next_instance >= props->num_instances)
+                        return false;
+                size_t record_size = binary_record_size(props->num_species, props->num_characters);
+                if (fread(props->buffer, 1, record_size, props->file) != record_size)
+                        error(2, 0, "Badly formatted input file: %s\n", props->filename);
+                const unsigned char *record = (const unsigned char *) props->buffer;
+                for (size_t i = 0; i < cells; i++)
+                        matrix[i] = (record[i / BINARY_CELLS_PER_BYTE] >> (BINARY_CELL_BITS * (i % BINARY_CELLS_PER_BYTE))) & BINARY_CELL_MASK;
+                return true;
+        }
+        for (size_t i = 0; i < cells; i++) {
+                uint32_t x = -1;
+                uint32_t outcome = read_value(props, &x);
+/*
+  Check that the file is not ended in the middle of an instance.
+  Notice that, just as fscanf, a file whose last value is not followed by
+  a newline ends there: the last instance is not read.
+*/
+                if (outcome == READ_EOF && i != 0)
+                        error(2, 0, "Badly formatted input file: %s\n", props->filename);
+                if (outcome == READ_INVALID)
+                        error(2, 0, "Badly formatted input file: %s\n", props->filename);
+                if (outcome == READ_EOF || outcome == READ_EOF_AFTER_VALUE)
+                        return false;
+                matrix[i] = x;
+        }
+        return true;
+}
+
+/**
+   \brief reads the next matrix of the range \c first_instance ..
+   \c last_instance of \c props, skipping the matrices before the range.
+
+   \return \c false when the range or the file is over
+*/
+static bool
+next_matrix(instances_schema_s* props, uint32_t *matrix) {
+        for (; props->next_instance < props->first_instance; props->next_instance++)
+                if (!read_matrix(props, matrix))
+                        return false;
+        if (props->next_instance >= props->last_instance || !read_matrix(props, matrix))
+                return false;
+        props->next_instance++;
+        return true;
+}
+
+uint64_t
+write_binary_instances(instances_schema_s* props, FILE* outf) {
+        assert(props->filename != NULL);
+        if (props->file == NULL)
+                open_instances(props);
+        size_t cells = (size_t) props->num_species * props->num_characters;
+        size_t record_size = binary_record_size(props->num_species, props->num_characters);
+        uint32_t *matrix = xmalloc(cells * sizeof(uint32_t));
+        unsigned char *record = xmalloc(record_size);
+        unsigned char header[BINARY_HEADER_SIZE];
+        uint64_t count = 0;
+
+        memcpy(header, BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+        put_uint(header + BINARY_MAGIC_LENGTH, props->num_species, 4);
+        put_uint(header + BINARY_MAGIC_LENGTH + 4, props->num_characters, 4);
+        put_uint(header + BINARY_MAGIC_LENGTH + 8, count, 8);
+        if (fwrite(header, 1, BINARY_HEADER_SIZE, outf) != BINARY_HEADER_SIZE)
+                error(6, 0, "Could not write the header of the binary file\n");
+        while (next_matrix(props, matrix)) {
+                memset(record, 0, record_size);
+                for (size_t i = 0; i < cells; i++) {
+                        if (matrix[i] > BINARY_CELL_MASK - 1)
+                                error(2, 0, "Value %" PRIu32 " cannot be stored in the binary format: %s\n", matrix[i], props->filename);
+                        record[i / BINARY_CELLS_PER_BYTE] |= matrix[i] << (BINARY_CELL_BITS * (i % BINARY_CELLS_PER_BYTE));
+                }
+                if (fwrite(record, 1, record_size, outf) != record_size)
+                        error(6, 0, "Could not write instance %" PRIu64 " to the binary file\n", count);
+                count++;
+        }
+        close_instances(props);
+/*
+  The number of instances is known only at the end, so the header is
+  written again, once all records have reached the file.
+*/
+        put_uint(header + BINARY_MAGIC_LENGTH + 8, count, 8);
+        if (fflush(outf) != 0 || fseek(outf, 0, SEEK_SET) != 0 ||
+            fwrite(header, 1, BINARY_HEADER_SIZE, outf) != BINARY_HEADER_SIZE || fflush(outf) != 0)
+                error(6, 0, "Could not write the header of the binary file\n");
+        xfree(record);
+        xfree(matrix);
+        return count;
+}
+
+/*
+  Builds the instance of the matrix of stp, which has just been
+  initialized by init_state: the column bitmaps, the red-black graph, the
+  connected components and the conflict graph, after the cleanup.
+*/
+static void
+build_instance(state_s* stp) {
+        stp->columns = arena_alloc(stp->arena, stp->num_characters * stp->species_words * sizeof(bitmap_word));
+/*
+  Each 1 of the matrix is stored in the column bitmaps and in the
+  red-black graph.
+*/
+        for(uint32_t s=0; s < stp->num_species; s++)
+                for(uint32_t c=0; c < stp->num_characters; c++)
+                        if (matrix_get_value(stp, s, c) == 1) {
+                                bitmap_set_bit(column(stp, c), s);
+                                graph_add_edge(stp->red_black, s, c + stp->num_species);
+                        }
+        state_fingerprint(stp, stp->fingerprint);
+#ifdef DEBUG
+        log_debug("MATRIX");
+        for(uint32_t s=0; s < stp->num_species; s++) {
+                for(uint32_t c=0; c < stp->num_characters; c++)
+                        fprintf(stderr, "%d", matrix_get_value(stp, s, c));
+                fprintf(stderr, "\n");
+        }
+        graph_pp(stp->red_black);
+#endif
+        update_connected_components(stp);
+        check_state(stp);
+        cleanup(stp);
+        check_state(stp);
+        log_debug("build_instance: call update_connected_components");
+        update_connected_components(stp);
+        check_state(stp);
+        log_debug("build_instance: update_conflict_graph");
+        update_conflict_graph(stp);
+/*
+  The instance read from the file is the root of the decision tree,
+  therefore there is nothing to undo
+*/
+        stp->log_size = 0;
+
+        log_state(stp);
+}
+
+
+
+void
+state_from_matrix(state_s* stp, const uint32_t* matrix, uint32_t num_species, uint32_t num_characters, arena_s* ap,
+                  bool collapse_duplicates, bool direct_phylogeny) {
+        init_state(stp, num_species, num_characters, ap);
+        stp->collapse_duplicates = collapse_duplicates;
+        stp->direct_phylogeny = direct_phylogeny;
+        stp->matrix = arena_alloc(ap, (size_t) num_species * num_characters * sizeof(uint32_t));
+        memcpy(stp->matrix, matrix, (size_t) num_species * num_characters * sizeof(uint32_t));
+        build_instance(stp);
+}
+
 /**
    \brief read the file containing an instance of the ppp problem and computes the
    corresponding state
@@ -348,110 +916,170 @@ bool
 read_instance_from_filename(instances_schema_s* global_props, state_s* stp) {
         assert(global_props->filename != NULL);
         log_debug("Reading data from:%s\n", global_props->filename);
-        if (global_props->file == NULL) {
-                global_props->file = fopen(global_props->filename, "r");
-                assert(global_props->file != NULL);
-                if (feof(global_props->file))
-                        error(3, 0, "Could not open input file: %s\n", global_props->filename);
-
-                int err = fscanf(global_props->file, "%"SCNu32" %"SCNu32, &(global_props->num_species),
-                                 &(global_props->num_characters));
-                if (err == EOF)
-                        error(1, 0, "Could not read the first line of file: %s\n", global_props->filename);
-        }
-
-        init_state(stp, global_props->num_species, global_props->num_characters);
+        if (global_props->file == NULL)
+                open_instances(global_props);
+
+        if (global_props->arena != NULL)
+                arena_reset(global_props->arena);
+        init_state(stp, global_props->num_species, global_props->num_characters, global_props->arena);
+        stp->collapse_duplicates = global_props->collapse_duplicates;
+        stp->direct_phylogeny = global_props->direct_phylogeny;
         stp->num_species = global_props->num_species;
         stp->num_characters = global_props->num_characters;
-        stp->matrix = GC_MALLOC_ATOMIC(stp->num_species * stp->num_characters * sizeof(uint32_t));
+        stp->matrix = arena_alloc(global_props->arena, stp->num_species * stp->num_characters * sizeof(uint32_t));
         assert(stp->matrix != NULL);
-        for(uint32_t s=0; s < stp->num_species; s++)
-                for(uint32_t c=0; c < stp->num_characters; c++) {
-                        uint32_t x = -1;
-                        int err = fscanf(global_props->file, "%"SCNu32, &x);
-/*
-  Check that the file is not ended in the middle of an instance
+        if (!next_matrix(global_props, stp->matrix)) {
+                close_instances(global_props);
+                return false;
+        }
+        build_instance(stp);
+        log_debug("read_instance_from_filename: completed");
+        return true;
+}
+
+/**
+   \struct vertex_hash_s
+   \brief a vertex of the red-black graph, with the hash of its neighbourhood
 */
-                        if (err == EOF && (s != 0 || c != 0))
-                                error(2, 0, "Badly formatted input file: %s\n", global_props->filename);
-                        if (feof(global_props->file)) {
-                                log_debug("Read instance: EOF");
-                                fclose(global_props->file);
-                                return false;
-                        }
-                        matrix_set_value(stp, s, c, x);
-                }
-#ifdef DEBUG
-        log_debug("MATRIX");
-        for(uint32_t s=0; s < stp->num_species; s++) {
-                for(uint32_t c=0; c < stp->num_characters; c++)
-                        fprintf(stderr, "%d", matrix_get_value(stp, s, c));
-                fprintf(stderr, "\n");
+typedef struct vertex_hash_s {
+        uint64_t hash;
+        uint32_t vertex;
+} vertex_hash_s;
+
+static int
+vertex_hash_cmp(const void *p1, const void *p2) {
+        const vertex_hash_s *a = p1;
+        const vertex_hash_s *b = p2;
+        if (a->hash != b->hash)
+                return (a->hash < b->hash) ? -1 : 1;
+        return (a->vertex < b->vertex) ? -1 : (a->vertex > b->vertex);
+}
+
+static uint64_t
+neighbourhood_hash(const state_s *stp, uint32_t v) {
+        const bitmap_word *row = graph_neighbourhood(stp->red_black, v);
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (uint32_t i = 0; i < stp->red_black->row_words; i++) {
+                h = (h ^ row[i]) * 0xBF58476D1CE4E5B9ULL;
+                h ^= h >> 31;
         }
-#endif
-        /* red-black graph */
-        for(uint32_t s=0; s < stp->num_species; s++)
-                for(uint32_t c=0; c < stp->num_characters; c++)
-                        if (matrix_get_value(stp, s, c) == 1)
-                                graph_add_edge(stp->red_black, s, c + stp->num_species);
-#ifdef DEBUG
-        log_debug("MATRIX");
-        graph_pp(stp->red_black);
-#endif
-        /* check the red-black graph */
-        for(uint32_t s=0; s < stp->num_species; s++)
-                for(uint32_t c=0; c < stp->num_characters; c++)
-                        assert(matrix_get_value(stp, s, c) == 0 && !graph_get_edge(stp->red_black, s, c + stp->num_species) ||
-                               matrix_get_value(stp, s, c) == 1 && graph_get_edge(stp->red_black, s, c + stp->num_species));
-        update_connected_components(stp);
-        check_state(stp);
-        cleanup(stp);
-        check_state(stp);
-        log_debug("read_instance_from_filename: call update_connected_components");
-        update_connected_components(stp);
-        check_state(stp);
-        log_debug("read_instance_from_filename: update_conflict_graph");
-        update_conflict_graph(stp);
+        return h;
+}
 
-        memset(stp->tried_characters, 0, stp->num_characters_orig * sizeof((stp->tried_characters)[0]));
-        memset(stp->character_queue, 0, stp->num_characters_orig * sizeof((stp->character_queue)[0]));
-        stp->tried_characters_size = 0;
-        stp->character_queue_size = 0;
-        stp->operation = 0;
-        stp->realize = 0;
-        stp->backtrack_level = 0;
+static bool
+same_neighbourhood(const state_s *stp, uint32_t v1, uint32_t v2) {
+        return memcmp(graph_neighbourhood(stp->red_black, v1), graph_neighbourhood(stp->red_black, v2),
+                      stp->red_black->row_words * sizeof(bitmap_word)) == 0;
+}
 
-        log_state(stp);
-        log_debug("read_instance_from_filename: completed");
-        return true;
+/**
+   \brief removes all edges incident on \c v
+*/
+static void
+isolate_vertex(state_s *stp, uint32_t v) {
+        uint32_t nv = stp->red_black->num_vertices;
+        for (uint32_t w = graph_next_neighbour(stp->red_black, v, 0); w < nv; w = graph_next_neighbour(stp->red_black, v, w + 1))
+                flip_red_black_edge(stp, v, w);
+}
+
+/**
+   \brief finds the duplicates among the \c size vertices of \c vertices,
+   which must have nonzero degree. Each duplicate is passed to \c collapse,
+   together with the vertex with the smallest id that it duplicates.
+
+   The neighbourhoods are hashed and sorted, so that only vertices with the
+   same hash are compared. The color of the characters is part of the hash.
+*/
+static void
+collapse_duplicates(state_s *stp, uint32_t *vertices, uint32_t size, void (*collapse)(state_s *, uint32_t, uint32_t)) {
+        vertex_hash_s *hashes = stp->workspace.hashes;
+        for (uint32_t i = 0; i < size; i++) {
+                uint32_t v = vertices[i];
+                hashes[i].vertex = v;
+                hashes[i].hash = neighbourhood_hash(stp, v);
+                if (v >= stp->num_species_orig)
+                        hashes[i].hash ^= stp->colors[v - stp->num_species_orig];
+        }
+        qsort(hashes, size, sizeof(vertex_hash_s), vertex_hash_cmp);
+        for (uint32_t first = 0; first < size; ) {
+                uint32_t last = first + 1;
+                for (; last < size && hashes[last].hash == hashes[first].hash; last++) ;
+                for (uint32_t i = first + 1; i < last; i++)
+                        for (uint32_t j = first; j < i; j++) {
+                                uint32_t v = hashes[j].vertex;
+                                uint32_t w = hashes[i].vertex;
+                                if (graph_degree(stp->red_black, v) > 0 && same_neighbourhood(stp, v, w) &&
+                                    (v < stp->num_species_orig ||
+                                     stp->colors[v - stp->num_species_orig] == stp->colors[w - stp->num_species_orig])) {
+                                        collapse(stp, v, w);
+                                        break;
+                                }
+                        }
+                first = last;
+        }
 }
 
+static void
+collapse_species(state_s *stp, uint32_t s, uint32_t duplicate) {
+        log_debug("Species %d duplicates species %d", duplicate, s);
+        isolate_vertex(stp, duplicate);
+        delete_species(stp, duplicate);
+}
+
+/*
+  The duplicate, together with its own list of duplicates, is appended to
+  the list of duplicates following the character.
+*/
+static void
+collapse_character(state_s *stp, uint32_t v, uint32_t duplicate) {
+        uint32_t c = v - stp->num_species_orig;
+        uint32_t d = duplicate - stp->num_species_orig;
+        log_debug("Character %d duplicates character %d", d, c);
+        for (; stp->twin[c] != -1; c = stp->twin[c]) ;
+        record_change(stp, CHANGE_TWIN, c, stp->twin[c]);
+        stp->twin[c] = d;
+        isolate_vertex(stp, duplicate);
+        delete_character(stp, d);
+}
 
 /*
   \brief Simplify the instance whenever possible.
 
-  We remove null characters and species.
+  We remove null characters and species, and the duplicates if
+  \c stp->collapse_duplicates is set. Removing a duplicate changes only the
+  edges of the duplicate, and the connected components must be updated
+  afterwards.
 */
 void cleanup(state_s *stp) {
         assert(stp != NULL);
         log_debug("cleanup");
         log_state(stp);
+        uint32_t n = stp->num_species_orig;
+        uint32_t m = stp->num_characters_orig;
         // Looking for null species
-        for (uint32_t s=0; s < stp->num_species_orig; s++)
-                if (stp->species[s] && graph_degree(stp->red_black, s) == 0) {
+        for (uint32_t s = bitmap_next_bit(stp->species, 0, n); s < n; s = bitmap_next_bit(stp->species, s + 1, n))
+                if (graph_degree(stp->red_black, s) == 0) {
                         log_debug("Want to delete species %d\n", s);
                         delete_species(stp, s);
                 }
 // Looking for null characters
-        for (uint32_t c = 0; c < stp->num_characters_orig; c++)
-                if (stp->characters[c] && graph_degree(stp->red_black, c + stp->num_species_orig) == 0) {
+        for (uint32_t c = bitmap_next_bit(stp->characters, 0, m); c < m; c = bitmap_next_bit(stp->characters, c + 1, m))
+                if (graph_degree(stp->red_black, c + n) == 0) {
 
                         log_debug("Want to delete character %d\n", c);
                         delete_character(stp, c);
                 }
-/* TODO (if necessary) */
-/* we remove duplicated characters */
-/* we remove duplicated species */
+        if (stp->collapse_duplicates) {
+                uint32_t *vertices = stp->workspace.vertices;
+                uint32_t size = 0;
+                for (uint32_t s = bitmap_next_bit(stp->species, 0, n); s < n; s = bitmap_next_bit(stp->species, s + 1, n))
+                        vertices[size++] = s;
+                collapse_duplicates(stp, vertices, size, collapse_species);
+                size = 0;
+                for (uint32_t c = bitmap_next_bit(stp->characters, 0, m); c < m; c = bitmap_next_bit(stp->characters, c + 1, m))
+                        vertices[size++] = c + n;
+                collapse_duplicates(stp, vertices, size, collapse_character);
+        }
         log_debug("cleanup: final state");
         log_state(stp);
         log_debug("cleanup: end");
@@ -470,54 +1098,191 @@ get_conflict_graph(const state_s *inst) {
 }
 
 
+/*
+  The arrays of a state, and those of a node of the decision tree, are
+  carved from a single block, each one starting at a multiple of
+  SLAB_ALIGNMENT bytes, that is at a cache line.
+*/
+#define SLAB_ALIGNMENT 64
+
+static size_t
+slab_round(size_t size) {
+        return (size + SLAB_ALIGNMENT - 1) & ~((size_t) SLAB_ALIGNMENT - 1);
+}
+
+/**
+   \brief allocates in the arena \c ap a block of \c size bytes starting at a
+   multiple of \c SLAB_ALIGNMENT
+*/
+static void*
+slab_alloc(arena_s *ap, size_t size) {
+        return (void*) slab_round((uintptr_t) arena_alloc(ap, size + SLAB_ALIGNMENT - 1));
+}
+
+/**
+   \brief the array of \c size bytes starting at \c *next, which is moved to
+   the next aligned position
+*/
+static void*
+slab_carve(char **next, size_t size) {
+        void *p = *next;
+        *next += slab_round(size);
+        return p;
+}
+
 void
-init_state(state_s *stp, uint32_t n, uint32_t m) {
+init_state(state_s *stp, uint32_t n, uint32_t m, arena_s *ap) {
         log_debug("init_state n=%d m=%d", n, m);
         assert(stp != NULL);
+        stp->arena = ap;
         stp->num_characters_orig = m;
         stp->num_species_orig = n;
         stp->num_characters = m;
         stp->num_species = n;
-        stp->realize = 0;
-        stp->species = xmalloc(n * sizeof(bool));
-        stp->characters = xmalloc(m * sizeof(bool));
-        stp->colors = xmalloc(m * sizeof(uint8_t));
-
-        stp->tried_characters = xmalloc(m * sizeof(uint32_t));
-        stp->character_queue = xmalloc(m * sizeof(uint32_t));
-        stp->connected_components = xmalloc((m + n) * sizeof(uint32_t));
-        stp->current_component = xmalloc((m + n) * sizeof(bool));
-        stp->operation = 0;
-
-        stp->red_black = graph_new(n + m);
+        size_t vertices_size = slab_round((m + n) * sizeof(uint32_t));
+        size_t rows_size = WORKSPACE_ROWS * BITMAP_NWORDS(n + m) * sizeof(bitmap_word);
+        char *next = slab_alloc(ap, slab_round(bitmap_sizeof(n)) + slab_round(bitmap_sizeof(m)) +
+                                slab_round(m * sizeof(uint8_t)) + slab_round(m * sizeof(uint32_t)) + 4 * vertices_size +
+                                slab_round(rows_size) + slab_round((m + n) * sizeof(int64_t)) +
+                                slab_round((m + n) * sizeof(vertex_hash_s)) +
+                                slab_round(BITMAP_NWORDS(n) * sizeof(uint32_t)) +
+                                slab_round(2 * m * sizeof(bitmap_word*)) + slab_round((n + 2 * m) * sizeof(uint32_t)) +
+                                slab_round((WORKSPACE_TREE_ARRAYS * 2 * m + n + 1) * sizeof(uint32_t)) +
+                                slab_round(m * sizeof(uint32_t)) + slab_round((m + n) * sizeof(char*)));
+        stp->connected_components = slab_carve(&next, (m + n) * sizeof(uint32_t));
+        stp->component_size = slab_carve(&next, (m + n) * sizeof(uint32_t));
+        stp->component_species = slab_carve(&next, (m + n) * sizeof(uint32_t));
+        stp->species = slab_carve(&next, bitmap_sizeof(n));
+        stp->characters = slab_carve(&next, bitmap_sizeof(m));
+        stp->colors = slab_carve(&next, m * sizeof(uint8_t));
+        stp->twin = slab_carve(&next, m * sizeof(uint32_t));
+        stp->workspace.rows = slab_carve(&next, rows_size);
+        stp->workspace.vertices = slab_carve(&next, (m + n) * sizeof(uint32_t));
+        stp->workspace.keys = slab_carve(&next, (m + n) * sizeof(int64_t));
+        stp->workspace.hashes = slab_carve(&next, (m + n) * sizeof(vertex_hash_s));
+        stp->workspace.words = slab_carve(&next, BITMAP_NWORDS(n) * sizeof(uint32_t));
+        stp->workspace.columns = slab_carve(&next, 2 * m * sizeof(bitmap_word*));
+        stp->workspace.labels = slab_carve(&next, (n + 2 * m) * sizeof(uint32_t));
+        stp->workspace.tree = slab_carve(&next, (WORKSPACE_TREE_ARRAYS * 2 * m + n + 1) * sizeof(uint32_t));
+        stp->workspace.chain = slab_carve(&next, m * sizeof(uint32_t));
+        stp->workspace.results = slab_carve(&next, (m + n) * sizeof(char*));
+        stp->collapse_duplicates = false;
+        stp->direct_phylogeny = false;
+        stp->times = NULL;
+
+        if (m + n > 0) {
+                stp->component_size[0] = m + n;
+                stp->component_species[0] = n;
+        }
+
+        stp->red_black = graph_new(n + m, ap);
         assert(stp->red_black != NULL);
-        stp->conflict = graph_new(m);
+        stp->conflict = graph_new(m, ap);
         assert(stp->conflict != NULL);
 
-        for (uint32_t i=0; i < n; i++) {
-                stp->species[i] = true;
-        }
+        stp->matrix = NULL;
+        stp->columns = NULL;
+        stp->species_words = BITMAP_NWORDS(n);
 
+        stp->log_capacity = 4 * (n + m) + 1;
+        stp->log = arena_alloc(ap, stp->log_capacity * sizeof(change_s));
+        stp->log_size = 0;
+
+        bitmap_fill(stp->species, n);
+        bitmap_fill(stp->characters, m);
         for (uint32_t i=0; i < m; i++) {
-                stp->tried_characters[i] = -1;
-                stp->character_queue[i] = -1;
-                stp->characters[i] = true;
                 stp->colors[i] = BLACK;
+                stp->twin[i] = -1;
         }
-        stp->character_queue_size = 0;
-        stp->tried_characters_size = 0;
-
 
+        state_fingerprint(stp, stp->fingerprint);
         log_debug("init_state: before update_connected_components");
         update_connected_components(stp);
+        stp->log_size = 0;
         log_debug("init_state: completed");
         check_state(stp);
 }
 
+static size_t
+level_slab_size(uint32_t n, uint32_t m) {
+        return 3 * slab_round(m * sizeof(uint32_t)) + slab_round(bitmap_sizeof(m + n)) + slab_round(bitmap_sizeof(m));
+}
+
+/**
+   \brief carves the arrays of the node \c lp from \c slab, and gives them
+   their initial values
+*/
+static void
+carve_level(level_s *lp, void *slab, uint32_t n, uint32_t m) {
+        char *next = slab;
+        lp->slab = slab;
+        lp->tried_characters = slab_carve(&next, m * sizeof(uint32_t));
+        lp->character_queue = slab_carve(&next, m * sizeof(uint32_t));
+        lp->twins = slab_carve(&next, m * sizeof(uint32_t));
+        lp->current_component = slab_carve(&next, bitmap_sizeof(m + n));
+        lp->characters = slab_carve(&next, bitmap_sizeof(m));
+        lp->twins_size = 0;
+        for (uint32_t i=0; i < m; i++) {
+                lp->tried_characters[i] = -1;
+                lp->character_queue[i] = -1;
+        }
+        bitmap_fill(lp->characters, m);
+        lp->character_queue_size = 0;
+        lp->character_queue_first = 0;
+        lp->tried_characters_size = 0;
+        lp->num_species = n;
+        lp->operation = 0;
+        lp->realize = 0;
+        lp->backtrack_level = 0;
+        lp->log_mark = 0;
+        lp->subtrees = NULL;
+}
+
+void
+init_level(level_s *lp, uint32_t n, uint32_t m, arena_s *ap) {
+        log_debug("init_level n=%d m=%d", n, m);
+        assert(lp != NULL);
+        carve_level(lp, slab_alloc(ap, level_slab_size(n, m)), n, m);
+}
+
+level_s *
+new_levels(uint32_t n, uint32_t m, arena_s *ap) {
+/*
+   Notice that each character is realized at most twice (once positive and once
+   negative) and that each species can be declared null at most once.
+
+   Therefore each partial solution con contain at most 2m+n states.
+*/
+        uint32_t max_depth = n + 2 * m + 1;
+        size_t size = level_slab_size(n, m);
+        level_s *levels = arena_alloc(ap, (max_depth + 1) * sizeof(level_s));
+        char *slabs = slab_alloc(ap, (max_depth + 1) * size);
+        for (uint32_t level = 0; level <= max_depth; level++)
+                carve_level(levels + level, slabs + level * size, n, m);
+        return levels;
+}
+
+void
+copy_level(level_s *dst, const level_s *src, uint32_t n, uint32_t m) {
+        memcpy(dst->slab, src->slab, level_slab_size(n, m));
+        dst->character_queue_size = src->character_queue_size;
+        dst->character_queue_first = src->character_queue_first;
+        dst->tried_characters_size = src->tried_characters_size;
+        dst->num_species = src->num_species;
+        dst->operation = src->operation;
+        dst->realize = src->realize;
+        dst->backtrack_level = src->backtrack_level;
+        dst->log_mark = src->log_mark;
+        dst->subtrees = src->subtrees;
+        dst->fingerprint[0] = src->fingerprint[0];
+        dst->fingerprint[1] = src->fingerprint[1];
+        dst->twins_size = src->twins_size;
+}
+
+#ifdef DEBUG
 void
 check_state(const state_s* stp) {
         uint32_t err = 0;
-#ifdef DEBUG
         if (stp->num_species == -1 || stp->num_species > stp->num_species_orig) {
                 err = 1;
                 log_debug("check_state error: Line %d (%d != %d)", __LINE__, stp->num_species, stp->num_species_orig);
@@ -529,7 +1294,7 @@ check_state(const state_s* stp) {
 
         uint32_t count = 0;
         for (uint32_t s = 0; s < stp->num_species_orig; s++) {
-                if (stp->species[s])
+                if (bitmap_get_bit(stp->species, s))
                         count++;
         }
         if (count != stp->num_species) {
@@ -539,7 +1304,7 @@ check_state(const state_s* stp) {
 
         count = 0;
         for (uint32_t c = 0; c < stp->num_characters_orig; c++) {
-                if (stp->characters[c])
+                if (bitmap_get_bit(stp->characters, c))
                         count++;
         }
         if (count != stp->num_characters) {
@@ -552,21 +1317,36 @@ check_state(const state_s* stp) {
                 log_debug("Line %d (%d != %d)", __LINE__, stp->num_characters, count);
         }
 
-        // check connected_components
-        uint32_t max_conn = 0;
-        for (uint32_t v = 0; v < stp->red_black->num_vertices; v++)
-                if ((stp->connected_components)[v] > max_conn)
-                        max_conn = (stp->connected_components)[v];
-
-        bool component_id[max_conn + 1];
-        memset(component_id, 0, (max_conn + 1) * sizeof(bool));
-        for (uint32_t v = 0; v < stp->red_black->num_vertices; v++)
-                component_id[stp->connected_components[v]] = true;
-        for (uint32_t c = 0; c <= max_conn; c++)
-                if (!component_id[c]) {
+        // check connected_components: each label is the smallest vertex of
+        // its component, adjacent vertices have the same label, and the
+        // sizes of the components are correct
+        uint32_t nv = stp->red_black->num_vertices;
+        for (uint32_t v = 0; v < nv; v++) {
+                uint32_t label = (stp->connected_components)[v];
+                if (label > v || (stp->connected_components)[label] != label) {
                         err = 6;
-                        log_debug("Line %d %d %d", __LINE__, c, component_id[c]);
+                        log_debug("Line %d %d %d", __LINE__, v, label);
                 }
+                for (uint32_t w = graph_next_neighbour(stp->red_black, v, 0); w < nv; w = graph_next_neighbour(stp->red_black, v, w + 1))
+                        if ((stp->connected_components)[w] != label) {
+                                err = 6;
+                                log_debug("Line %d %d %d", __LINE__, v, w);
+                        }
+        }
+        for (uint32_t label = 0; label < nv; label++) {
+                uint32_t size = 0;
+                uint32_t size_species = 0;
+                for (uint32_t v = 0; v < nv; v++)
+                        if ((stp->connected_components)[v] == label) {
+                                size++;
+                                if (v < stp->num_species_orig)
+                                        size_species++;
+                        }
+                if (size != stp->component_size[label] || size_species != stp->component_species[label]) {
+                        err = 8;
+                        log_debug("Line %d %d %d %d", __LINE__, label, size, stp->component_size[label]);
+                }
+        }
         assert(stp->red_black != NULL);
 
         if ((stp->num_characters_orig) + (stp->num_species_orig) != stp->red_black->num_vertices) {
@@ -574,7 +1354,13 @@ check_state(const state_s* stp) {
                 log_debug("Line %d (%d + %d != %d)", __LINE__, stp->num_characters_orig, stp->num_species_orig, stp->red_black->num_vertices);
         }
 
-#endif
+        uint64_t fingerprint[2];
+        state_fingerprint(stp, fingerprint);
+        if (fingerprint[0] != stp->fingerprint[0] || fingerprint[1] != stp->fingerprint[1]) {
+                err = 9;
+                log_debug("Line %d fingerprint", __LINE__);
+        }
+
         if (err > 0) {
                 log_state(stp);
                 log_debug("check_graph code: %d", err);
@@ -583,6 +1369,7 @@ check_state(const state_s* stp) {
         graph_check(stp->red_black);
         graph_check(stp->conflict);
 }
+#endif
 
 uint32_t
 characters_list(state_s * stp, uint32_t *array) {
@@ -601,30 +1388,36 @@ void
 delete_character(state_s *stp, uint32_t c) {
         log_debug("Deleting character %d", c);
         assert(c < stp->num_characters_orig);
-        assert(stp->characters[c]);
+        assert(bitmap_get_bit(stp->characters, c));
         assert(stp->colors[c] > 0);
-        stp->characters[c] = false;
+        bitmap_clear_bit(stp->characters, c);
         (stp->num_characters)--;
+        toggle_fingerprint(stp->fingerprint, CHANGE_CHARACTER, c, 0);
+        record_change(stp, CHANGE_CHARACTER, c, 0);
 }
 
 void
 delete_species(state_s *stp, uint32_t s) {
         log_debug("Deleting species %d", s);
         assert(s < stp->num_species_orig);
-        assert(stp->species[s] > 0);
-        stp->species[s] = false;
+        assert(bitmap_get_bit(stp->species, s));
+        bitmap_clear_bit(stp->species, s);
         (stp->num_species)--;
+        toggle_fingerprint(stp->fingerprint, CHANGE_SPECIES, s, 0);
+        record_change(stp, CHANGE_SPECIES, s, 0);
 }
 
 
 
 void
-smallest_component(state_s* stp) {
+smallest_component(const state_s* stp, level_s* lp) {
         assert(stp != NULL);
+        assert(lp != NULL);
         assert(stp->connected_components != NULL);
-        log_debug("smallest_component. stp=%p", stp);
+        log_debug("smallest_component. stp=%p lp=%p", stp, lp);
+        double start = timer_start(stp);
         log_array_uint32_t("stp->connected_components", stp->connected_components, stp->red_black->num_vertices);
-        stp->character_queue_size = stp->red_black->num_vertices + 1;
+        lp->character_queue_size = stp->red_black->num_vertices + 1;
 /**
    We need only the connected components that contain at least a species and a character. We only have to count the
    number of characters contained in the component.
@@ -637,15 +1430,8 @@ smallest_component(state_s* stp) {
    Only the first character in \c character_queue can might be active: in that case the character must be adjacent to
    all species in its connected components, hence it can be freed.
 */
-        uint32_t card[stp->red_black->num_vertices];
-        memset(card, 0, stp->red_black->num_vertices * sizeof(card[0]));
-        uint32_t card_species[stp->red_black->num_vertices];
-        memset(card_species, 0, stp->red_black->num_vertices * sizeof(card[0]));
-        for (uint32_t w = 0; w < stp->red_black->num_vertices; w++) {
-                card[stp->connected_components[w]] += 1;
-                if (w < stp->num_species_orig)
-                        card_species[stp->connected_components[w]] += 1;
-        }
+        const uint32_t *card = stp->component_size;
+        const uint32_t *card_species = stp->component_species;
         uint32_t smallest_component = stp->red_black->num_vertices + 1;
         uint32_t smallest_size = stp->red_black->num_vertices + 1;
         for (uint32_t w = 0; w < stp->num_species_orig + stp->num_characters_orig; w++)
@@ -653,111 +1439,228 @@ smallest_component(state_s* stp) {
                         smallest_size = card[w];
                         smallest_component = w;
                 }
-        uint32_t smallest_num_species = card_species[smallest_component];
+        uint32_t smallest_num_species = (smallest_component < stp->red_black->num_vertices) ? card_species[smallest_component] : 0;
 
         log_debug("smallest_component: %d smallest_size: %d smallest_num_species: %d",
                   smallest_component, smallest_size, smallest_num_species);
-        for (uint32_t w = 0; w < stp->red_black->num_vertices; w++)
-                stp->current_component[w] = (stp->connected_components[w] == smallest_component);
-
         /* Reorder the characters in the current (i.e. smallest) connected components so that an active character that
-           can be freed is in the first position of \c stp->character_queue (if such an active character exists), and all
-           other active characters are at the end of the queue */
+           can be freed is in the first position of \c lp->character_queue (if such an active character exists), and all
+           other active characters are at the end of the queue.
+           The degree of an active character is at most the number of species of its component, hence the first active
+           character reaching it is the one that can be freed, and the degrees of the following ones are not needed. */
 
         uint32_t maximum_active_char = 0;
         uint32_t num_inactive_char = 0;
         uint32_t max_degree_active = 0;
 
+        bitmap_zero(lp->current_component, stp->red_black->num_vertices);
+        for (uint32_t w = 0; w < stp->num_species_orig; w++)
+                if (stp->connected_components[w] == smallest_component)
+                        bitmap_set_bit(lp->current_component, w);
         for (uint32_t w = stp->num_species_orig; w < stp->num_species_orig + stp->num_characters_orig; w++)
                 if (stp->connected_components[w] == smallest_component) {
                         uint32_t character = w - stp->num_species_orig;
+                        bitmap_set_bit(lp->current_component, w);
                         if (stp->colors[character] == BLACK) {
-                                stp->character_queue[num_inactive_char++] = w - stp->num_species_orig;
-                        } else
-                                if (graph_degree(stp->red_black, w) > max_degree_active) {
-                                        max_degree_active = graph_degree(stp->red_black, w);
+                                lp->character_queue[num_inactive_char++] = character;
+                        } else if (max_degree_active < smallest_num_species) {
+                                uint32_t degree = graph_degree(stp->red_black, w);
+                                if (degree > max_degree_active) {
+                                        max_degree_active = degree;
                                         maximum_active_char = character;
                                 }
+                        }
                 }
-        stp->character_queue_size = num_inactive_char;
+        lp->character_queue_size = num_inactive_char;
+        lp->character_queue_first = 0;
         log_array_uint32_t("card", card, stp->red_black->num_vertices);
         log_array_uint32_t("card_species", card_species, stp->red_black->num_vertices);
         log_array_uint8_t("stp->colors", stp->colors, stp->num_characters_orig);
         log_array_uint32_t("stp->connected_components", stp->connected_components, stp->num_species_orig + stp->num_characters_orig);
         log_debug("maximum_char: %d max_degree: %d", maximum_active_char, max_degree_active);
-        log_array_uint32_t("character_queue", stp->character_queue, stp->character_queue_size);
+        log_array_uint32_t("character_queue", lp->character_queue, lp->character_queue_size);
 
 /* Put the character with maximum degree in front of
-   stp->character_queue */
+   lp->character_queue */
 
         if (smallest_num_species > 0 && smallest_num_species == max_degree_active) {
-                stp->character_queue_size++;
-                stp->character_queue[num_inactive_char] = stp->character_queue[0];
-                stp->character_queue[0] = maximum_active_char;
+                lp->character_queue_size++;
+                lp->character_queue[num_inactive_char] = lp->character_queue[0];
+                lp->character_queue[0] = maximum_active_char;
         }
-        log_debug("character_queue_size: %d", stp->character_queue_size);
-        log_array_uint32_t("character_queue", stp->character_queue, stp->character_queue_size);
+        log_debug("character_queue_size: %d", lp->character_queue_size);
+        log_array_uint32_t("character_queue", lp->character_queue, lp->character_queue_size);
+        TIMER_STOP(stp, smallest_component, start);
         log_debug("smallest_component: end");
 }
 
+/**
+   \brief check that the conflict graph is up to date
+*/
+static void
+check_conflict_graph(const state_s* stp) {
+#ifdef DEBUG
+        columns_view_s view;
+        columns_view(stp, &view);
+        for (uint32_t c1 = 0; c1 < stp->num_characters_orig; c1++)
+                for (uint32_t c2 = c1 + 1; c2 < stp->num_characters_orig; c2++)
+                        if (graph_get_edge(stp->conflict, c1, c2) !=
+                            (inactive(stp, c1) && inactive(stp, c2) && four_gametes(stp, &view, c1, c2))) {
+                                log_debug("check_conflict_graph: %d %d", c1, c2);
+                                assert(false);
+                        }
+#endif
+}
+
+/**
+   Instead of removing all edges and recomputing the conflict graph, only
+   the edges whose status has changed are flipped, so that the undo log
+   records exactly the difference.
+   Only the pairs of current inactive characters are tested, since all
+   other characters are isolated.
+*/
 void
 update_conflict_graph(state_s* stp) {
         log_debug("update_conflict_graph");
         graph_pp(stp->conflict);
-        graph_nuke_edges(stp->conflict);
-        log_debug("update_conflict_graph: nuked edges");
-        graph_pp(stp->conflict);
-        for(uint32_t c1 = 0; c1 < stp->num_characters; c1++)
-                for(uint32_t c2 = c1 + 1; c2 < stp->num_characters; c2++) {
-                        uint32_t states[2][2] = { {0, 0}, {0, 0} };
-                        for(uint32_t s=0; s < stp->num_species; s++)
-                                states[matrix_get_value(stp, s, c1)][matrix_get_value(stp, s, c2)] = 1;
-                        if(states[0][0] + states[0][1] + states[1][0] + states[1][1] == 4)
-                                graph_add_edge(stp->conflict, c1, c2);
+        double start = timer_start(stp);
+        uint32_t m = stp->num_characters_orig;
+        uint32_t *chars = stp->workspace.vertices;
+        uint32_t size = 0;
+        for (uint32_t c1 = 0; c1 < m; c1++) {
+                if (inactive(stp, c1)) {
+                        chars[size++] = c1;
+                        continue;
                 }
+                for (uint32_t c2 = graph_next_neighbour(stp->conflict, c1, 0); c2 < m; c2 = graph_next_neighbour(stp->conflict, c1, c2 + 1))
+                        flip_conflict_edge(stp, c1, c2);
+        }
+        columns_view_s view;
+        columns_view(stp, &view);
+        for (uint32_t i = 0; i < size; i++)
+                for (uint32_t j = i + 1; j < size; j++) {
+                        uint32_t c1 = chars[i], c2 = chars[j];
+                        if (four_gametes(stp, &view, c1, c2) != graph_get_edge(stp->conflict, c1, c2))
+                                flip_conflict_edge(stp, c1, c2);
+                }
+        TIMER_STOP(stp, conflict_graph, start);
         log_debug("update_conflict_graph: end");
         graph_pp(stp->conflict);
+        check_conflict_graph(stp);
+}
+
+/**
+   All edges of the conflict graph are between current characters, hence
+   only the current characters are visited.
+*/
+void
+update_conflict_graph_realization(state_s* stp, uint32_t character, bool species_deleted) {
+        log_debug("update_conflict_graph_realization: %d %d", character, species_deleted);
+        uint32_t m = stp->num_characters_orig;
+        double start = timer_start(stp);
+        if (!inactive(stp, character))
+                for (uint32_t c = graph_next_neighbour(stp->conflict, character, 0); c < m; c = graph_next_neighbour(stp->conflict, character, c + 1))
+                        flip_conflict_edge(stp, character, c);
+        if (species_deleted) {
+                columns_view_s view;
+                columns_view(stp, &view);
+                for (uint32_t c1 = bitmap_next_bit(stp->characters, 0, m); c1 < m; c1 = bitmap_next_bit(stp->characters, c1 + 1, m))
+                        for (uint32_t c2 = graph_next_neighbour(stp->conflict, c1, c1 + 1); c2 < m; c2 = graph_next_neighbour(stp->conflict, c1, c2 + 1))
+                                if (!four_gametes(stp, &view, c1, c2))
+                                        flip_conflict_edge(stp, c1, c2);
+        }
+        TIMER_STOP(stp, conflict_graph, start);
+        log_debug("update_conflict_graph_realization: end");
+        graph_pp(stp->conflict);
+        check_conflict_graph(stp);
 }
 
+/**
+   The components are recomputed from scratch, but only the labels that
+   have changed are recorded in the undo log.
+*/
 void
 update_connected_components(state_s* stp) {
         log_debug("update_connected_components. stp=%p", stp);
-        connected_components(stp->red_black, stp->connected_components);
+        double start = timer_start(stp);
+        uint32_t n = stp->red_black->num_vertices;
+        uint32_t *components = stp->workspace.vertices;
+        connected_components(stp->red_black, components, stp->workspace.rows);
+        for (uint32_t v = 0; v < n; v++)
+                set_component(stp, v, components[v]);
+        TIMER_STOP(stp, components, start);
         log_array_uint32_t("stp->connected_components", stp->connected_components, stp->red_black->num_vertices);
         log_debug("update_connected_components: end");
 }
 
-// From 21st Century C
-#define Sasprintf(write_to, ...) {                              \
-                char *tmp_string_for_extend = (write_to);       \
-                if (-1 == asprintf(&(write_to), __VA_ARGS__))   \
-                        exit(1);                                \
-                free(tmp_string_for_extend);                    \
+/**
+   The vertices of \c component are visited in increasing order, so that the
+   first vertex of each new connected component is its label.
+   Only the vertices of \c component are relabeled.
+*/
+void
+update_component(state_s* stp, const bitmap_word* component) {
+        log_debug("update_component. stp=%p", stp);
+        double start = timer_start(stp);
+        uint32_t n = stp->red_black->num_vertices;
+        uint32_t words = stp->red_black->row_words;
+        bitmap_word *todo = stp->workspace.rows;
+        bitmap_word *reached = todo + words;
+        bitmap_copy(todo, component, n);
+        for (uint32_t v = bitmap_next_bit(todo, 0, n); v < n; v = bitmap_next_bit(todo, v + 1, n)) {
+                graph_reachable_bitmap(stp->red_black, v, reached, reached + words);
+                assert(bitmap_includes(reached, todo, n));
+                for (uint32_t w = bitmap_next_bit(reached, v, n); w < n; w = bitmap_next_bit(reached, w + 1, n))
+                        set_component(stp, w, v);
+                bitmap_difference(todo, todo, reached, n);
         }
+        TIMER_STOP(stp, components, start);
+        log_array_uint32_t("stp->connected_components", stp->connected_components, stp->red_black->num_vertices);
+        log_debug("update_component: end");
+}
 
-static char*
-newick_levels(state_s* states, uint32_t first, uint32_t last) {
-        char* result = NULL;
+/*
+  Appends to sb the tree of the levels [first:last]. The whole tree is
+  written in a single pass: the parentheses enclosing a subtree are
+  written before it, since their number is known in advance.
+*/
+static void
+newick_levels(strbuf_s* sb, level_s* levels, uint32_t nvertices, uint32_t first, uint32_t last) {
         log_debug("newick_levels: %d %d", first, last);
-        if (first > last) {
-                result = strdup("");
-                return result;
-        }
-        state_s* cur = states + first;
+        if (first > last)
+                return;
+        level_s* cur = levels + first;
 // check if all red-black graphs in the states [first:last]
 // are subgraph of the current connected component of the
 // first state.
 // In that case, we are solving a single connected component
 // of the red-black graph.
-        if (bool_array_includes(cur->current_component, (states + last)->current_component, cur->red_black->num_vertices)) {
+        if (bitmap_includes((levels + last)->current_component, cur->current_component, nvertices)) {
 // A single connected component
                 log_debug("newick_levels: 1 component. %d %d", first, last);
                 char sign = (cur->operation == 1) ? '+' : '-';
-                if (first == last) {
-// we are in a leaf of the tree
-                        Sasprintf(result, ":C%04u%c", cur->realize, sign);
-                } else {
-                        Sasprintf(result, "(%s:C%04u%c)", newick_levels(states, first + 1, last), cur->realize, sign);
+/*
+  The duplicates realized together with cur->realize form a path of edges
+  below it: the deepest one is the last duplicate. Each edge encloses the
+  edges below it, except the deepest edge of a leaf of the tree, that is
+  when the components obtained after the realization have not been solved
+  separately.
+*/
+                bool leaf = (first == last && cur->subtrees == NULL);
+                for (uint32_t i = 0; i < cur->twins_size + !leaf; i++)
+                        strbuf_putc(sb, '(');
+                if (first < last) {
+                        newick_levels(sb, levels, nvertices, first + 1, last);
+                } else if (cur->subtrees != NULL) {
+                        strbuf_putc(sb, '(');
+                        strbuf_puts(sb, cur->subtrees);
+                        strbuf_putc(sb, ')');
+                }
+                for (uint32_t i = cur->twins_size + 1; i-- > 0; ) {
+                        uint32_t c = (i > 0) ? cur->twins[i - 1] : cur->realize;
+                        strbuf_printf(sb, ":C%04u%c", c, sign);
+                        if (!leaf || i < cur->twins_size)
+                                strbuf_putc(sb, ')');
                 }
         } else {
 // More connected components: recurse on each single
@@ -766,51 +1669,312 @@ newick_levels(state_s* states, uint32_t first, uint32_t last) {
 // cur_first: first index of the current component
 // cur_last: last index of the current component
                 uint32_t cur_first = first;
+                strbuf_putc(sb, '(');
                 if (cur_first < last) {
                         uint32_t cur_last = cur_first + 1;
                         for (;cur_last <= last; cur_last++) {
-                                if (!bool_array_includes((states + cur_first)->current_component,
-                                                         (states + cur_last)->current_component, cur->red_black->num_vertices))
+                                if (!bitmap_includes((levels + cur_last)->current_component,
+                                                     (levels + cur_first)->current_component, nvertices))
                                         break;
                         }
                         cur_last -= 1;
                         log_debug("newick_levels: more components. %d:%d (%d:%d)", cur_first, cur_last, first, last);
                         if (cur_last >= last) {
-                                Sasprintf(result, "%s", newick_levels(states, cur_first, cur_last));
+                                newick_levels(sb, levels, nvertices, cur_first, cur_last);
                         } else {
-                                char* tmp1 = NULL;
-                                Sasprintf(tmp1, "%s", newick_levels(states, cur_last + 1, last));
-                                char* tmp2 = NULL;
-                                Sasprintf(tmp2, "%s", newick_levels(states, cur_first, cur_last));
-                                Sasprintf(result, "%s,%s", tmp1, tmp2);
-                                free(tmp1);
-                                free(tmp2);
+                                newick_levels(sb, levels, nvertices, cur_last + 1, last);
+                                strbuf_putc(sb, ',');
+                                newick_levels(sb, levels, nvertices, cur_first, cur_last);
                         }
                 }
                 log_debug("newick_levels: completed more components. %d:%d", first, last);
-                Sasprintf(result, "(%s)", result);
+                strbuf_putc(sb, ')');
         }
-        log_debug("newick_levels: completed %s", result);
-
-        return result;
 }
 
-
-char*
-newick(state_s* states) {
+void
+newick_append(strbuf_s* sb, const state_s* stp, level_s* levels) {
+        uint32_t nvertices = stp->red_black->num_vertices;
         uint32_t final_level = 0;
         log_debug("dump_states");
-        while ((states + final_level)->num_species > 0) {
-                log_debug("%4d | %4d ", final_level, (states + final_level)->realize);
-                log_array_bool("Component.",  (states + final_level)->current_component, (states + final_level)->red_black->num_vertices);
+        while ((levels + final_level)->num_species > 0) {
+                log_debug("%4d | %4d ", final_level, (levels + final_level)->realize);
+                final_level += 1;
+        }
+        if (final_level == 0) {
+                if (levels->subtrees != NULL)
+                        strbuf_puts(sb, levels->subtrees);
+                return;
+        }
+        newick_levels(sb, levels, nvertices, 0, final_level - 1);
+}
+
+void
+free_subtrees(level_s* levels) {
+        uint32_t final_level = 0;
+        while ((levels + final_level)->num_species > 0)
                 final_level += 1;
+        for (uint32_t l = 0; l < final_level || l == 0; l++)
+                if ((levels + l)->subtrees != NULL) {
+                        xfree((levels + l)->subtrees);
+                        (levels + l)->subtrees = NULL;
+                }
+}
+
+char*
+newick_subtree(const state_s* stp, level_s* levels) {
+        strbuf_s sb;
+        strbuf_init(&sb);
+        newick_append(&sb, stp, levels);
+        if (sb.data == NULL)
+                strbuf_append(&sb, "", 0);
+        log_debug("newick_subtree: result %s", sb.data);
+        return sb.data;
+}
+
+char*
+newick(const state_s* stp, level_s* levels) {
+        strbuf_s sb;
+        strbuf_init(&sb);
+        newick_append(&sb, stp, levels);
+        strbuf_putc(&sb, ';');
+        log_debug("newick: result %s", sb.data);
+        return sb.data;
+}
+
+/*
+  The edge of the character c, preceded by the path of the duplicates
+  collapsed into c: the subtree written between the two calls, if any,
+  hangs below the deepest duplicate.
+*/
+static void
+gain_edge(strbuf_s* sb, const state_s* stp, uint32_t c, bool below, bool open) {
+        uint32_t *chain = stp->workspace.chain;
+        uint32_t size = 0;
+        for (; c != -1; c = stp->twin[c])
+                chain[size++] = c;
+        if (open) {
+                for (uint32_t i = 0; i < size - 1 + below; i++)
+                        strbuf_putc(sb, '(');
+                return;
+        }
+        for (uint32_t i = size; i-- > 0; ) {
+                strbuf_printf(sb, ":C%04u+", chain[i]);
+                if (below || i < size - 1)
+                        strbuf_putc(sb, ')');
+        }
+}
+
+/*
+  The trees of the columns, each one the list of the children of a
+  column, in the same order as the siblings: first_child and next_sibling
+  are -1 at the end of a list.
+*/
+typedef struct column_tree_s {
+        const uint32_t* first_child;
+        const uint32_t* next_sibling;
+        const uint32_t* children;
+        edge_fn edge;
+        const void* data;
+} column_tree_s;
+
+static void
+column_forest(strbuf_s* sb, const column_tree_s* tp, uint32_t first, bool enclose);
+
+static void
+column_subtree(strbuf_s* sb, const column_tree_s* tp, uint32_t c) {
+        bool below = (tp->first_child[c] != -1);
+        tp->edge(sb, tp->data, c, below, true);
+        if (below)
+                column_forest(sb, tp, tp->first_child[c], tp->children[c] > 1);
+        tp->edge(sb, tp->data, c, below, false);
+}
+
+static void
+column_forest(strbuf_s* sb, const column_tree_s* tp, uint32_t first, bool enclose) {
+        if (enclose)
+                strbuf_putc(sb, '(');
+        for (uint32_t c = first; c != -1; c = tp->next_sibling[c]) {
+                if (c != first)
+                        strbuf_putc(sb, ',');
+                column_subtree(sb, tp, c);
+        }
+        if (enclose)
+                strbuf_putc(sb, ')');
+}
+
+bool
+phylogeny_from_columns(strbuf_s* sb, const workspace_s* ws, const bitmap_word** columns, uint32_t num_columns,
+                       uint32_t num_species, edge_fn edge, const void* data, bool enclose) {
+        if (num_columns == 0)
+                return false;
+        uint32_t *order = ws->tree;
+        uint32_t *size = order + num_columns;
+        uint32_t *parent = size + num_columns;
+        uint32_t *first_child = parent + num_columns;
+        uint32_t *next_sibling = first_child + num_columns;
+        uint32_t *children = next_sibling + num_columns;
+        uint32_t *count = children + num_columns;
+        memset(count, 0, (num_species + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < num_columns; i++) {
+                size[i] = bitmap_popcount(columns[i], num_species);
+                count[size[i]]++;
+        }
+/*
+  counting sort of the columns by nonincreasing number of species
+*/
+        for (uint32_t k = num_species, pos = 0; k != -1; k--) {
+                uint32_t tmp = count[k];
+                count[k] = pos;
+                pos += tmp;
+        }
+        for (uint32_t i = 0; i < num_columns; i++)
+                order[count[size[i]]++] = i;
+/*
+  Each species must have the columns of a path from the root: the
+  parent of each column is the previous one in the order, and it must be
+  the same for all species.
+  unset and root are respectively -2 and -1.
+*/
+        for (uint32_t i = 0; i < num_columns; i++)
+                parent[i] = -2;
+        for (uint32_t s = 0; s < num_species; s++) {
+                uint32_t prev = -1;
+                for (uint32_t i = 0; i < num_columns; i++) {
+                        uint32_t c = order[i];
+                        if (!(BITMAP_WORD(columns[c], s) & BITMAP_BIT_MASK(s)))
+                                continue;
+                        if (parent[c] == -2)
+                                parent[c] = prev;
+                        else if (parent[c] != prev)
+                                return false;
+                        prev = c;
+                }
+        }
+/*
+  Link each column to its parent: the siblings, and the roots, are listed
+  from the last one in the order.
+*/
+        uint32_t roots = -1;
+        uint32_t num_trees = 0;
+        for (uint32_t i = 0; i < num_columns; i++) {
+                first_child[i] = -1;
+                children[i] = 0;
+        }
+        for (uint32_t i = 0; i < num_columns; i++) {
+                uint32_t c = order[i];
+                assert(parent[c] != -2);
+                uint32_t* head = (parent[c] == -1) ? &roots : first_child + parent[c];
+                next_sibling[c] = *head;
+                *head = c;
+                if (parent[c] == -1)
+                        num_trees++;
+                else
+                        children[parent[c]]++;
+        }
+        column_tree_s tree = {
+                .first_child = first_child,
+                .next_sibling = next_sibling,
+                .children = children,
+                .edge = edge,
+                .data = data
+        };
+        column_forest(sb, &tree, roots, enclose && num_trees > 1);
+        return true;
+}
+
+/*
+  The columns of perfect_phylogeny_forest are the characters listed in
+  data.
+*/
+typedef struct forest_data_s {
+        const state_s* stp;
+        const uint32_t* characters;
+} forest_data_s;
+
+static void
+character_edge(strbuf_s* sb, const void* data, uint32_t column, bool below, bool open) {
+        const forest_data_s* fp = data;
+        gain_edge(sb, fp->stp, fp->characters[column], below, open);
+}
+
+char*
+perfect_phylogeny_forest(const state_s* stp, bool enclose) {
+        uint32_t n = stp->num_species_orig;
+        uint32_t m = stp->num_characters_orig;
+        uint32_t *characters = stp->workspace.labels;
+        const bitmap_word **columns = stp->workspace.columns;
+        uint32_t size = 0;
+        for (uint32_t c = 0; c < m; c++)
+                if (bitmap_get_bit(stp->characters, c)) {
+                        if (!inactive(stp, c))
+                                return NULL;
+/*
+  The red-black graph is bipartite, hence the first species_words words of
+  the neighbourhood of a character contain only species.
+*/
+                        characters[size] = c;
+                        columns[size++] = graph_neighbourhood(stp->red_black, n + c);
+                }
+        forest_data_s data = { .stp = stp, .characters = characters };
+        strbuf_s sb;
+        strbuf_init(&sb);
+        if (!phylogeny_from_columns(&sb, &(stp->workspace), columns, size, n, character_edge, &data, enclose))
+                return NULL;
+        log_debug("perfect_phylogeny_forest: %s", sb.data);
+        return sb.data;
+}
+
+bool
+red_sigma_graph(const state_s* stp) {
+        uint32_t n = stp->num_species_orig;
+        uint32_t *red = stp->workspace.vertices;
+        uint32_t size = 0;
+        for (uint32_t c = 0; c < stp->num_characters_orig; c++)
+                if (bitmap_get_bit(stp->characters, c) && stp->colors[c] == RED)
+                        red[size++] = c;
+/*
+  The red-black graph is bipartite, hence the first species_words words of
+  the neighbourhood of a character contain only species.
+*/
+        for (uint32_t i = 0; i < size; i++) {
+                const bitmap_word* a = graph_neighbourhood(stp->red_black, n + red[i]);
+                for (uint32_t j = i + 1; j < size; j++) {
+                        const bitmap_word* b = graph_neighbourhood(stp->red_black, n + red[j]);
+                        bool common = false, only_a = false, only_b = false;
+                        for (uint32_t w = 0; w < stp->species_words; w++) {
+                                common |= (a[w] & b[w]) != 0;
+                                only_a |= (a[w] & ~b[w]) != 0;
+                                only_b |= (b[w] & ~a[w]) != 0;
+                        }
+                        if (common && only_a && only_b) {
+                                log_debug("red_sigma_graph: characters %d %d", red[i], red[j]);
+                                return true;
+                        }
+                }
+        }
+        return false;
+}
+
+uint32_t
+realizations_lower_bound(const state_s* stp) {
+        uint32_t m = stp->num_characters_orig;
+        bitmap_word *matched = stp->workspace.rows;
+        bitmap_zero(matched, m);
+        uint32_t bound = stp->num_characters;
+/*
+  Only inactive characters have conflicts
+*/
+        for (uint32_t c1 = 0; c1 < m; c1++) {
+                if (!bitmap_get_bit(stp->characters, c1) || bitmap_get_bit(matched, c1))
+                        continue;
+                for (uint32_t c2 = graph_next_neighbour(stp->conflict, c1, c1 + 1); c2 < m; c2 = graph_next_neighbour(stp->conflict, c1, c2 + 1))
+                        if (!bitmap_get_bit(matched, c2)) {
+                                bitmap_set_bit(matched, c1);
+                                bitmap_set_bit(matched, c2);
+                                bound++;
+                                break;
+                        }
         }
-        char* tmp = NULL;
-        Sasprintf(tmp, "%s;", newick_levels(states, 0, final_level -1));
-        log_debug("newick: tmp %s", tmp);
-        char* result = GC_MALLOC((strlen(tmp) + 1) * sizeof(char));
-        strncpy(result, tmp, strlen(tmp) + 1);
-        log_debug("newick: result %s", result);
-        free(tmp);
-        return result;
+        return bound;
 }
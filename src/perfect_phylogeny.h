@@ -50,64 +50,244 @@
 #define RED   2
 #define MAX_COLOR 2
 /**
-   \struct state_s
-   \brief an instance and the
-   possible completions that have
-   been already tried
-
-   It stores everything that is necessary to construct the final phylogeny and
-   to determine the next step of the strategy.
+   \struct change_s
+   \brief an entry of the undo log of a state
+
+   Each entry records a single elementary modification of a state, with
+   enough information to revert it:
+
+   CHANGE_RED_BLACK_EDGE => the edge (a,b) of the red-black graph has been flipped
+   CHANGE_CONFLICT_EDGE  => the edge (a,b) of the conflict graph has been flipped
+   CHANGE_COLOR          => the color of character a was b
+   CHANGE_SPECIES        => the species a has been deleted
+   CHANGE_CHARACTER      => the character a has been deleted
+   CHANGE_COMPONENT      => the connected component of vertex a was b
+   CHANGE_TWIN           => the duplicate following character a was b
+*/
+#define CHANGE_RED_BLACK_EDGE 0
+#define CHANGE_CONFLICT_EDGE  1
+#define CHANGE_COLOR          2
+#define CHANGE_SPECIES        3
+#define CHANGE_CHARACTER      4
+#define CHANGE_COMPONENT      5
+#define CHANGE_TWIN           6
+
+typedef struct change_s {
+        uint32_t type;
+        uint32_t a;
+        uint32_t b;
+} change_s;
 
-   It consists of \c instance, \c realized_char, \c
-   tried_chars, and \c character_queue which are respectively the current
-   instance, the character to realize and the list of characters
-   that we have previously tried to realize and the candidate
-   characters left.
+/**
+   \struct state_times_s
+   \brief the time, in nanoseconds, spent in \c realize_character, in the
+   updates of the conflict graph and of the connected components, and in
+   \c smallest_component.
 
-   Notice that the last character in \c tried_characters is equal to \c realized_char
+   The updates performed by \c realize_character are counted both in
+   \c realize and in their own field.
+*/
+typedef struct state_times_s {
+        uint64_t realize;
+        uint64_t conflict_graph;
+        uint64_t components;
+        uint64_t smallest_component;
+} state_times_s;
 
-   The \c matrix field can be \c NULL, if we are not interested in the matrix
-   any more.
+/**
+   \struct workspace_s
+   \brief the scratch buffers borrowed by the operations on a state
+
+   They are carved by \c init_state with the other arrays of the state,
+   hence they are sized once per instance, and each state, that is each
+   search and each task of a parallel search, has its own. Their content is
+   meaningless between two operations, hence they are never copied, and
+   they can be borrowed through a \c const state.
+
+   \c rows are \c WORKSPACE_ROWS bitmaps of the vertices of the red-black
+   graph, enough for \c connected_components. \c vertices, \c keys and
+   \c hashes have an entry for each vertex, and \c words has an entry for
+   each word of the bitmap of the species.
+   \c columns has an entry for each column of the extended matrix, that has
+   two columns for each character, and \c labels has an entry for each such
+   column and for each species: they are the columns of the phylogeny built
+   by \c phylogeny_from_columns and their labels, or the components solved
+   separately. \c tree has \c WORKSPACE_TREE_ARRAYS entries for each column
+   of the extended matrix and one for each number of species, for
+   \c phylogeny_from_columns itself, \c chain has an entry for each
+   character and \c results has an entry for each vertex.
+   A function that borrows a buffer never calls another function that
+   borrows the same buffer.
+*/
+#define WORKSPACE_ROWS GRAPH_COMPONENTS_ROWS
+#define WORKSPACE_TREE_ARRAYS 6
+typedef struct workspace_s {
+        bitmap_word *rows;
+        uint32_t *vertices;
+        int64_t *keys;
+        void *hashes;
+        uint32_t *words;
+        const bitmap_word **columns;
+        uint32_t *labels;
+        uint32_t *tree;
+        uint32_t *chain;
+        char **results;
+} workspace_s;
 
-   \c current_component contains the current connected component of
-   the red-black graph. It is used to solve separately each connected
-   component by a careful managing of the backtracking
+/**
+   \struct state_s
+   \brief an instance of the problem
 
+   A single state is modified in place during the whole search:
+   each modification is recorded in the undo log \c log, so that the
+   state of any previous node of the decision tree can be restored with
+   \c state_undo.
 
-   \c species and \c characters are two arrays whose values are 1 for the actual species and characters
-   respectively.
+   The \c matrix field can be \c NULL, if we are not interested in the matrix
+   any more.
+   \c columns stores each column of the input matrix as a bitmap of
+   \c species_words words over the species. Both \c matrix and \c columns
+   are never modified, hence they are shared among copies of a state.
 
-   \c operation is the code for the most recent operation:
-   0 => failure
-   1 => realize an inactive character
-   2 => realize an active character
+   \c species and \c characters are two bitmaps whose bits are set for the
+   actual species and characters respectively.
 
    the \c color of each character encodes if it is active or not.
    The possible values are:
    BLACK => the character is inactive
    RED   => the character is active
+
+   \c connected_components labels each vertex of the red-black graph with the
+   smallest vertex of its connected component. For each such label,
+   \c component_size and \c component_species are the number of vertices and
+   of species of the connected component (they are 0 for all other values).
+
+   If \c collapse_duplicates is \c true, \c cleanup deletes each species and
+   each character that is a duplicate of another one, that is, a vertex of the
+   red-black graph with the same neighbourhood (and the same color, for a
+   character) of a vertex with a smaller id.
+   A deleted duplicate character follows the character that it duplicates in
+   all subsequent realizations: \c twin[c] is the next character of the list
+   of duplicates following \c c, or -1. Species do not appear in the trees,
+   hence deleted duplicate species are not recorded.
+
+   If \c direct_phylogeny is \c true, the search builds directly, with
+   \c perfect_phylogeny_forest, the phylogeny of each instance that does not
+   need any loss, instead of exploring its decision tree.
+
+   \c fingerprint is a Zobrist hash of the species, the characters, the colors
+   and the edges of the red-black graph, that is of everything that
+   determines whether the instance has a solution. It is updated
+   incrementally by each modification of the state, and by \c state_undo.
+
+   If \c times is not \c NULL, the time spent in the main operations on the
+   state is added to it. It belongs to a single state, hence it is not
+   copied, just as \c workspace.
+
+   All arrays of a state are allocated in \c arena, or in the heap if
+   \c arena is \c NULL. The vertex and character arrays are carved from a
+   single block, each one aligned to a cache line, so that the loops over
+   the vertices touch contiguous memory.
 */
 typedef struct state_s {
         graph_s *red_black;
         graph_s *conflict;
-        bool *species;
-        bool *characters;
+        bitmap_word *species;
+        bitmap_word *characters;
         uint32_t *connected_components;
+        uint32_t *component_size;
+        uint32_t *component_species;
         uint32_t num_species;
         uint32_t num_characters;
         uint32_t num_species_orig;
         uint32_t num_characters_orig;
         uint8_t  *colors;
+        uint32_t *matrix;
+        bitmap_word *columns;
+        uint32_t species_words;
+        change_s *log;
+        uint32_t log_size;
+        uint32_t log_capacity;
+        arena_s *arena;
+        uint64_t fingerprint[2];
+        bool collapse_duplicates;
+        bool direct_phylogeny;
+        uint32_t *twin;
+        state_times_s *times;
+        workspace_s workspace;
+} state_s;
+
+/**
+   \struct level_s
+   \brief a node of the decision tree, that is the possible completions that
+   have been already tried at a given level.
+
+   It stores everything that is necessary to construct the final phylogeny and
+   to determine the next step of the strategy, while the instance itself is
+   stored only once in a \c state_s.
+
+   \c tried_characters and \c character_queue are respectively the list of
+   characters that we have previously tried to realize and the candidate
+   characters left: these are the \c character_queue_size characters of
+   \c character_queue starting from \c character_queue_first, so that
+   taking the next character only advances \c character_queue_first.
+   Notice that the last character in \c tried_characters is equal to \c realize
+
+   \c current_component is the bitmap of the current connected component of
+   the red-black graph, over all its vertices. It is used to solve separately each connected
+   component by a careful managing of the backtracking
+
+   \c characters (a bitmap) and \c num_species are the set of characters
+   and the number of species of the instance when the node has been reached.
+
+   \c log_mark is the size of the undo log of the state when the node has been
+   reached: reverting the log up to \c log_mark restores the instance of this
+   node.
+
+   \c fingerprint is the fingerprint of the instance when the node has been
+   reached.
+
+   \c twins are the \c twins_size duplicates of \c realize that have been
+   realized together with \c realize, in that order.
+
+   \c operation is the code for the most recent operation:
+   0 => failure
+   1 => realize an inactive character
+   2 => realize an active character
+
+   \c subtrees is not \c NULL only if the realization of \c realize has
+   split the current component, and each resulting component has been solved
+   separately: in that case it contains the comma-separated list of the trees
+   of such components, that are children of the edge labeled by \c realize.
+   The same holds when the instance left after the realization has been
+   solved directly by \c perfect_phylogeny_forest.
+   If the instance has been solved directly at the root, then the first level
+   has no species and its \c subtrees is the whole tree.
+   The string is owned by the stack of the solution, and it is freed by
+   \c free_subtrees once the tree has been written.
+
+   All arrays of a node are carved from \c slab, whose size depends only on
+   the size of the instance, hence copying a node copies a single block.
+*/
+typedef struct level_s {
         uint32_t *tried_characters;
         uint32_t *character_queue;
         uint32_t tried_characters_size;
         uint32_t character_queue_size;
-        bool *current_component;
-        uint32_t *matrix;
+        uint32_t character_queue_first;
+        bitmap_word *current_component;
+        bitmap_word *characters;
+        uint32_t num_species;
         uint32_t operation;
         uint32_t realize;
         uint32_t backtrack_level;
-} state_s;
+        uint32_t log_mark;
+        char *subtrees;
+        uint64_t fingerprint[2];
+        uint32_t *twins;
+        uint32_t twins_size;
+        void *slab;
+} level_s;
 
 /**
    \struct array_s
@@ -121,22 +301,64 @@ typedef struct array_s {
 /**
    \brief managing states:
    \c init_state is used only at the very beginning and allocates the
-   memory that is required and gives the correct values to
+   memory that is required in the arena \c ap (or in the heap, if \c ap is
+   \c NULL) and gives the correct values to
    \c num_species_orig and \c num_characters_orig
 
    \c resize_state sets the values of \c num_species and \c num_characters
 */
-void init_state(state_s *stp, uint32_t nspecies, uint32_t nchars);
+void init_state(state_s *stp, uint32_t nspecies, uint32_t nchars, arena_s *ap);
 
 void
 resize_state(state_s *stp, uint32_t nspecies, uint32_t nchars);
 
+/**
+   \brief allocates, in the arena \c ap, a node of the decision tree for an
+   instance with \c nspecies species and \c nchars characters
+*/
+void
+init_level(level_s *lp, uint32_t nspecies, uint32_t nchars, arena_s *ap);
+
+/**
+   \brief allocates, in the arena \c ap, all nodes of a decision tree for an
+   instance with \c nspecies species and \c nchars characters, that is
+   \c nspecies + 2 \c nchars + 2 nodes, whose slabs are consecutive
+*/
+level_s *
+new_levels(uint32_t nspecies, uint32_t nchars, arena_s *ap);
+
+/**
+   \brief copy a node of the decision tree. Both nodes must have been
+   allocated by \c init_level with the same \c nspecies and \c nchars
+*/
+void
+copy_level(level_s *dst, const level_s *src, uint32_t nspecies, uint32_t nchars);
+
+/**
+   \brief reverts all changes recorded in the undo log of \c stp after
+   position \c mark, in reverse order.
+
+   At the end, the size of the log is equal to \c mark.
+*/
+void
+state_undo(state_s *stp, uint32_t mark);
+
 /**
    \brief check if a state is internally consistent
 
-   \return \c true if all check have been passed
+   Without DEBUG, only the pointers to the graphs are checked, so that the
+   calls on the hot path vanish when NDEBUG is also defined.
 */
+#ifdef DEBUG
 void check_state(const state_s* stp);
+#else
+static inline void
+check_state(const state_s* stp) {
+        assert(stp->red_black != NULL);
+        graph_check(stp->red_black);
+        graph_check(stp->conflict);
+}
+#endif
 
 /**
    \brief simplify the current instance, if possible
@@ -148,28 +370,43 @@ void check_state(const state_s* stp);
    original instance. More precisely:
 
    * we remove all isolated vertices of the red-black graph
-   * we remove duplicated characters
-   * we remove duplicated species
+   * we remove duplicated species, if \c src->collapse_duplicates
+   * we remove duplicated characters, if \c src->collapse_duplicates
 
-   Notice that at each function, at most one of those operations is performed,
-   therefore it is necessary to include this function in a \c while loop to
-   completely simplify the instance
+   Removing a duplicate cannot create new isolated vertices or new
+   duplicates, therefore a single call completely simplifies the instance.
 */
 void cleanup(state_s *src);
 
 /**
    \brief copy a state
 
-   The \c characters_queue and the \c tried_characters are not copied.
-   To copy also those fields, use the \c full_copy_state function.
+   The undo log is not copied: the destination starts with an empty log.
    The destination must have already been allocated
 
 */
 void
 copy_state(state_s* dst, const state_s* src);
 
+/**
+   \brief same as \c copy_state, but the undo log is copied too, so that the
+   destination can be reverted to any node that has been reached by the
+   source.
+*/
 void
-full_copy_state(state_s* dst, const state_s* src);
+fork_state(state_s* dst, const state_s* src);
+
+/**
+   \brief copy into \c dst only the connected component of the red-black
+   graph of \c src that is labeled \c label.
+
+   All species and characters that are not in such component are deleted,
+   as well as all edges that are not in the component.
+   The destination must have already been allocated, and starts with an
+   empty undo log.
+*/
+void
+copy_component(state_s* dst, const state_s* src, uint32_t label);
 
 
 /**
@@ -192,6 +429,19 @@ write_state(const char* filename, state_s* stp);
 uint32_t
 characters_list(state_s * stp, uint32_t *array);
 
+/**
+   \brief computes from scratch the fingerprint of the state \c stp
+*/
+void
+state_fingerprint(const state_s* stp, uint64_t fingerprint[2]);
+
+/**
+   \brief the value of the species \c s and the character \c c in the input
+   matrix
+*/
+uint32_t
+matrix_get_value(const state_s *stp, uint32_t s, uint32_t c);
+
 /**
    \brief delete a species from the set of current species
 */
@@ -204,12 +454,68 @@ void delete_character(state_s* stp, uint32_t c);
 
 /**
    \struct data common to all instances in a file
+
+   \c arena, if it is not \c NULL, contains the instance that has been
+   read most recently.
+
+   The file is read in chunks of \c READ_BUFFER_SIZE bytes, stored in
+   \c buffer: \c buffer_position is the first byte of the chunk that has
+   not been parsed yet, and \c buffer_length is the size of the chunk.
+
+   Only the instances whose index (starting from 0) is at least
+   \c first_instance and smaller than \c last_instance are read;
+   \c next_instance is the index of the next instance of the file.
+
+   \c binary is \c true if the file is in the binary format, and in that
+   case \c num_instances is the number of instances stored in the file.
+
+   \c collapse_duplicates and \c direct_phylogeny are copied into each
+   instance that is read.
+*/
+#define READ_BUFFER_SIZE (1 << 16)
+
+/*
+  Binary format of a file of instances: a header of BINARY_HEADER_SIZE
+  bytes, made of BINARY_MAGIC, the number of species and of characters
+  (4 bytes each) and the number of instances (8 bytes), all little-endian.
+  Then each instance is a record of ceil(num_species * num_characters / 4)
+  bytes, where the matrix is stored row by row with BINARY_CELL_BITS bits
+  per cell, starting from the least significant bits of each byte.
+  Two bits are enough for the values 0, 1 and 2 of a constrained matrix.
+  All records have the same size, hence the record of the k-th instance
+  starts at BINARY_HEADER_SIZE + k * record size.
 */
+#define BINARY_MAGIC "CPPPBIN1"
+#define BINARY_MAGIC_LENGTH 8
+#define BINARY_HEADER_SIZE 24
+#define BINARY_CELL_BITS 2
+#define BINARY_CELL_MASK 3
+#define BINARY_CELLS_PER_BYTE 4
+
+/*
+  outcomes of reading a value from the input file
+*/
+#define READ_VALUE           0
+#define READ_EOF             1
+#define READ_EOF_AFTER_VALUE 2
+#define READ_INVALID         3
+
 typedef struct instances_schema_s {
         FILE* file;
         char* filename;
         uint32_t num_species;
         uint32_t num_characters;
+        arena_s* arena;
+        char* buffer;
+        size_t buffer_length;
+        size_t buffer_position;
+        bool binary;
+        uint64_t num_instances;
+        uint64_t next_instance;
+        uint64_t first_instance;
+        uint64_t last_instance;
+        bool collapse_duplicates;
+        bool direct_phylogeny;
 } instances_schema_s;
 
 /* /\** */
@@ -225,19 +531,47 @@ typedef struct instances_schema_s {
    \param the filename and a pointer to the state that will contain
    the data read from the file
 
+   If \c global_props->arena is not \c NULL, it is reset and the
+   instance is allocated in it: reading an instance releases the previous
+   one.
+
 
 */
 bool
 read_instance_from_filename(instances_schema_s* global_props, state_s* stp);
 
 /**
-   \param character: the source state \c src and the outcome \c dst of
-   the realization. The character to realize is \c src->realize
+   \brief the instance of the matrix \c matrix, with \c num_species rows
+   and \c num_characters columns stored row by row, in \c stp, just as if
+   it had been read from a file. The matrix is copied, and all arrays of
+   the instance are allocated in \c ap (in the heap if \c ap is \c NULL).
+*/
+void
+state_from_matrix(state_s* stp, const uint32_t* matrix, uint32_t num_species, uint32_t num_characters, arena_s* ap,
+                  bool collapse_duplicates, bool direct_phylogeny);
+
+/**
+   \brief converts the instances of \c props, in any format, to the
+   binary format and writes them to \c outf, which must be seekable.
+
+   \return the number of instances written
+*/
+uint64_t
+write_binary_instances(instances_schema_s* props, FILE* outf);
+
+/**
+   \param stp: the state that is modified by the realization, and the
+   node \c lp of the decision tree where the realization happens.
+   The character to realize is \c lp->realize, and the operation performed
+   is stored in \c lp->operation
+
+   All changes to \c stp are recorded in its undo log. If the realization
+   is impossible, \c stp is not modified.
 
    \return \c true if the realization has been successful
 
 */
-bool realize_character(state_s* dst, state_s* src);
+bool realize_character(state_s* stp, level_s* lp);
 
 /**
    \brief updates the connected components of the red-black graph of
@@ -247,6 +581,17 @@ bool realize_character(state_s* dst, state_s* src);
 void
 update_connected_components(state_s* stp);
 
+/**
+   \brief updates only the connected components of the vertices in \c
+   component, which must be a union of connected components of the
+   red-black graph of \c stp.
+
+   It is used after a realization, since only the connected component
+   containing the realized character can be split.
+*/
+void
+update_component(state_s* stp, const bitmap_word* component);
+
 
 /**
    \param inst: state_s
@@ -266,32 +611,150 @@ get_conflict_graph(const state_s *stp);
    Print a dump of a state
    \param stp: pointer to state_s
 */
+#ifdef DEBUG
 void log_state(const state_s* stp);
-void log_state_lists(const state_s* stp);
 void log_state_graphs(const state_s* stp);
+void log_level(const level_s* lp, uint32_t nvertices);
+void log_level_lists(const level_s* lp);
+#else
+#define log_state(stp)
+#define log_state_graphs(stp)
+#define log_level(lp, nvertices)
+#define log_level_lists(lp)
+#endif
 
 /**
    \brief
-   updates the current_component field a state, computing the
-   smallest nontrivial connected component of the red-black graph.
+   updates the current_component field of the node \c lp, computing the
+   smallest nontrivial connected component of the red-black graph of \c stp.
    Updates also the queue of characters that can be realized.
 
    It requires that the connected_component field has been previously updated.
 */
 void
-smallest_component(state_s* stp);
+smallest_component(const state_s* stp, level_s* lp);
 
 /**
-   \brief update the conflict graph
+   \brief recompute the conflict graph
+
+   Two characters are adjacent in the conflict graph iff they are both
+   current and inactive, and they induce the four gametes on the current
+   species. The four gametes test is performed on the \c columns bitmaps.
 */
 void
 update_conflict_graph(state_s* stp);
 
 /**
-   \brief analyzes the array of states and computes the resulting tree
-   in Newick format
+   \brief update the conflict graph after the realization of \c character
+
+   Since the columns of inactive characters never change, and species are
+   only deleted, a realization can only remove edges: those incident on
+   \c character, if it is not inactive anymore, and, only if some species
+   has been deleted (\c species_deleted), the edges whose four gametes are
+   not induced anymore.
+*/
+void
+update_conflict_graph_realization(state_s* stp, uint32_t character, bool species_deleted);
+
+/**
+   \brief analyzes the array of levels of the decision tree and computes the
+   resulting tree in Newick format. \c stp is the state that has been
+   modified by the search.
 
    \return a string with the tree
 */
 char*
-newick(state_s* states);
+newick(const state_s* stp, level_s* levels);
+
+/**
+   \brief same as \c newick, but the tree is not terminated by a semicolon, so
+   that it can be used as a subtree
+*/
+char*
+newick_subtree(const state_s* stp, level_s* levels);
+
+/**
+   \brief appends to \c sb the tree computed by \c newick_subtree, so that
+   the trees of many instances can be written into the same buffer
+*/
+void
+newick_append(strbuf_s* sb, const state_s* stp, level_s* levels);
+
+/**
+   \brief frees the \c subtrees of the levels of a solution, once its tree
+   has been written by \c newick or \c newick_append
+*/
+void
+free_subtrees(level_s* levels);
+
+/**
+   \brief checks if the red-black graph has a red Sigma-graph, that is two
+   active characters adjacent to a common species, such that each one is
+   adjacent to a species that is not adjacent to the other.
+
+   Such an instance has no solution: a red edge is removed only when its
+   character is freed, hence neither character can ever be adjacent to all
+   species of its connected component.
+*/
+bool
+red_sigma_graph(const state_s* stp);
+
+/**
+   \brief a lower bound on the number of realizations that are still needed
+   to solve \c stp.
+
+   Each inactive character must be realized and each active character must
+   be freed. Moreover, at least one of two conflicting characters must be
+   freed after its realization, so the bound also includes the size of a
+   greedy matching of the conflict graph. The cost is linear in the size of
+   the conflict graph.
+*/
+uint32_t
+realizations_lower_bound(const state_s* stp);
+
+/**
+   \brief the callback that appends to \c sb an edge of a tree built by
+   \c phylogeny_from_columns: the edge of the column \c column is written by
+   two calls, with \c open true before the subtree below it, if \c below, and
+   with \c open false after it, so that the whole tree is written in a single
+   pass.
+*/
+typedef void (*edge_fn)(strbuf_s* sb, const void* data, uint32_t column, bool below, bool open);
+
+/**
+   \brief appends to \c sb the perfect phylogeny of the \c num_columns
+   columns \c columns, each one a bitmap over \c num_species species, whose
+   edges are written by \c edge, that receives \c data. It borrows the
+   buffer \c tree of \c ws, that must be the workspace of an instance with
+   at least \c num_species species and half as many characters as columns.
+
+   The columns are sorted by nonincreasing number of species, so that
+   each species must have exactly the columns of a path from the root,
+   which is checked in \c O(nm) time. Columns with the same species are
+   on the same path, in their order.
+
+   The result is the comma-separated list of the trees, enclosed in
+   parentheses if \c enclose and there is more than one tree.
+
+   \return false, without appending anything, if there is no column or the
+   columns do not have a perfect phylogeny
+*/
+bool
+phylogeny_from_columns(strbuf_s* sb, const workspace_s* ws, const bitmap_word** columns, uint32_t num_columns,
+                       uint32_t num_species, edge_fn edge, const void* data, bool enclose);
+
+/**
+   \brief builds directly the phylogeny of an instance where all characters
+   are inactive and no two characters need to be both gained on the same
+   path, that is an instance with a perfect phylogeny.
+
+   The tree is built by \c phylogeny_from_columns from the neighbourhoods of
+   the characters in the red-black graph.
+
+   \return the comma-separated list of the trees of the instance, enclosed
+   as by \c phylogeny_from_columns, or \c NULL if the instance has some
+   active character or does not have a perfect phylogeny. It is freed by
+   \c xfree.
+*/
+char*
+perfect_phylogeny_forest(const state_s* stp, bool enclose);
@@ -0,0 +1,140 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "portfolio.h"
+
+/**
+   \struct race_s
+   \brief the two engines solving the same instance
+
+   Each engine has its outcome, counters and tree in the entries
+   \c ENGINE_SEARCH and \c ENGINE_SAT of the arrays. \c limits are the
+   limits of both engines, whose \c cancelled flag is \c cancelled: it is
+   set by the first engine that gives a definitive answer, that is the
+   \c winner (-1 until then).
+*/
+typedef struct race_s {
+        state_s *stp;
+        level_s *levels;
+        strategy_fn strategy;
+        memo_s *memo;
+        sat_engine_s *ep;
+        search_limits_s limits;
+        bool cancelled;
+        uint32_t winner;
+        uint32_t status[2];
+        search_counters_s counters[2];
+        char *tree[2];
+} race_s;
+
+static void
+finish(race_s *rp, uint32_t engine) {
+        if (rp->status[engine] == SEARCH_UNKNOWN)
+                return;
+#pragma omp critical(portfolio)
+        {
+                if (rp->winner == -1)
+                        rp->winner = engine;
+        }
+#pragma omp atomic write
+        rp->cancelled = true;
+}
+
+static void
+run_search(race_s *rp) {
+        state_s *stp = rp->stp;
+        rp->status[ENGINE_SEARCH] = exhaustive_search(stp, rp->levels, rp->strategy, rp->memo, &(rp->limits),
+                                                      rp->counters + ENGINE_SEARCH,
+                                                      stp->num_species + 2 * stp->num_characters);
+        if (rp->status[ENGINE_SEARCH] == SEARCH_FOUND) {
+                rp->tree[ENGINE_SEARCH] = newick(stp, rp->levels);
+                free_subtrees(rp->levels);
+        }
+        finish(rp, ENGINE_SEARCH);
+}
+
+static void
+run_sat(race_s *rp) {
+        bool cancelled;
+#pragma omp atomic read
+        cancelled = rp->cancelled;
+        /* the task has started after the search has answered */
+        if (cancelled)
+                return;
+        rp->status[ENGINE_SAT] = sat_search(rp->ep, rp->stp, &(rp->limits), rp->counters + ENGINE_SAT,
+                                            rp->tree + ENGINE_SAT);
+        finish(rp, ENGINE_SAT);
+}
+
+/*
+  The search modifies the state, while the SAT engine reads only its
+  matrix, which is never modified.
+*/
+static void
+race(race_s *rp) {
+#pragma omp taskgroup
+        {
+#pragma omp task default(shared)
+                run_sat(rp);
+                run_search(rp);
+        }
+}
+
+uint32_t
+portfolio_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo, sat_engine_s *ep,
+                 const search_limits_s *limits, search_counters_s *counters, char **tree) {
+        race_s r = {
+                .stp = stp,
+                .levels = levels,
+                .strategy = strategy,
+                .memo = memo,
+                .ep = ep,
+                .cancelled = false,
+                .winner = -1,
+                .status = { SEARCH_UNKNOWN, SEARCH_UNKNOWN },
+                .tree = { NULL, NULL }
+        };
+        if (limits != NULL)
+                r.limits = *limits;
+        r.limits.cancelled = &(r.cancelled);
+        if (omp_in_parallel()) {
+                race(&r);
+        } else {
+                memory_init_threads();
+#pragma omp parallel default(shared) num_threads(2)
+                {
+                        memory_register_thread();
+#pragma omp barrier
+#pragma omp single
+                        race(&r);
+                }
+        }
+        uint32_t engine = (r.winner != -1) ? r.winner : ENGINE_SEARCH;
+        log_debug("portfolio_search: engine %d, status %d", engine, r.status[engine]);
+        if (counters != NULL) {
+                *counters = r.counters[engine];
+                counters->engine = r.winner;
+        }
+        /* both engines may have found a tree */
+        if (r.tree[1 - engine] != NULL)
+                xfree(r.tree[1 - engine]);
+        *tree = r.tree[engine];
+        return r.status[engine];
+}
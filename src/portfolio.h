@@ -0,0 +1,47 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_PORTFOLIO_H
+#define CPPP_PORTFOLIO_H
+#include "sat_engine.h"
+
+/**
+   \brief solves the instance \c stp by running at the same time, in two
+   OpenMP tasks, \c exhaustive_search with the nodes \c levels, the strategy
+   \c strategy and the table \c memo, and \c sat_search with the solver
+   \c ep. The first definitive answer wins, and the other engine is
+   cancelled. Both engines have the budget \c limits.
+
+   Outside a parallel region, a team of two threads is created for the
+   instance. Inside a parallel region, such as a batch, the tasks are run by
+   the threads of the team.
+
+   \c counters are the counters of the engine that has answered, recorded in
+   their \c engine field, or of the search if no engine has answered.
+
+   \param tree: if a solution is found, it contains the resulting tree in
+   Newick format
+
+   returns one of \c SEARCH_FOUND, \c SEARCH_NOT_FOUND and \c SEARCH_UNKNOWN
+*/
+uint32_t
+portfolio_search(state_s *stp, level_s *levels, strategy_fn strategy, memo_s *memo, sat_engine_s *ep,
+                 const search_limits_s *limits, search_counters_s *counters, char **tree);
+#endif
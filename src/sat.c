@@ -0,0 +1,720 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sat.h"
+
+/*
+  values of the variables
+*/
+#define VALUE_FALSE 0
+#define VALUE_TRUE  1
+#define VALUE_UNDEF 2
+
+/*
+  header of a clause: size, flags and literal block distance, activity
+*/
+#define SAT_HEADER    3
+#define CLAUSE_LEARNT  1
+#define CLAUSE_DELETED 2
+#define LBD_SHIFT      2
+
+#define NONE UINT32_MAX
+
+/*
+  internal outcome of a run of the search between two restarts
+*/
+#define SAT_RESTART 1
+
+#define VAR_DECAY    0.95
+#define CLAUSE_DECAY 0.999
+#define RESTART_UNIT 100
+
+static void *
+grow(void *p, size_t bytes) {
+        if (p == NULL)
+                return xmalloc_atomic(bytes);
+        return xrealloc(p, bytes);
+}
+
+static uint32_t *
+clause_lits(const sat_s *sp, uint32_t c) {
+        return sp->db + c + SAT_HEADER;
+}
+
+static uint32_t
+clause_size(const sat_s *sp, uint32_t c) {
+        return sp->db[c];
+}
+
+static float
+clause_activity(const sat_s *sp, uint32_t c) {
+        float a;
+        memcpy(&a, sp->db + c + 2, sizeof(float));
+        return a;
+}
+
+static void
+set_clause_activity(sat_s *sp, uint32_t c, float a) {
+        memcpy(sp->db + c + 2, &a, sizeof(float));
+}
+
+static uint8_t
+lit_value(const sat_s *sp, uint32_t l) {
+        uint8_t v = sp->assigns[SAT_VAR(l)];
+        return (v == VALUE_UNDEF) ? v : (v ^ (l & 1));
+}
+
+/*
+  The heap of the unassigned variables, by decreasing activity
+*/
+static void
+heap_up(sat_s *sp, uint32_t i) {
+        uint32_t v = sp->heap[i];
+        while (i > 0) {
+                uint32_t parent = (i - 1) / 2;
+                if (sp->activity[sp->heap[parent]] >= sp->activity[v])
+                        break;
+                sp->heap[i] = sp->heap[parent];
+                sp->heap_index[sp->heap[i]] = i;
+                i = parent;
+        }
+        sp->heap[i] = v;
+        sp->heap_index[v] = i;
+}
+
+static void
+heap_down(sat_s *sp, uint32_t i) {
+        uint32_t v = sp->heap[i];
+        for (;;) {
+                uint32_t child = 2 * i + 1;
+                if (child >= sp->heap_size)
+                        break;
+                if (child + 1 < sp->heap_size && sp->activity[sp->heap[child + 1]] > sp->activity[sp->heap[child]])
+                        child++;
+                if (sp->activity[sp->heap[child]] <= sp->activity[v])
+                        break;
+                sp->heap[i] = sp->heap[child];
+                sp->heap_index[sp->heap[i]] = i;
+                i = child;
+        }
+        sp->heap[i] = v;
+        sp->heap_index[v] = i;
+}
+
+static void
+heap_insert(sat_s *sp, uint32_t v) {
+        if (sp->heap_index[v] != NONE)
+                return;
+        sp->heap[sp->heap_size] = v;
+        heap_up(sp, sp->heap_size++);
+}
+
+static uint32_t
+heap_pop(sat_s *sp) {
+        uint32_t v = sp->heap[0];
+        sp->heap_index[v] = NONE;
+        if (--(sp->heap_size) > 0) {
+                sp->heap[0] = sp->heap[sp->heap_size];
+                heap_down(sp, 0);
+        }
+        return v;
+}
+
+static void
+bump_var(sat_s *sp, uint32_t v) {
+        if ((sp->activity[v] += sp->var_inc) > 1e100) {
+                for (uint32_t w = 0; w < sp->num_vars; w++)
+                        sp->activity[w] *= 1e-100;
+                sp->var_inc *= 1e-100;
+        }
+        if (sp->heap_index[v] != NONE)
+                heap_up(sp, sp->heap_index[v]);
+}
+
+static void
+bump_clause(sat_s *sp, uint32_t c) {
+        float a = clause_activity(sp, c) + sp->clause_inc;
+        set_clause_activity(sp, c, a);
+        if (a > 1e20) {
+                for (uint32_t i = 0; i < sp->num_learnts; i++)
+                        set_clause_activity(sp, sp->learnts[i], clause_activity(sp, sp->learnts[i]) * 1e-20);
+                sp->clause_inc *= 1e-20;
+        }
+}
+
+void
+sat_init(sat_s *sp) {
+        memset(sp, 0, sizeof(sat_s));
+        sp->var_inc = 1;
+        sp->clause_inc = 1;
+        sp->ok = true;
+}
+
+void
+sat_release(sat_s *sp) {
+        for (uint32_t l = 0; l < 2 * sp->vars_capacity; l++)
+                if (sp->watches[l].watchers != NULL)
+                        xfree(sp->watches[l].watchers);
+        void *arrays[] = { sp->assigns, sp->polarity, sp->seen, sp->level, sp->reason, sp->activity,
+                           sp->heap, sp->heap_index, sp->trail, sp->trail_lim, sp->watches, sp->db,
+                           sp->learnts, sp->buffer, sp->toclear, sp->stamps, sp->model };
+        for (uint32_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+                if (arrays[i] != NULL)
+                        xfree(arrays[i]);
+        sat_init(sp);
+}
+
+uint32_t
+sat_new_vars(sat_s *sp, uint32_t count) {
+        assert(sp->num_levels == 0);
+        uint32_t first = sp->num_vars;
+        uint32_t needed = first + count;
+        if (needed > sp->vars_capacity) {
+                uint32_t capacity = 2 * sp->vars_capacity;
+                if (capacity < needed)
+                        capacity = needed;
+                sp->assigns = grow(sp->assigns, capacity);
+                sp->polarity = grow(sp->polarity, capacity);
+                sp->seen = grow(sp->seen, capacity);
+                sp->model = grow(sp->model, capacity);
+                sp->level = grow(sp->level, capacity * sizeof(uint32_t));
+                sp->reason = grow(sp->reason, capacity * sizeof(uint32_t));
+                sp->heap = grow(sp->heap, capacity * sizeof(uint32_t));
+                sp->heap_index = grow(sp->heap_index, capacity * sizeof(uint32_t));
+                sp->trail = grow(sp->trail, capacity * sizeof(uint32_t));
+                sp->trail_lim = grow(sp->trail_lim, capacity * sizeof(uint32_t));
+                sp->buffer = grow(sp->buffer, capacity * sizeof(uint32_t));
+                sp->toclear = grow(sp->toclear, capacity * sizeof(uint32_t));
+                sp->stamps = grow(sp->stamps, (capacity + 1) * sizeof(uint32_t));
+                sp->activity = grow(sp->activity, capacity * sizeof(double));
+/* the watch lists contain pointers, hence they are scanned */
+                sat_watches_s *watches = xmalloc(2 * capacity * sizeof(sat_watches_s));
+                memset(watches, 0, 2 * capacity * sizeof(sat_watches_s));
+                if (sp->watches != NULL) {
+                        memcpy(watches, sp->watches, 2 * sp->vars_capacity * sizeof(sat_watches_s));
+                        xfree(sp->watches);
+                }
+                sp->watches = watches;
+                memset(sp->stamps, 0, (capacity + 1) * sizeof(uint32_t));
+                sp->stamp = 0;
+                sp->vars_capacity = capacity;
+        }
+        for (uint32_t v = first; v < needed; v++) {
+                sp->assigns[v] = VALUE_UNDEF;
+                sp->polarity[v] = 1;
+                sp->seen[v] = 0;
+                sp->level[v] = 0;
+                sp->reason[v] = NONE;
+                sp->activity[v] = 0;
+                sp->heap_index[v] = NONE;
+                heap_insert(sp, v);
+        }
+        sp->num_vars = needed;
+        return first;
+}
+
+static void
+watch(sat_s *sp, uint32_t l, uint32_t c, uint32_t blocker) {
+        sat_watches_s *ws = sp->watches + l;
+        if (ws->size == ws->capacity) {
+                ws->capacity = (ws->capacity > 0) ? 2 * ws->capacity : 4;
+                ws->watchers = grow(ws->watchers, ws->capacity * sizeof(sat_watcher_s));
+        }
+        ws->watchers[ws->size++] = (sat_watcher_s) { .clause = c, .blocker = blocker };
+}
+
+/*
+  A clause is watched by the negations of its first two literals: when one
+  of them becomes true, the clause is visited.
+*/
+static void
+attach(sat_s *sp, uint32_t c) {
+        uint32_t *lits = clause_lits(sp, c);
+        watch(sp, SAT_NOT(lits[0]), c, lits[1]);
+        watch(sp, SAT_NOT(lits[1]), c, lits[0]);
+}
+
+static uint32_t
+new_clause(sat_s *sp, const uint32_t *lits, uint32_t size, bool learnt, uint32_t lbd) {
+        if (sp->db_size + SAT_HEADER + size > sp->db_capacity) {
+                size_t capacity = sp->db_capacity + sp->db_capacity / 2 + SAT_HEADER + size + 1024;
+                sp->db = grow(sp->db, capacity * sizeof(uint32_t));
+                sp->db_capacity = capacity;
+        }
+        uint32_t c = sp->db_size;
+        assert(c < NONE);
+        sp->db[c] = size;
+        sp->db[c + 1] = (lbd << LBD_SHIFT) | (learnt ? CLAUSE_LEARNT : 0);
+        set_clause_activity(sp, c, 0);
+        memcpy(clause_lits(sp, c), lits, size * sizeof(uint32_t));
+        sp->db_size += SAT_HEADER + size;
+        if (learnt) {
+                if (sp->num_learnts == sp->learnts_capacity) {
+                        sp->learnts_capacity = (sp->learnts_capacity > 0) ? 2 * sp->learnts_capacity : 1024;
+                        sp->learnts = grow(sp->learnts, sp->learnts_capacity * sizeof(uint32_t));
+                }
+                sp->learnts[sp->num_learnts++] = c;
+        }
+        attach(sp, c);
+        return c;
+}
+
+static void
+assign(sat_s *sp, uint32_t l, uint32_t reason) {
+        uint32_t v = SAT_VAR(l);
+        assert(sp->assigns[v] == VALUE_UNDEF);
+        sp->assigns[v] = (l & 1) ? VALUE_FALSE : VALUE_TRUE;
+        sp->level[v] = sp->num_levels;
+        sp->reason[v] = reason;
+        sp->trail[sp->trail_size++] = l;
+}
+
+static void
+new_level(sat_s *sp) {
+        sp->trail_lim[sp->num_levels++] = sp->trail_size;
+}
+
+/*
+  The values of the unassigned variables are saved, so that they are tried
+  again by the next decisions.
+*/
+static void
+cancel_until(sat_s *sp, uint32_t level) {
+        if (sp->num_levels <= level)
+                return;
+        for (uint32_t i = sp->trail_size; i-- > sp->trail_lim[level]; ) {
+                uint32_t v = SAT_VAR(sp->trail[i]);
+                sp->polarity[v] = sp->trail[i] & 1;
+                sp->assigns[v] = VALUE_UNDEF;
+                sp->reason[v] = NONE;
+                heap_insert(sp, v);
+        }
+        sp->trail_size = sp->trail_lim[level];
+        sp->qhead = sp->trail_size;
+        sp->num_levels = level;
+}
+
+/**
+   \brief unit propagation of all literals of the trail
+
+   \return a clause whose literals are all false, or \c NONE
+*/
+static uint32_t
+propagate(sat_s *sp) {
+        uint32_t conflict = NONE;
+        while (sp->qhead < sp->trail_size && conflict == NONE) {
+                uint32_t p = sp->trail[sp->qhead++];
+                uint32_t false_lit = SAT_NOT(p);
+                sat_watches_s *ws = sp->watches + p;
+                sp->propagations++;
+                uint32_t i = 0, j = 0;
+                while (i < ws->size) {
+                        sat_watcher_s w = ws->watchers[i];
+                        if (lit_value(sp, w.blocker) == VALUE_TRUE) {
+                                ws->watchers[j++] = ws->watchers[i++];
+                                continue;
+                        }
+                        uint32_t *lits = clause_lits(sp, w.clause);
+                        if (lits[0] == false_lit) {
+                                lits[0] = lits[1];
+                                lits[1] = false_lit;
+                        }
+                        assert(lits[1] == false_lit);
+                        i++;
+                        uint32_t first = lits[0];
+                        sat_watcher_s kept = { .clause = w.clause, .blocker = first };
+                        if (first != w.blocker && lit_value(sp, first) == VALUE_TRUE) {
+                                ws->watchers[j++] = kept;
+                                continue;
+                        }
+                        bool moved = false;
+                        uint32_t size = clause_size(sp, w.clause);
+                        for (uint32_t k = 2; k < size; k++)
+                                if (lit_value(sp, lits[k]) != VALUE_FALSE) {
+                                        lits[1] = lits[k];
+                                        lits[k] = false_lit;
+                                        watch(sp, SAT_NOT(lits[1]), w.clause, first);
+                                        moved = true;
+                                        break;
+                                }
+                        if (moved)
+                                continue;
+                        ws->watchers[j++] = kept;
+                        if (lit_value(sp, first) == VALUE_FALSE) {
+                                conflict = w.clause;
+                                sp->qhead = sp->trail_size;
+                                while (i < ws->size)
+                                        ws->watchers[j++] = ws->watchers[i++];
+                        } else
+                                assign(sp, first, w.clause);
+                }
+                ws->size = j;
+        }
+        return conflict;
+}
+
+/*
+  A literal of a learned clause is redundant if all other literals of its
+  reason are in the clause, or are fixed.
+*/
+static bool
+redundant(const sat_s *sp, uint32_t l) {
+        uint32_t r = sp->reason[SAT_VAR(l)];
+        if (r == NONE)
+                return false;
+        const uint32_t *lits = clause_lits(sp, r);
+        for (uint32_t k = 1; k < clause_size(sp, r); k++) {
+                uint32_t v = SAT_VAR(lits[k]);
+                if (!sp->seen[v] && sp->level[v] > 0)
+                        return false;
+        }
+        return true;
+}
+
+/**
+   \brief computes in \c buffer the first-UIP clause learned from \c conflict
+
+   \return the size of the clause. \c backtrack is the level where the
+   clause becomes unit, and \c lbd the number of levels of its literals.
+*/
+static uint32_t
+analyze(sat_s *sp, uint32_t conflict, uint32_t *backtrack, uint32_t *lbd) {
+        uint32_t *learnt = sp->buffer;
+        uint32_t size = 1;
+        uint32_t pending = 0;
+        uint32_t p = NONE;
+        uint32_t index = sp->trail_size;
+        do {
+                if (sp->db[conflict + 1] & CLAUSE_LEARNT)
+                        bump_clause(sp, conflict);
+                const uint32_t *lits = clause_lits(sp, conflict);
+                for (uint32_t k = (p == NONE) ? 0 : 1; k < clause_size(sp, conflict); k++) {
+                        uint32_t v = SAT_VAR(lits[k]);
+                        if (sp->seen[v] || sp->level[v] == 0)
+                                continue;
+                        bump_var(sp, v);
+                        sp->seen[v] = 1;
+                        if (sp->level[v] >= sp->num_levels)
+                                pending++;
+                        else
+                                learnt[size++] = lits[k];
+                }
+                while (!sp->seen[SAT_VAR(sp->trail[--index])]) ;
+                p = sp->trail[index];
+                conflict = sp->reason[SAT_VAR(p)];
+                sp->seen[SAT_VAR(p)] = 0;
+                pending--;
+        } while (pending > 0);
+        learnt[0] = SAT_NOT(p);
+
+        memcpy(sp->toclear, learnt, size * sizeof(uint32_t));
+        uint32_t num_toclear = size;
+        uint32_t j = 1;
+        for (uint32_t k = 1; k < size; k++)
+                if (!redundant(sp, learnt[k]))
+                        learnt[j++] = learnt[k];
+        size = j;
+        for (uint32_t k = 0; k < num_toclear; k++)
+                sp->seen[SAT_VAR(sp->toclear[k])] = 0;
+
+        *backtrack = 0;
+        if (size > 1) {
+                uint32_t max = 1;
+                for (uint32_t k = 2; k < size; k++)
+                        if (sp->level[SAT_VAR(learnt[k])] > sp->level[SAT_VAR(learnt[max])])
+                                max = k;
+                uint32_t tmp = learnt[1];
+                learnt[1] = learnt[max];
+                learnt[max] = tmp;
+                *backtrack = sp->level[SAT_VAR(learnt[1])];
+        }
+        sp->stamp++;
+        *lbd = 0;
+        for (uint32_t k = 0; k < size; k++) {
+                uint32_t l = sp->level[SAT_VAR(learnt[k])];
+                if (sp->stamps[l] != sp->stamp) {
+                        sp->stamps[l] = sp->stamp;
+                        (*lbd)++;
+                }
+        }
+        return size;
+}
+
+void
+sat_add_clause(sat_s *sp, const uint32_t *lits, uint32_t size) {
+        assert(sp->num_levels == 0);
+        if (!sp->ok)
+                return;
+/*
+  seen marks the literals already in the clause: 1 for the positive and 2
+  for the negative literal of a variable
+*/
+        uint32_t *clause = sp->buffer;
+        uint32_t n = 0;
+        bool satisfied = false;
+        for (uint32_t i = 0; i < size && !satisfied; i++) {
+                uint32_t l = lits[i];
+                assert(SAT_VAR(l) < sp->num_vars);
+                uint8_t mark = (l & 1) ? 2 : 1;
+                uint8_t *seen = sp->seen + SAT_VAR(l);
+                if (lit_value(sp, l) == VALUE_TRUE || (*seen & (3 - mark)))
+                        satisfied = true;
+                else if (lit_value(sp, l) == VALUE_UNDEF && !(*seen & mark)) {
+                        *seen |= mark;
+                        clause[n++] = l;
+                }
+        }
+        for (uint32_t i = 0; i < size; i++)
+                sp->seen[SAT_VAR(lits[i])] = 0;
+        if (satisfied)
+                return;
+        if (n == 0) {
+                sp->ok = false;
+        } else if (n == 1) {
+                assign(sp, clause[0], NONE);
+                sp->ok = (propagate(sp) == NONE);
+        } else {
+                new_clause(sp, clause, n, false, 0);
+                sp->num_clauses++;
+        }
+}
+
+typedef struct learnt_rank_s {
+        uint32_t clause;
+        uint32_t lbd;
+        float activity;
+} learnt_rank_s;
+
+static int
+learnt_rank_cmp(const void *a, const void *b) {
+        const learnt_rank_s *x = a;
+        const learnt_rank_s *y = b;
+        if (x->lbd != y->lbd)
+                return (x->lbd < y->lbd) ? -1 : 1;
+        if (x->activity != y->activity)
+                return (x->activity > y->activity) ? -1 : 1;
+        return (x->clause < y->clause) ? -1 : (x->clause > y->clause);
+}
+
+static bool
+locked(const sat_s *sp, uint32_t c) {
+        uint32_t l = clause_lits(sp, c)[0];
+        return sp->reason[SAT_VAR(l)] == c && lit_value(sp, l) == VALUE_TRUE;
+}
+
+/*
+  Moves all clauses that have not been deleted at the beginning of db. The
+  old offset of each moved clause stores its new offset, so that the
+  reasons can be updated.
+*/
+static void
+compact(sat_s *sp) {
+        uint32_t *db = xmalloc_atomic((sp->db_size - sp->wasted) * sizeof(uint32_t) + 1);
+        size_t size = 0;
+        sp->num_learnts = 0;
+        for (size_t c = 0; c < sp->db_size; c += SAT_HEADER + sp->db[c]) {
+                if (sp->db[c + 1] & CLAUSE_DELETED)
+                        continue;
+                memcpy(db + size, sp->db + c, (SAT_HEADER + sp->db[c]) * sizeof(uint32_t));
+                if (db[size + 1] & CLAUSE_LEARNT)
+                        sp->learnts[sp->num_learnts++] = size;
+                sp->db[c + 2] = size;
+                size += SAT_HEADER + sp->db[c];
+        }
+        for (uint32_t i = 0; i < sp->trail_size; i++) {
+                uint32_t v = SAT_VAR(sp->trail[i]);
+                if (sp->reason[v] != NONE)
+                        sp->reason[v] = sp->db[sp->reason[v] + 2];
+        }
+        xfree(sp->db);
+        sp->db = db;
+        sp->db_size = size;
+        sp->db_capacity = size + 1;
+        sp->wasted = 0;
+}
+
+/**
+   \brief deletes half of the learned clauses, keeping those with the
+   smallest literal block distance and the largest activity, and those that
+   are the reason of an assignment.
+*/
+static void
+reduce_db(sat_s *sp) {
+        learnt_rank_s *ranks = xmalloc_atomic(sp->num_learnts * sizeof(learnt_rank_s) + 1);
+        for (uint32_t i = 0; i < sp->num_learnts; i++) {
+                uint32_t c = sp->learnts[i];
+                ranks[i] = (learnt_rank_s) {
+                        .clause = c,
+                        .lbd = sp->db[c + 1] >> LBD_SHIFT,
+                        .activity = clause_activity(sp, c)
+                };
+        }
+        qsort(ranks, sp->num_learnts, sizeof(learnt_rank_s), learnt_rank_cmp);
+        for (uint32_t i = sp->num_learnts / 2; i < sp->num_learnts; i++) {
+                uint32_t c = ranks[i].clause;
+                if (ranks[i].lbd <= 2 || locked(sp, c))
+                        continue;
+                sp->db[c + 1] |= CLAUSE_DELETED;
+                sp->wasted += SAT_HEADER + clause_size(sp, c);
+        }
+        xfree(ranks);
+        compact(sp);
+/* the watched literals of each clause are still its first two literals */
+        for (uint32_t l = 0; l < 2 * sp->num_vars; l++)
+                sp->watches[l].size = 0;
+        for (size_t c = 0; c < sp->db_size; c += SAT_HEADER + sp->db[c])
+                attach(sp, c);
+        sp->max_learnts += sp->max_learnts / 10;
+}
+
+/*
+  The Luby sequence 1, 1, 2, 1, 1, 2, 4, ...
+*/
+static uint64_t
+luby(uint32_t x) {
+        uint32_t size = 1, seq = 0;
+        for (; size < x + 1; seq++)
+                size = 2 * size + 1;
+        while (size - 1 != x) {
+                size = (size - 1) >> 1;
+                seq--;
+                x = x % size;
+        }
+        return (uint64_t) 1 << seq;
+}
+
+static bool
+stopped(const sat_s *sp, uint64_t first_conflict) {
+        if (sp->max_conflicts > 0 && sp->conflicts - first_conflict >= sp->max_conflicts)
+                return true;
+        if (sp->deadline > 0 && omp_get_wtime() >= sp->deadline)
+                return true;
+        if (sp->cancelled != NULL) {
+                bool cancelled;
+#pragma omp atomic read
+                cancelled = *(sp->cancelled);
+                return cancelled;
+        }
+        return false;
+}
+
+/**
+   \brief the search until \c max_conflicts conflicts have been found, or the
+   outcome is known
+
+   \return \c SAT_RESTART, or the outcome of \c sat_solve
+*/
+static uint32_t
+search(sat_s *sp, const uint32_t *assumptions, uint32_t num_assumptions, uint64_t max_conflicts, uint64_t first_conflict) {
+        uint64_t conflicts = 0;
+        uint64_t steps = 0;
+        for (;;) {
+                uint32_t conflict = propagate(sp);
+                if (conflict != NONE) {
+                        sp->conflicts++;
+                        conflicts++;
+                        if (sp->num_levels == 0) {
+                                sp->ok = false;
+                                return SAT_UNSATISFIABLE;
+                        }
+                        uint32_t backtrack, lbd;
+                        uint32_t size = analyze(sp, conflict, &backtrack, &lbd);
+                        cancel_until(sp, backtrack);
+                        if (size == 1)
+                                assign(sp, sp->buffer[0], NONE);
+                        else {
+                                uint32_t c = new_clause(sp, sp->buffer, size, true, lbd);
+                                bump_clause(sp, c);
+                                assign(sp, sp->buffer[0], c);
+                        }
+                        sp->var_inc /= VAR_DECAY;
+                        sp->clause_inc /= CLAUSE_DECAY;
+                        if (stopped(sp, first_conflict)) {
+                                cancel_until(sp, 0);
+                                return SAT_UNKNOWN;
+                        }
+                        continue;
+                }
+                if (conflicts >= max_conflicts) {
+                        cancel_until(sp, 0);
+                        return SAT_RESTART;
+                }
+/* the decisions, and the levels of the assumptions, are bounded too */
+                if ((++steps & 255) == 0 && stopped(sp, first_conflict)) {
+                        cancel_until(sp, 0);
+                        return SAT_UNKNOWN;
+                }
+                if (sp->num_learnts >= sp->max_learnts + sp->trail_size)
+                        reduce_db(sp);
+                uint32_t next = NONE;
+                while (sp->num_levels < num_assumptions) {
+                        uint32_t p = assumptions[sp->num_levels];
+                        uint8_t value = lit_value(sp, p);
+                        if (value == VALUE_TRUE) {
+                                new_level(sp);
+                        } else if (value == VALUE_FALSE) {
+                                cancel_until(sp, 0);
+                                return SAT_UNSATISFIABLE;
+                        } else {
+                                next = p;
+                                break;
+                        }
+                }
+                if (next == NONE) {
+                        while (next == NONE && sp->heap_size > 0) {
+                                uint32_t v = heap_pop(sp);
+                                if (sp->assigns[v] == VALUE_UNDEF)
+                                        next = SAT_LIT(v, sp->polarity[v]);
+                        }
+                        if (next == NONE) {
+                                memcpy(sp->model, sp->assigns, sp->num_vars);
+                                cancel_until(sp, 0);
+                                return SAT_SATISFIABLE;
+                        }
+                        sp->decisions++;
+                }
+                new_level(sp);
+                assign(sp, next, NONE);
+        }
+}
+
+uint32_t
+sat_solve(sat_s *sp, const uint32_t *assumptions, uint32_t num_assumptions) {
+        if (!sp->ok)
+                return SAT_UNSATISFIABLE;
+        if (sp->max_learnts < sp->num_clauses / 3 + 1000)
+                sp->max_learnts = sp->num_clauses / 3 + 1000;
+        uint64_t first_conflict = sp->conflicts;
+        if (stopped(sp, first_conflict))
+                return SAT_UNKNOWN;
+        uint32_t status = SAT_RESTART;
+        for (uint32_t restarts = 0; status == SAT_RESTART; restarts++)
+                status = search(sp, assumptions, num_assumptions, RESTART_UNIT * luby(restarts), first_conflict);
+        return status;
+}
+
+bool
+sat_model_value(const sat_s *sp, uint32_t v) {
+        assert(v < sp->num_vars);
+        return sp->model[v] == VALUE_TRUE;
+}
@@ -0,0 +1,157 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_SAT_H
+#define CPPP_SAT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <omp.h>
+#include "memory.h"
+
+/*
+  A literal is a variable, numbered from 0, together with a sign:
+  SAT_LIT(v, false) is the variable v, SAT_LIT(v, true) is its negation.
+*/
+#define SAT_LIT(v, negated) (((v) << 1) | ((negated) ? 1 : 0))
+#define SAT_NOT(l)          ((l) ^ 1)
+#define SAT_VAR(l)          ((l) >> 1)
+
+/*
+  outcomes of sat_solve, with the usual DIMACS codes
+*/
+#define SAT_UNKNOWN        0
+#define SAT_SATISFIABLE   10
+#define SAT_UNSATISFIABLE 20
+
+/**
+   \struct sat_watches_s
+   \brief the clauses watched by a literal, each one with a literal of the
+   clause (the \c blocker) that, if true, makes the clause satisfied
+*/
+typedef struct sat_watcher_s {
+        uint32_t clause;
+        uint32_t blocker;
+} sat_watcher_s;
+
+typedef struct sat_watches_s {
+        sat_watcher_s *watchers;
+        uint32_t size;
+        uint32_t capacity;
+} sat_watches_s;
+
+/**
+   \struct sat_s
+   \brief an incremental CDCL SAT solver, in the style of MiniSat
+
+   Clauses can be added between two calls of \c sat_solve, and each call can
+   have a different set of assumptions: the learned clauses are consequences
+   of the clauses, not of the assumptions, hence they are kept across calls.
+
+   All clauses are stored in \c db: each clause is a header of
+   \c SAT_HEADER words (size, flags and literal block distance, activity)
+   followed by its literals, and it is identified by the offset of its
+   header. The first two literals of each clause are watched.
+
+   \c max_conflicts, \c deadline (as returned by \c omp_get_wtime) and
+   \c cancelled bound each call of \c sat_solve: a value 0 or \c NULL means
+   no bound. \c conflicts, \c decisions and \c propagations count the work
+   done by all calls.
+
+   \c ok is \c false when the clauses are unsatisfiable regardless of the
+   assumptions.
+*/
+typedef struct sat_s {
+        uint32_t num_vars;
+        uint32_t vars_capacity;
+        uint8_t *assigns;
+        uint8_t *polarity;
+        uint8_t *seen;
+        uint32_t *level;
+        uint32_t *reason;
+        double *activity;
+        uint32_t *heap;
+        uint32_t heap_size;
+        uint32_t *heap_index;
+        uint32_t *trail;
+        uint32_t trail_size;
+        uint32_t *trail_lim;
+        uint32_t num_levels;
+        uint32_t qhead;
+        sat_watches_s *watches;
+
+        uint32_t *db;
+        size_t db_size;
+        size_t db_capacity;
+        size_t wasted;
+        uint32_t *learnts;
+        uint32_t num_learnts;
+        uint32_t learnts_capacity;
+        uint32_t max_learnts;
+        uint32_t num_clauses;
+
+        uint32_t *buffer;
+        uint32_t *toclear;
+        uint32_t *stamps;
+        uint32_t stamp;
+        double var_inc;
+        double clause_inc;
+        bool ok;
+
+        uint8_t *model;
+        uint64_t max_conflicts;
+        double deadline;
+        const bool *cancelled;
+        uint64_t conflicts;
+        uint64_t decisions;
+        uint64_t propagations;
+} sat_s;
+
+void sat_init(sat_s *sp);
+void sat_release(sat_s *sp);
+
+/**
+   \brief adds \c count new variables
+
+   \return the first new variable
+*/
+uint32_t sat_new_vars(sat_s *sp, uint32_t count);
+
+/**
+   \brief adds the clause made of the \c size literals \c lits
+*/
+void sat_add_clause(sat_s *sp, const uint32_t *lits, uint32_t size);
+
+/**
+   \brief decides if the clauses, together with the \c num_assumptions
+   literals \c assumptions, are satisfiable.
+
+   \return \c SAT_SATISFIABLE, \c SAT_UNSATISFIABLE, or \c SAT_UNKNOWN if a
+   bound has been reached. In the first case \c sat_model_value gives the
+   satisfying assignment.
+*/
+uint32_t sat_solve(sat_s *sp, const uint32_t *assumptions, uint32_t num_assumptions);
+
+/**
+   \brief the value of the variable \c v in the assignment found by the last
+   successful call of \c sat_solve
+*/
+bool sat_model_value(const sat_s *sp, uint32_t v);
+#endif
@@ -0,0 +1,206 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "sat_engine.h"
+
+/*
+  The variables of each cell (s,c) of the matrix:
+  VAR_ONE    => M[s,c] = 1, fixed by the assumptions
+  VAR_LOST   => s has lost c, that is the value of c- for s
+  VAR_GAINED => s or an ancestor of s has gained c, that is the value of c+
+                for s
+*/
+#define VAR_ONE    0
+#define VAR_LOST   1
+#define VAR_GAINED 2
+#define CELL_VARS  3
+
+static uint32_t
+cell_var(const sat_engine_s *ep, uint32_t s, uint32_t c, uint32_t var) {
+        return CELL_VARS * (s * ep->num_characters + c) + var;
+}
+
+void
+sat_engine_init(sat_engine_s *ep) {
+        sat_init(&(ep->solver));
+        ep->num_species = 0;
+        ep->num_characters = 0;
+        ep->assumptions = NULL;
+        ep->ready = false;
+}
+
+void
+sat_engine_release(sat_engine_s *ep) {
+        sat_release(&(ep->solver));
+        if (ep->assumptions != NULL)
+                xfree(ep->assumptions);
+        sat_engine_init(ep);
+}
+
+static void
+add_clause3(sat_s *sp, uint32_t l1, uint32_t l2, uint32_t l3) {
+        uint32_t lits[] = { l1, l2, l3 };
+        sat_add_clause(sp, lits, 3);
+}
+
+static void
+add_clause2(sat_s *sp, uint32_t l1, uint32_t l2) {
+        uint32_t lits[] = { l1, l2 };
+        sat_add_clause(sp, lits, 2);
+}
+
+/*
+  The clauses of all instances with n species and m characters
+*/
+static void
+encode(sat_engine_s *ep, uint32_t n, uint32_t m) {
+        sat_engine_release(ep);
+        ep->num_species = n;
+        ep->num_characters = m;
+        ep->assumptions = xmalloc_atomic(n * m * sizeof(uint32_t) + 1);
+        sat_s *sp = &(ep->solver);
+        sat_new_vars(sp, CELL_VARS * n * m);
+        for (uint32_t s = 0; s < n; s++)
+                for (uint32_t c = 0; c < m; c++) {
+                        uint32_t one = cell_var(ep, s, c, VAR_ONE);
+                        uint32_t lost = cell_var(ep, s, c, VAR_LOST);
+                        uint32_t gained = cell_var(ep, s, c, VAR_GAINED);
+                        add_clause2(sp, SAT_LIT(one, true), SAT_LIT(lost, true));
+                        add_clause3(sp, SAT_LIT(gained, true), SAT_LIT(one, false), SAT_LIT(lost, false));
+                        add_clause2(sp, SAT_LIT(one, true), SAT_LIT(gained, false));
+                        add_clause2(sp, SAT_LIT(lost, true), SAT_LIT(gained, false));
+                }
+/*
+  For each pair of columns of the extended matrix, three variables
+  record which of the pairs 10, 01 and 11 appear, and not all of them can
+  appear. c- is included in c+, hence the two columns of a character are
+  always compatible.
+*/
+        static const uint32_t signed_vars[] = { VAR_GAINED, VAR_LOST };
+        for (uint32_t c1 = 0; c1 < m; c1++)
+                for (uint32_t c2 = c1 + 1; c2 < m; c2++)
+                        for (uint32_t i = 0; i < 4; i++) {
+                                uint32_t pair = sat_new_vars(sp, 3);
+                                uint32_t g10 = pair, g01 = pair + 1, g11 = pair + 2;
+                                for (uint32_t s = 0; s < n; s++) {
+                                        uint32_t x = cell_var(ep, s, c1, signed_vars[i / 2]);
+                                        uint32_t y = cell_var(ep, s, c2, signed_vars[i % 2]);
+                                        add_clause3(sp, SAT_LIT(x, true), SAT_LIT(y, false), SAT_LIT(g10, false));
+                                        add_clause3(sp, SAT_LIT(x, false), SAT_LIT(y, true), SAT_LIT(g01, false));
+                                        add_clause3(sp, SAT_LIT(x, true), SAT_LIT(y, true), SAT_LIT(g11, false));
+                                }
+                                add_clause3(sp, SAT_LIT(g10, true), SAT_LIT(g01, true), SAT_LIT(g11, true));
+                        }
+        ep->ready = true;
+        log_debug("sat encoding: %d variables, %d clauses", sp->num_vars, sp->num_clauses);
+}
+
+/*
+  Each column of the extended matrix in data is 2c for c+ and 2c+1 for c-.
+*/
+static void
+signed_edge(strbuf_s* sb, const void* data, uint32_t column, bool below, bool open) {
+        if (open) {
+                if (below)
+                        strbuf_putc(sb, '(');
+                return;
+        }
+        uint32_t e = ((const uint32_t*) data)[column];
+        strbuf_printf(sb, ":C%04u%c", e / 2, (e % 2 == 0) ? '+' : '-');
+        if (below)
+                strbuf_putc(sb, ')');
+}
+
+/*
+  The tree of the extended matrix given by the model of the solver. The
+  columns c+ and c- with the same species are on the same path, with c+
+  first. The columns and their labels are borrowed from ws.
+*/
+static char*
+model_tree(const sat_engine_s *ep, const workspace_s *ws) {
+        uint32_t n = ep->num_species;
+        uint32_t m = ep->num_characters;
+        uint32_t words = BITMAP_NWORDS(n);
+        bitmap_word* bits = xmalloc_atomic(2 * m * words * sizeof(bitmap_word) + 1);
+        memset(bits, 0, 2 * m * words * sizeof(bitmap_word));
+        const bitmap_word **columns = ws->columns;
+        uint32_t *labels = ws->labels;
+        uint32_t size = 0;
+        for (uint32_t e = 0; e < 2 * m; e++) {
+                bitmap_word* col = bits + (size_t) e * words;
+                bool empty = true;
+                for (uint32_t s = 0; s < n; s++)
+                        if (sat_model_value(&(ep->solver), cell_var(ep, s, e / 2, (e % 2 == 0) ? VAR_GAINED : VAR_LOST))) {
+                                bitmap_set_bit(col, s);
+                                empty = false;
+                        }
+                if (!empty) {
+                        columns[size] = col;
+                        labels[size++] = e;
+                }
+        }
+        strbuf_s tree;
+        strbuf_init(&tree);
+        if (!phylogeny_from_columns(&tree, ws, columns, size, n, signed_edge, labels, true))
+                assert(size == 0);
+        xfree(bits);
+        strbuf_putc(&tree, ';');
+        return tree.data;
+}
+
+uint32_t
+sat_search(sat_engine_s *ep, const state_s *stp, const search_limits_s *limits, search_counters_s *counters,
+           char **tree) {
+        double start = omp_get_wtime();
+        uint32_t n = stp->num_species_orig;
+        uint32_t m = stp->num_characters_orig;
+        assert(stp->matrix != NULL);
+        if (!ep->ready || ep->num_species != n || ep->num_characters != m)
+                encode(ep, n, m);
+/*
+  Just as the search, which adds to the red-black graph only the 1s of the
+  matrix, any value other than 1, such as 2, is a 0
+*/
+        uint32_t size = 0;
+        for (uint32_t s = 0; s < n; s++)
+                for (uint32_t c = 0; c < m; c++) {
+                        ep->assumptions[size++] = SAT_LIT(cell_var(ep, s, c, VAR_ONE), matrix_get_value(stp, s, c) != 1);
+                }
+        sat_s *sp = &(ep->solver);
+        sp->max_conflicts = (limits != NULL) ? limits->max_nodes : 0;
+        sp->deadline = search_deadline(limits, start);
+        sp->cancelled = (limits != NULL) ? limits->cancelled : NULL;
+        uint64_t conflicts = sp->conflicts;
+        uint32_t result = sat_solve(sp, ep->assumptions, size);
+        log_debug("sat_search: result %d, %d conflicts", result, sp->conflicts - conflicts);
+        if (counters != NULL) {
+                counters->nodes = sp->conflicts - conflicts;
+                counters->time_us = (uint64_t) ((omp_get_wtime() - start) * 1000000);
+                counters->iterations = 1;
+                counters->max_losses = -1;
+                counters->engine = -1;
+                counters->stats = (search_stats_s) { 0 };
+        }
+        if (result == SAT_SATISFIABLE) {
+                *tree = model_tree(ep, &(stp->workspace));
+                return SEARCH_FOUND;
+        }
+        return (result == SAT_UNSATISFIABLE) ? SEARCH_NOT_FOUND : SEARCH_UNKNOWN;
+}
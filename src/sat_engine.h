@@ -0,0 +1,68 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_SAT_ENGINE_H
+#define CPPP_SAT_ENGINE_H
+#include "decision_tree.h"
+#include "sat.h"
+
+/**
+   \struct sat_engine_s
+   \brief the reduction of the constrained persistent phylogeny problem to
+   satisfiability, for all instances with \c num_species species and
+   \c num_characters characters.
+
+   The encoding is the same as \c bin/cppp-sat: the extended matrix, with
+   the columns c+ (c has been gained) and c- (c has been lost) of each
+   character c, must have a perfect phylogeny, that is no two columns can
+   have all the pairs 10, 01 and 11. Unlike \c bin/cppp-sat, where the value
+   2 forbids the loss, every value other than 1 is a 0, as in the search, so
+   that both engines solve the same instances.
+   The clauses do not depend on the values of the matrix, that are given to
+   \c solver as assumptions: the clauses learned while solving an instance
+   are valid for all instances of the same size, hence they are kept.
+
+   \c assumptions has room for the assumptions of an instance.
+*/
+typedef struct sat_engine_s {
+        sat_s solver;
+        uint32_t num_species;
+        uint32_t num_characters;
+        uint32_t *assumptions;
+        bool ready;
+} sat_engine_s;
+
+void sat_engine_init(sat_engine_s *ep);
+void sat_engine_release(sat_engine_s *ep);
+
+/**
+   \brief solves the instance read in \c stp, whose matrix must be available,
+   within the budget \c limits. The number of nodes of the budget and of the
+   counters is the number of conflicts of the solver.
+
+   \param tree: if a solution is found, it contains the resulting tree in
+   Newick format
+
+   returns one of \c SEARCH_FOUND, \c SEARCH_NOT_FOUND and \c SEARCH_UNKNOWN
+*/
+uint32_t
+sat_search(sat_engine_s *ep, const state_s *stp, const search_limits_s *limits, search_counters_s *counters,
+           char **tree);
+#endif
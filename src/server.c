@@ -0,0 +1,119 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#include "server.h"
+#include <ctype.h>
+#include <errno.h>
+
+/*
+  A matrix, whose capacity is extended only when a larger request arrives
+*/
+typedef struct request_s {
+        uint32_t num_species;
+        uint32_t num_characters;
+        uint32_t *matrix;
+        size_t capacity;
+} request_s;
+
+/*
+  Reads the next integer of the line starting at *p, skipping the
+  whitespaces before it, and moves *p after it.
+  Returns false if the line is over or its next token is not a number at
+  most max.
+*/
+static bool
+next_number(const char **p, uint64_t max, uint64_t *x) {
+        while (isspace((unsigned char) **p))
+                (*p)++;
+        if (!isdigit((unsigned char) **p))
+                return false;
+        char *end;
+        errno = 0;
+        unsigned long long value = strtoull(*p, &end, 10);
+        if (errno != 0 || value > max)
+                return false;
+        *p = end;
+        *x = value;
+        return true;
+}
+
+/*
+  Parses the request in line into rp.
+  Returns NULL if the request is valid, or the reason why it is not.
+*/
+static const char *
+parse_request(const char *line, request_s *rp) {
+        const char *p = line;
+        uint64_t n, m;
+        if (!next_number(&p, UINT32_MAX, &n) || !next_number(&p, UINT32_MAX, &m))
+                return "the request must start with the numbers of species and of characters";
+        if (n == 0 || m == 0)
+                return "the matrix is empty";
+        size_t cells = 0;
+        for (uint64_t x; next_number(&p, 2, &x); cells++) {
+                if (cells == (uint64_t) n * m)
+                        return "too many values";
+                if (cells == rp->capacity) {
+                        rp->capacity = (rp->capacity > 0) ? 2 * rp->capacity : n * m;
+                        rp->matrix = xrealloc(rp->matrix, rp->capacity * sizeof(uint32_t));
+                }
+                rp->matrix[cells] = x;
+        }
+        while (isspace((unsigned char) *p))
+                p++;
+        if (*p != '\0')
+                return "each value must be 0, 1 or 2";
+        if (cells != (uint64_t) n * m)
+                return "too few values";
+        rp->num_species = n;
+        rp->num_characters = m;
+        return NULL;
+}
+
+uint64_t
+serve(cppp_solver_s *sp, FILE *in, FILE *out, bool write_counters, bool json) {
+        request_s request = { .matrix = NULL, .capacity = 0 };
+        char *line = NULL;
+        size_t line_capacity = 0;
+        uint64_t requests = 0;
+        while (getline(&line, &line_capacity, in) != -1) {
+                const char *p = line;
+                while (isspace((unsigned char) *p))
+                        p++;
+                if (*p == '\0')
+                        continue;
+                const char *invalid = parse_request(line, &request);
+                if (invalid != NULL) {
+                        log_debug("serve: request %" PRIu64 ": %s", requests, invalid);
+                        fprintf(out, "Error: %s\n", invalid);
+                } else {
+                        search_counters_s counters;
+                        char *tree = NULL;
+                        uint32_t status = cppp_solve(sp, request.matrix, request.num_species, request.num_characters,
+                                                     &counters, &tree);
+                        write_result(out, status, tree, write_counters ? &counters : NULL, json, requests);
+                }
+                fflush(out);
+                requests++;
+        }
+        free(line);
+        xfree(request.matrix);
+        return requests;
+}
@@ -0,0 +1,43 @@
+/*
+  cppp - Compute a Constrained Perfect Phylogeny, if it exists
+
+  Copyright (C) 2014 Gianluca Della Vedova
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2, or (at your option)
+  any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software Foundation,
+  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*/
+#ifndef CPPP_SERVER_H
+#define CPPP_SERVER_H
+#include "libcppp.h"
+
+/**
+   \brief answers the requests read from \c in, one per line, until the end
+   of \c in, with the solver \c sp.
+
+   Each request is a line with the number n of species, the number m of
+   characters and the n x m values of the matrix, row by row, separated by
+   whitespaces. Empty lines are ignored.
+   The answer is written to \c out, and flushed, as soon as the instance
+   is solved: it is the result line of \c write_result (the tree, "Not found"
+   or "Unknown", followed by the counters if \c write_counters is \c true,
+   in JSON if \c json is \c true), or "Error: " followed by the reason
+   why the request is malformed. The index of an instance in its counters
+   is the index of its request, starting from 0.
+
+   \return the number of requests
+*/
+uint64_t
+serve(cppp_solver_s *sp, FILE *in, FILE *out, bool write_counters, bool json);
+#endif
@@ -0,0 +1,313 @@
+#!/usr/bin/env ruby
+# coding: utf-8
+
+# Copyright 2015
+# Gianluca Della Vedova <http://gianluca.dellavedova.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# This program times bin/cppp, and optionally bin/cppp-sat, over some subsets
+# of the regression corpus, that is the inputs of tests/regression/input with
+# an expected output in tests/regression/ok, computed with the default
+# options. It must be run from the top
+# directory of the repository.
+#
+# Each subset (option -s) can be:
+# all   : the whole corpus
+# pp    : the files pp_*
+# no    : the files no_*
+# NxM   : the files of the size class NxM, such as 5x4 or 7x4
+# any other string is a glob relative to tests/regression/input
+#
+# Each file is solved --warmup times, whose results are discarded, then --runs
+# times. For each program and subset, the results are the number of
+# instances solved per second of wall time, the percentiles of the latency of
+# each instance and the peak resident set size of the processes, as reported
+# by cppp, since the peak measured by wait4 includes the memory of this
+# program before exec.
+# The latency of an instance is the time of its search, as reported by
+# cppp --stats=json, or the wall time of the process for cppp-sat, which
+# solves a single instance, hence it is run only on the files with one
+# instance.
+#
+# The results are written as JSON in the file given by --output (default
+# tests/bench/<commit>.json), and --compare prints, for each program and
+# subset, the ratios between the results and those of a previous file.
+
+require 'fiddle'
+require 'fileutils'
+require 'json'
+require 'optparse'
+require 'ostruct'
+require 'tmpdir'
+
+REG_DIR = "tests/regression"
+
+def parse_options(args)
+  options = OpenStruct.new
+  options.cppp = "bin/cppp"
+  options.cppp_sat = "bin/cppp-sat"
+  options.args = []
+  options.subsets = []
+  options.runs = 5
+  options.warmup = 1
+  options.output = nil
+  options.compare = nil
+
+  opt_parser = OptionParser.new do |opts|
+    opts.banner = "Usage: bench.rb [options]"
+
+    opts.separator ""
+    opts.separator "Specific options:"
+
+    opts.on("-b", "--binary CPPP_PATH", "cppp pathname (default bin/cppp)") do |path|
+      options.cppp = path
+    end
+
+    opts.on("-a", "--args ARGS", "additional arguments of cppp, such as --engine=sat") do |a|
+      options.args += a.split
+    end
+
+    opts.on("-s", "--subset SUBSET", "all, pp, no, a size class NxM or a glob (repeatable, default all)") do |s|
+      options.subsets.push(s)
+    end
+
+    opts.on("-r", "--runs N", Integer, "timed runs of each file (default 5)") do |n|
+      options.runs = n
+    end
+
+    opts.on("-w", "--warmup N", Integer, "untimed runs of each file (default 1)") do |n|
+      options.warmup = n
+    end
+
+    opts.on("-c", "--cryptominisat SAT_SOLVER_PATH",
+            "also time bin/cppp-sat with this SAT solver") do |path|
+      options.satpath = path
+    end
+
+    opts.on("-t", "--tree TREE_COMPUTER_PATH", "tree program of bin/cppp-sat") do |path|
+      options.treepath = path
+    end
+
+    opts.on("-o", "--output FILENAME", "results file (default tests/bench/<commit>.json)") do |path|
+      options.output = path
+    end
+
+    opts.on("-p", "--compare FILENAME", "results file to compare with") do |path|
+      options.compare = path
+    end
+
+    opts.on_tail("-h", "--help", "Show this message") do
+      puts opts
+      exit
+    end
+  end
+  opt_parser.parse!(args)
+  abort("--runs must be positive") if options.runs < 1
+  abort("--cryptominisat and --tree must be given together") if options.satpath.nil? != options.treepath.nil?
+  options.subsets.push("all") if options.subsets.empty?
+  options
+end
+
+# The files of the corpus in subset. The expected outputs computed by a
+# script of tests/regression/options are not solutions of their input file
+# with the default options, hence they are not in the corpus.
+def subset_files(subset)
+  corpus = Dir.glob("#{REG_DIR}/ok/*").map { |f| File.basename(f) }
+  corpus -= Dir.glob("#{REG_DIR}/options/*").map { |f| File.basename(f) }
+  glob = case subset
+         when "all" then "*"
+         when "pp", "no" then "#{subset}_*"
+         when /^\d+x\d+$/ then "*#{subset}*"
+         else subset
+         end
+  files = Dir.glob("#{REG_DIR}/input/#{glob}").select { |f| corpus.include?(File.basename(f)) }.sort
+  abort("No file of the corpus in subset #{subset}") if files.empty?
+  files
+end
+
+# The number of instances of an input file: the file starts with the number n
+# of species and the number m of characters, followed by the n x m values of
+# each instance. Just as cppp, a last value that is not followed by a
+# whitespace is not read.
+def count_instances(file)
+  data = File.read(file)
+  values = data.split
+  values.pop unless data =~ /\s\z/
+  return 0 if values.size < 2
+  size = values[0].to_i * values[1].to_i
+  size > 0 ? (values.size - 2) / size : 0
+end
+
+# wait4 gives the resource usage of each child, hence its peak RSS. The
+# field ru_maxrss follows the two struct timeval of struct rusage, and it is
+# in kilobytes, except on macOS where it is in bytes.
+begin
+  WAIT4 = Fiddle::Function.new(Fiddle::Handle::DEFAULT['wait4'],
+                               [Fiddle::TYPE_INT, Fiddle::TYPE_VOIDP, Fiddle::TYPE_INT, Fiddle::TYPE_VOIDP],
+                               Fiddle::TYPE_INT)
+rescue Fiddle::DLError
+  WAIT4 = nil
+end
+RUSAGE_SIZE = 256
+MAXRSS_OFFSET = 4 * Fiddle::SIZEOF_LONG
+MAXRSS_UNIT = RUBY_PLATFORM =~ /darwin/ ? 1024 : 1
+
+# Runs the command cmd, and returns its wall time in seconds, whether it has
+# exited with a code at most max_code, and its peak RSS in kilobytes (nil if
+# it cannot be known).
+def run(cmd, max_code)
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  pid = Process.spawn(*cmd, :out => File::NULL, :err => File::NULL)
+  if WAIT4.nil?
+    _, status = Process.wait2(pid)
+    wall = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+    return wall, !status.exitstatus.nil? && status.exitstatus <= max_code, nil
+  end
+  status = Fiddle::Pointer.malloc(Fiddle::SIZEOF_INT)
+  rusage = Fiddle::Pointer.malloc(RUSAGE_SIZE)
+  WAIT4.call(pid, status, 0, rusage)
+  wall = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  code = status[0, Fiddle::SIZEOF_INT].unpack("i")[0]
+  rss = rusage[MAXRSS_OFFSET, Fiddle::SIZEOF_LONG].unpack("l!")[0] / MAXRSS_UNIT
+  # the child has exited normally iff the low 7 bits are 0
+  return wall, (code & 0x7f) == 0 && ((code >> 8) & 0xff) <= max_code, rss
+end
+
+# The latencies, in microseconds, of the instances in the output of
+# cppp --stats=json, and the peak RSS reported by cppp, or nil if it is not
+# reported. elapsed_us and peak_rss_kb are missing in older versions.
+def cppp_records(output)
+  records = File.readlines(output).select { |l| l.start_with?("# {") }.map { |l| JSON.parse(l[2..-1]) }
+  times = records.map { |r| r["elapsed_us"] || r["time_ms"] * 1000 }
+  rss = records.map { |r| r["peak_rss_kb"] }.compact.max
+  return times, rss
+end
+
+# The value at the p-th percentile of the sorted array values (nearest rank)
+def percentile(values, p)
+  return nil if values.empty?
+  values[[(p / 100.0 * values.size).ceil - 1, 0].max]
+end
+
+# Times program over files. cmd builds the command line that solves a file,
+# with its output in a given file, and records gives the latencies of the
+# instances of an output and the peak RSS, if the program reports them.
+def bench(options, program, subset, files, cmd, max_code, records)
+  wall = 0.0
+  instances = 0
+  failures = 0
+  rss = nil
+  times = []
+  output = File.join(Dir.tmpdir, "cppp-bench-#{Process.pid}.out")
+  files.each do |file|
+    n = count_instances(file)
+    (options.warmup + options.runs).times do |i|
+      t, ok, r = run(cmd.call(file, output), max_code)
+      next if i < options.warmup
+      unless ok
+        failures += 1
+        next
+      end
+      latencies, reported = records.nil? ? [[(t * 1000000).round], nil] : records.call(output)
+      r = reported unless reported.nil?
+      rss = [rss || 0, r].max unless r.nil?
+      wall += t
+      instances += n
+      times += latencies
+    end
+  end
+  FileUtils.rm_f(output)
+  times.sort!
+  {
+    "program" => program,
+    "subset" => subset,
+    "files" => files.size,
+    "instances" => instances,
+    "failures" => failures,
+    "wall_s" => wall.round(6),
+    "instances_per_s" => wall > 0 ? (instances / wall).round(3) : nil,
+    "latency_us" => {
+      "p50" => percentile(times, 50),
+      "p95" => percentile(times, 95),
+      "p99" => percentile(times, 99),
+      "max" => times.last
+    },
+    "peak_rss_kb" => rss
+  }
+end
+
+def report(result)
+  l = result["latency_us"]
+  printf("%-9s %-12s %6d instances %10s inst/s  p50 %8s us  p95 %8s us  p99 %8s us  rss %7s kB%s\n",
+         result["program"], result["subset"], result["instances"], result["instances_per_s"].to_s,
+         l["p50"].to_s, l["p95"].to_s, l["p99"].to_s, result["peak_rss_kb"].to_s,
+         result["failures"] > 0 ? "  (#{result["failures"]} failed runs)" : "")
+end
+
+# The ratio new/old, as a string, or - if it cannot be computed
+def ratio(new, old)
+  (new.nil? || old.nil? || old == 0) ? "-" : format("%.3f", new.to_f / old)
+end
+
+def compare(results, previous)
+  puts "Compared with #{previous["commit"]} (ratio new/old):"
+  results.each do |r|
+    old = previous["results"].find { |p| p["program"] == r["program"] && p["subset"] == r["subset"] }
+    next if old.nil?
+    printf("%-9s %-12s inst/s %7s  p50 %7s  p95 %7s  p99 %7s  rss %7s\n",
+           r["program"], r["subset"], ratio(r["instances_per_s"], old["instances_per_s"]),
+           ratio(r["latency_us"]["p50"], old["latency_us"]["p50"]),
+           ratio(r["latency_us"]["p95"], old["latency_us"]["p95"]),
+           ratio(r["latency_us"]["p99"], old["latency_us"]["p99"]),
+           ratio(r["peak_rss_kb"], old["peak_rss_kb"]))
+  end
+end
+
+options = parse_options(ARGV)
+abort("Could not find #{options.cppp}") unless File.executable?(options.cppp)
+commit = `git rev-parse --short HEAD 2>/dev/null`.strip
+commit = "unknown" if commit.empty?
+
+results = []
+options.subsets.each do |subset|
+  files = subset_files(subset)
+  cppp = lambda { |file, output| [options.cppp, *options.args, "--stats=json", "-o", output, file] }
+  results.push(bench(options, "cppp", subset, files, cppp, 0, method(:cppp_records)))
+  report(results.last)
+  next if options.satpath.nil?
+  single = files.select { |f| count_instances(f) == 1 }
+  next if single.empty?
+  # cppp-sat exits with 1 when there is no phylogeny
+  sat = lambda { |file, output|
+    [options.cppp_sat, "-m", file, "-o", output, "-c", options.satpath, "-t", options.treepath]
+  }
+  results.push(bench(options, "cppp-sat", subset, single, sat, 1, nil))
+  report(results.last)
+end
+
+output = options.output || "tests/bench/#{commit}.json"
+FileUtils.mkdir_p(File.dirname(output))
+File.write(output, JSON.pretty_generate({
+  "commit" => commit,
+  "date" => Time.now.utc.strftime("%Y-%m-%dT%H:%M:%SZ"),
+  "host" => `uname -nm 2>/dev/null`.strip,
+  "cppp" => options.cppp,
+  "args" => options.args,
+  "runs" => options.runs,
+  "warmup" => options.warmup,
+  "results" => results
+}) + "\n")
+puts "Results written to #{output}"
+compare(results, JSON.parse(File.read(options.compare))) unless options.compare.nil?
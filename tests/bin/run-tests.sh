@@ -1,5 +1,11 @@
 #!/bin/bash
 
+# Each expected output ok/NAME is compared with the output of bin/cppp on
+# input/NAME, with the default options.
+# If the script options/NAME exists, it computes instead the output: it is
+# run by bash with the variables regdir and o (the output file) and it can
+# use any file of ${regdir}/input, and o.* as temporary files.
+
 regdir="tests/regression"
 test -d "${regdir}/output" || mkdir -p "${regdir}/output"
 test -d "${regdir}/diffs" || mkdir -p "${regdir}/diffs"
@@ -7,10 +13,17 @@ for t in ${regdir}/ok/*
 do
     f=$(basename "$t")
     o="${regdir}/output/${f}"
-    test -f "$o" || echo "Could not find $o"
-    test -f "${regdir}/input/${f}" || echo "Could not find ${regdir}/input/${f}"
-    echo "Solving ${regdir}/input/${f}"
-    bin/cppp -o "$o" "${regdir}/input/${f}"
+    if test -f "${regdir}/options/${f}"
+    then
+        echo "Running ${regdir}/options/${f}"
+        rm -f "$o" "$o".*
+        regdir="$regdir" o="$o" bash "${regdir}/options/${f}" > /dev/null 2>&1
+    else
+        test -f "$o" || echo "Could not find $o"
+        test -f "${regdir}/input/${f}" || echo "Could not find ${regdir}/input/${f}"
+        echo "Solving ${regdir}/input/${f}"
+        bin/cppp -o "$o" "${regdir}/input/${f}"
+    fi
     diff -uNaw --strip-trailing-cr --ignore-all-space "${o}" "$t" >  "${regdir}/diffs/${f}"
 
     # Remove empty diffs
@@ -0,0 +1,9 @@
+cppp checkpoint 1
+instances 1 18446744073709551615 101
+search 14 10 165d8271593290bf 64f5f32151a7ef55 100 0 0 6
+-1 1 8 2 3 4 5 6 7 8 9
+0 5 4 6 7 8 9
+1 2 6 3 4 6 7 8 9
+2 5 7 3 4 6 7 8 9 0
+2 7 2 8 9
+4 -1 3 6 8 9